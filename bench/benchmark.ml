@@ -154,6 +154,96 @@ let calculate_fee store =
   done;
   !max_fee
 
+(** Zero-conf outputs.
+
+    Processes one block at a time: all of a block's transactions share its
+    height, so the join on height is a lookup in the set of IDs from the
+    block's tx list, without reading the tx records.
+
+    {v
+    MATCH (t1:Transaction)-[:TX_OUTPUT]->(o:Output)<-[:TX_INPUT]-(t2:Transaction)
+    WHERE t1.blockHeight = t2.blockHeight
+    RETURN count(o) AS value;
+    v} *)
+let zero_conf_outputs store =
+  let last_height = Query.last_block_height store in
+  let count = ref 0 in
+  for height = 0 to last_height do
+    let tx_ids = Query.block_tx_ids store height in
+    let in_block = Hashtbl.create (List.length tx_ids) in
+    List.iter (fun tx_id -> Hashtbl.replace in_block tx_id ()) tx_ids;
+    List.iter
+      (fun tx_id ->
+        List.iter
+          (fun vout ->
+            match Query.output_spent_by store tx_id (int_of_string vout) with
+            | Some spender when Hashtbl.mem in_block spender -> incr count
+            | _ -> ())
+          (Store.list store (Store.spent_by_tx_path tx_id)))
+      tx_ids
+  done;
+  !count
+
+(** Locktime change.
+
+    {v
+    MATCH (t1:Transaction)-[:TX_OUTPUT]->(o:Output)<-[:TX_INPUT]-(t2:Transaction)
+    WHERE (t1.locktime > 0) = (t2.locktime > 0)
+    WITH t1, count(o) AS matching_count
+    WHERE matching_count = 1
+    RETURN count(t1) AS value;
+    v} *)
+let locktime_change store =
+  let last_height = Query.last_block_height store in
+  let count = ref 0 in
+  let locked tx_id =
+    match Query.get_transaction store tx_id with
+    | Some tx -> Some (tx.tx_locktime > 0L)
+    | None -> None
+  in
+  for height = 0 to last_height do
+    let txs = Query.block_transactions store height in
+    List.iter
+      (fun (tx : Types.transaction) ->
+        let creator_locked = tx.tx_locktime > 0L in
+        let matching =
+          List.fold_left
+            (fun acc vout ->
+              match Query.output_spent_by store tx.tx_id (int_of_string vout) with
+              | Some spender when locked spender = Some creator_locked -> acc + 1
+              | _ -> acc)
+            0
+            (Store.list store (Store.spent_by_tx_path tx.tx_id))
+        in
+        if matching = 1 then incr count)
+      txs
+  done;
+  !count
+
+(** Satoshi Dice address: sum of outputs sent to a set of addresses.
+
+    An output listed under several of the addresses is counted once.
+
+    {v
+    MATCH (a:Address)<-[:TO_ADDRESS]-(o:Output)
+    WHERE a.addressId IN $addresses
+    RETURN sum(DISTINCT o.value) AS value;
+    v} *)
+let satoshi_dice store addresses =
+  let seen = Hashtbl.create 1024 in
+  List.fold_left
+    (fun acc addr ->
+      List.fold_left
+        (fun acc (o : Types.output) ->
+          if Hashtbl.mem seen (o.out_tx_id, o.out_vout) then acc
+          else begin
+            Hashtbl.add seen (o.out_tx_id, o.out_vout) ();
+            Int64.add acc o.out_value
+          end)
+        acc
+        (Query.address_outputs store addr))
+    0L addresses
+
 (** {1 Additional Queries} *)
 
 (** Total output value.
@@ -368,7 +458,7 @@ let multi_input_tx store =
 
 (** {1 Main benchmark runner} *)
 
-let run_benchmarks store =
+let run_benchmarks ?(addresses = []) store =
   results := [];
 
   (* Basic Counts *)
@@ -382,6 +472,10 @@ let run_benchmarks store =
   let _ = time_it "Tx locktime > 0" (fun () -> Int64.of_int (tx_locktime_gt_0 store)) in
   let _ = time_it "Max output value" (fun () -> max_output_value store) in
   let _ = time_it "Calculate fee" (fun () -> calculate_fee store) in
+  let _ = time_it "Zero-conf outputs" (fun () -> Int64.of_int (zero_conf_outputs store)) in
+  let _ = time_it "Locktime change" (fun () -> Int64.of_int (locktime_change store)) in
+  if addresses <> [] then
+    ignore (time_it "Satoshi Dice address" (fun () -> satoshi_dice store addresses));
 
   (* Additional Queries *)
   let _ = time_it "Total output value" (fun () -> total_output_value store) in
@@ -414,21 +508,34 @@ let output_csv () =
 
 let default_store = "/tmp/irmin-blocksci-store"
 
-let run_with_store ~sw ~fs store_path =
+let run_with_store ~sw ~fs ~addresses store_path =
   let root = Eio.Path.(fs / store_path) in
   let repo = Store.init ~sw ~fs root in
   let main = Store.main repo in
   Fun.protect
     ~finally:(fun () -> Store.Store.Repo.close repo)
     (fun () ->
-      run_benchmarks main;
+      run_benchmarks ~addresses main;
       output_csv ())
 
-let () =
-  let store_path =
-    if Array.length Sys.argv > 1 then Sys.argv.(1) else default_store
+let usage = "Usage: irmin-blocksci-bench [STORE] [-a ADDRESS_ID[,ADDRESS_ID...]]"
+
+(** Parse [STORE] and [-a ADDRESS_IDS] (comma-separated) from the command line. *)
+let parse_args argv =
+  let rec go store addresses = function
+    | [] -> (store, addresses)
+    | ("-a" | "--address") :: ids :: rest ->
+        go store (addresses @ String.split_on_char ',' ids) rest
+    | arg :: _ when String.length arg > 0 && arg.[0] = '-' ->
+        prerr_endline usage;
+        exit 1
+    | path :: rest -> go path addresses rest
   in
+  go default_store [] (List.tl (Array.to_list argv))
+
+let () =
+  let store_path, addresses = parse_args Sys.argv in
   Eio_main.run @@ fun env ->
   Eio.Switch.run @@ fun sw ->
   let fs = Eio.Stdenv.fs env in
-  run_with_store ~sw ~fs store_path
+  run_with_store ~sw ~fs ~addresses store_path
@@ -9,6 +9,27 @@ let run_with_store ~sw ~fs store_path f =
   let main = Store.main repo in
   Fun.protect ~finally:(fun () -> Store.Store.Repo.close repo) (fun () -> f main)
 
+(** [--at H]: run against the commit recorded for block H. *)
+let at_height =
+  Arg.(
+    value
+    & opt (some int) None
+    & info [ "at" ] ~docv:"HEIGHT"
+        ~doc:"Query the store as of block HEIGHT (needs import --commit-per-block)")
+
+(** [main], or [main] as of block [at]; prints why and returns [None] if
+    that block has no recorded commit. *)
+let as_of main store_path at =
+  match at with
+  | None -> Some main
+  | Some height -> (
+      match History.at main (History.file_of_store store_path) height with
+      | Some store -> Some store
+      | None ->
+          Printf.printf "No commit recorded for block %d in %s\n" height
+            (History.file_of_store store_path);
+          None)
+
 let import_cmd env =
   let doc = "Import BlockSci CSV export into Irmin store" in
   let export_dir =
@@ -24,15 +45,79 @@ let import_cmd env =
       & info [ "s"; "store" ] ~docv:"PATH"
           ~doc:"Path to the Irmin store (default: /tmp/irmin-blocksci-store)")
   in
-  let run export_dir store_path =
+  let packed =
+    Arg.(
+      value & flag
+      & info [ "packed" ]
+          ~doc:
+            "Store each transaction's inputs and outputs as one packed value \
+             instead of one leaf per entry. A store keeps the layout of its \
+             first packed import.")
+  in
+  let summaries =
+    Arg.(
+      value & flag
+      & info [ "summaries" ]
+          ~doc:
+            "Store each transaction's fee, locktime, version, input and output \
+             counts and output value in its index/block_txs entry, so \
+             tx-level scans need one read per transaction.")
+  in
+  let values =
+    Arg.(
+      value & flag
+      & info [ "output-values" ]
+          ~doc:
+            "Store each output's value and script type code in its \
+             index/tx_outputs reference, so value aggregates skip the output \
+             record.")
+  in
+  let binary =
+    Arg.(
+      value & flag
+      & info [ "binary-records" ]
+          ~doc:
+            "Store block and transaction records in a binary form with raw \
+             32-byte hashes instead of JSON with 64-digit hex. Hashes are \
+             still hex in every query result.")
+  in
+  let per_block =
+    Arg.(
+      value & flag
+      & info [ "commit-per-block" ]
+          ~doc:
+            "Commit once per new block and record each height's commit in \
+             PATH.heights, so queries can run as of any imported block \
+             (--at). Holds the import in memory until the end.")
+  in
+  let run export_dir store_path packed summaries values binary per_block =
     Eio.Switch.run @@ fun sw ->
     let fs = Eio.Stdenv.fs env in
     run_with_store ~sw ~fs store_path (fun main ->
         let dir = Eio.Path.(fs / export_dir) in
-        Import.import_all main dir)
+        let heights =
+          if per_block then Some (History.file_of_store store_path) else None
+        in
+        Import.import_all ~packed ~summaries ~values ~binary ?heights main dir;
+        Hash_index.update main (Hash_index.dir_of_store store_path);
+        let aggregates = Incremental.dir_of_store store_path in
+        if Sys.file_exists aggregates then
+          ignore (Incremental.update main aggregates))
   in
   let info = Cmd.info "import" ~doc in
-  Cmd.v info Term.(const run $ export_dir $ store_path)
+  Cmd.v info
+    Term.(
+      const run $ export_dir $ store_path $ packed $ summaries $ values $ binary
+      $ per_block)
+
+let print_block_details main (block : Types.block) =
+  Query.print_block block;
+  let txs = Query.block_transactions main block.height in
+  Printf.printf "  Transactions: %d\n" (List.length txs);
+  List.iter
+    (fun (tx : Types.transaction) ->
+      Printf.printf "    TX %d: %s\n" tx.tx_id tx.tx_hash)
+    txs
 
 let query_block_cmd env =
   let doc = "Query a block by height" in
@@ -52,18 +137,77 @@ let query_block_cmd env =
     run_with_store ~sw ~fs store_path (fun main ->
         match Query.get_block main height with
         | None -> Printf.printf "Block %d not found\n" height
-        | Some block ->
-            Query.print_block block;
-            let txs = Query.block_transactions main height in
-            Printf.printf "  Transactions: %d\n" (List.length txs);
-            List.iter
-              (fun (tx : Types.transaction) ->
-                Printf.printf "    TX %d: %s\n" tx.tx_id tx.tx_hash)
-              txs)
+        | Some block -> print_block_details main block)
   in
   let info = Cmd.info "block" ~doc in
   Cmd.v info Term.(const run $ height $ store_path)
 
+let query_blockhash_cmd env =
+  let doc = "Query a block by hash" in
+  let hash =
+    Arg.(
+      required & pos 0 (some string) None & info [] ~docv:"HASH" ~doc:"Block hash")
+  in
+  let store_path =
+    Arg.(
+      value
+      & opt string default_store
+      & info [ "s"; "store" ] ~docv:"PATH" ~doc:"Path to the Irmin store")
+  in
+  let run hash store_path =
+    Eio.Switch.run @@ fun sw ->
+    let fs = Eio.Stdenv.fs env in
+    match Hash_index.open_block (Hash_index.dir_of_store store_path) with
+    | None ->
+        Printf.printf "No block hash index for %s (run index first)\n"
+          store_path
+    | Some idx ->
+        run_with_store ~sw ~fs store_path (fun main ->
+            match Hash_index.find_block idx main hash with
+            | None -> Printf.printf "Block %s not found\n" hash
+            | Some block -> print_block_details main block)
+  in
+  let info = Cmd.info "blockhash" ~doc in
+  Cmd.v info Term.(const run $ hash $ store_path)
+
+let print_tx_details main tx_id =
+  match Query.tx_details main tx_id with
+  | None -> Printf.printf "Transaction %d not found\n" tx_id
+  | Some (tx, inputs, outputs, block) ->
+      Query.print_transaction tx;
+      (match block with
+      | Some (b : Types.block) ->
+          Printf.printf "  In block: %d (%s)\n" b.height b.hash
+      | None -> ());
+      Printf.printf "  Inputs (%d):\n" (List.length inputs);
+      List.iter
+        (fun ((inp : Types.input), spent_output, addr) ->
+          Printf.printf "    [%d] spends %d:%d" inp.in_index
+            inp.in_spent_tx_id inp.in_spent_vout;
+          (match spent_output with
+          | Some (o : Types.output) ->
+              Printf.printf " (%Ld satoshis = %.8f BTC)" o.out_value
+                (Query.satoshis_to_btc o.out_value)
+          | None -> ());
+          (match addr with
+          | Some a -> Printf.printf " from %s" a
+          | None -> ());
+          Printf.printf "\n")
+        inputs;
+      Printf.printf "  Outputs (%d):\n" (List.length outputs);
+      List.iter
+        (fun ((o : Types.output), addr) ->
+          Printf.printf "    [%d] %Ld satoshis = %.8f BTC (%s)" o.out_vout
+            o.out_value (Query.satoshis_to_btc o.out_value) o.out_script_type;
+          (match addr with Some a -> Printf.printf " to %s" a | None -> ());
+          let spent =
+            if Query.is_output_spent main o.out_tx_id o.out_vout then
+              " [SPENT]"
+            else " [UNSPENT]"
+          in
+          Printf.printf "%s\n" spent)
+        outputs
+
 let query_tx_cmd env =
   let doc = "Query a transaction by ID" in
   let tx_id =
@@ -80,46 +224,39 @@ let query_tx_cmd env =
     Eio.Switch.run @@ fun sw ->
     let fs = Eio.Stdenv.fs env in
     run_with_store ~sw ~fs store_path (fun main ->
-        match Query.tx_details main tx_id with
-        | None -> Printf.printf "Transaction %d not found\n" tx_id
-        | Some (tx, inputs, outputs, block) ->
-            Query.print_transaction tx;
-            (match block with
-            | Some (b : Types.block) ->
-                Printf.printf "  In block: %d (%s)\n" b.height b.hash
-            | None -> ());
-            Printf.printf "  Inputs (%d):\n" (List.length inputs);
-            List.iter
-              (fun ((inp : Types.input), spent_output, addr) ->
-                Printf.printf "    [%d] spends %d:%d" inp.in_index
-                  inp.in_spent_tx_id inp.in_spent_vout;
-                (match spent_output with
-                | Some (o : Types.output) ->
-                    Printf.printf " (%Ld satoshis = %.8f BTC)" o.out_value
-                      (Query.satoshis_to_btc o.out_value)
-                | None -> ());
-                (match addr with
-                | Some a -> Printf.printf " from %s" a
-                | None -> ());
-                Printf.printf "\n")
-              inputs;
-            Printf.printf "  Outputs (%d):\n" (List.length outputs);
-            List.iter
-              (fun ((o : Types.output), addr) ->
-                Printf.printf "    [%d] %Ld satoshis = %.8f BTC (%s)" o.out_vout
-                  o.out_value (Query.satoshis_to_btc o.out_value) o.out_script_type;
-                (match addr with Some a -> Printf.printf " to %s" a | None -> ());
-                let spent =
-                  if Query.is_output_spent main o.out_tx_id o.out_vout then
-                    " [SPENT]"
-                  else " [UNSPENT]"
-                in
-                Printf.printf "%s\n" spent)
-              outputs)
+        print_tx_details main tx_id)
   in
   let info = Cmd.info "tx" ~doc in
   Cmd.v info Term.(const run $ tx_id $ store_path)
 
+let query_txhash_cmd env =
+  let doc = "Query a transaction by hash" in
+  let hash =
+    Arg.(
+      required & pos 0 (some string) None & info [] ~docv:"HASH" ~doc:"Transaction hash")
+  in
+  let store_path =
+    Arg.(
+      value
+      & opt string default_store
+      & info [ "s"; "store" ] ~docv:"PATH" ~doc:"Path to the Irmin store")
+  in
+  let run hash store_path =
+    Eio.Switch.run @@ fun sw ->
+    let fs = Eio.Stdenv.fs env in
+    match Hash_index.open_tx (Hash_index.dir_of_store store_path) with
+    | None ->
+        Printf.printf "No transaction hash index for %s (run index first)\n"
+          store_path
+    | Some idx ->
+        run_with_store ~sw ~fs store_path (fun main ->
+            match Hash_index.find_tx idx main hash with
+            | None -> Printf.printf "Transaction %s not found\n" hash
+            | Some (tx : Types.transaction) -> print_tx_details main tx.tx_id)
+  in
+  let info = Cmd.info "txhash" ~doc in
+  Cmd.v info Term.(const run $ hash $ store_path)
+
 let query_balance_cmd env =
   let doc = "Query balance for an address" in
   let address =
@@ -132,29 +269,66 @@ let query_balance_cmd env =
       & opt string default_store
       & info [ "s"; "store" ] ~docv:"PATH" ~doc:"Path to the Irmin store")
   in
-  let run address store_path =
+  let run address store_path at =
     Eio.Switch.run @@ fun sw ->
     let fs = Eio.Stdenv.fs env in
     run_with_store ~sw ~fs store_path (fun main ->
-        match Query.get_address main address with
-        | None -> Printf.printf "Address %s not found\n" address
-        | Some addr ->
-            Query.print_address addr;
-            let outputs = Query.address_outputs main address in
-            Printf.printf "Total outputs: %d\n" (List.length outputs);
-            let unspent =
-              List.filter
-                (fun (o : Types.output) ->
-                  not (Query.is_output_spent main o.out_tx_id o.out_vout))
-                outputs
-            in
-            Printf.printf "Unspent outputs: %d\n" (List.length unspent);
-            let balance = Query.address_balance main address in
-            Printf.printf "Balance: %Ld satoshis = %.8f BTC\n" balance
-              (Query.satoshis_to_btc balance))
+        Option.iter
+          (fun store ->
+            match Query.get_address store address with
+            | None -> Printf.printf "Address %s not found\n" address
+            | Some addr ->
+                Query.print_address addr;
+                let outputs = Query.address_outputs store address in
+                Printf.printf "Total outputs: %d\n" (List.length outputs);
+                let unspent =
+                  List.filter
+                    (fun (o : Types.output) ->
+                      not (Query.is_output_spent store o.out_tx_id o.out_vout))
+                    outputs
+                in
+                Printf.printf "Unspent outputs: %d\n" (List.length unspent);
+                let balance = Query.address_balance store address in
+                Printf.printf "Balance: %Ld satoshis = %.8f BTC\n" balance
+                  (Query.satoshis_to_btc balance))
+          (as_of main store_path at))
   in
   let info = Cmd.info "balance" ~doc in
-  Cmd.v info Term.(const run $ address $ store_path)
+  Cmd.v info Term.(const run $ address $ store_path $ at_height)
+
+let query_address_cmd _env =
+  let doc = "Find addresses by string or prefix" in
+  let prefix =
+    Arg.(
+      required
+      & pos 0 (some string) None
+      & info [] ~docv:"PREFIX" ~doc:"Address string or prefix")
+  in
+  let limit =
+    Arg.(
+      value & opt int 20
+      & info [ "n"; "count" ] ~doc:"Maximum number of addresses to list")
+  in
+  let store_path =
+    Arg.(
+      value
+      & opt string default_store
+      & info [ "s"; "store" ] ~docv:"PATH" ~doc:"Path to the Irmin store")
+  in
+  let run prefix limit store_path =
+    match Hash_index.Address.open_ (Hash_index.dir_of_store store_path) with
+    | None ->
+        Printf.printf "No address index for %s (run index first)\n" store_path
+    | Some idx -> (
+        match Hash_index.Address.search ~limit idx prefix with
+        | [] -> Printf.printf "No address starts with %s\n" prefix
+        | matches ->
+            List.iter
+              (fun (addr, id) -> Printf.printf "%s  (address ID %s)\n" addr id)
+              matches)
+  in
+  let info = Cmd.info "address" ~doc in
+  Cmd.v info Term.(const run $ prefix $ limit $ store_path)
 
 let query_chain_cmd env =
   let doc = "Query a range of blocks" in
@@ -263,8 +437,11 @@ let query_cmd env =
   Cmd.group info
     [
       query_block_cmd env;
+      query_blockhash_cmd env;
       query_tx_cmd env;
+      query_txhash_cmd env;
       query_balance_cmd env;
+      query_address_cmd env;
       query_chain_cmd env;
       query_output_cmd env;
       query_info_cmd env;
@@ -283,16 +460,221 @@ let serve_cmd env =
       & opt string default_store
       & info [ "s"; "store" ] ~docv:"PATH" ~doc:"Path to the Irmin store")
   in
-  let run port store_path =
+  let no_cache =
+    Arg.(
+      value & flag
+      & info [ "no-cache" ] ~doc:"Do not cache responses in PATH.cache")
+  in
+  let run port store_path no_cache =
     Eio.Switch.run @@ fun sw ->
     let fs = Eio.Stdenv.fs env in
     let clock = Eio.Stdenv.clock env in
+    let cache =
+      if no_cache then None else Some (Result_cache.dir_of_store store_path)
+    in
     Lwt_eio.with_event_loop ~clock @@ fun _token ->
+    let indexes = Hash_index.open_dir (Hash_index.dir_of_store store_path) in
+    let snapshot = Snapshot.Reader.open_ (Snapshot.dir_of_store store_path) in
     run_with_store ~sw ~fs store_path (fun main ->
-        Lwt_eio.run_lwt (fun () -> Graphql_server.start_server ~port main))
+        Lwt_eio.run_lwt (fun () ->
+            Graphql_server.start_server ~indexes ?snapshot ?cache ~port main))
   in
   let info = Cmd.info "serve" ~doc in
-  Cmd.v info Term.(const run $ port $ store_path)
+  Cmd.v info Term.(const run $ port $ store_path $ no_cache)
+
+let snapshot_cmd env =
+  let doc = "Export a CSR snapshot of the transaction graph" in
+  let store_path =
+    Arg.(
+      value
+      & opt string default_store
+      & info [ "s"; "store" ] ~docv:"PATH" ~doc:"Path to the Irmin store")
+  in
+  let output =
+    Arg.(
+      value
+      & opt (some string) None
+      & info [ "o"; "output" ] ~docv:"DIR"
+          ~doc:"Snapshot directory (default: PATH.snapshot)")
+  in
+  let run store_path output =
+    Eio.Switch.run @@ fun sw ->
+    let fs = Eio.Stdenv.fs env in
+    let dir = Option.value output ~default:(Snapshot.dir_of_store store_path) in
+    run_with_store ~sw ~fs store_path (fun main -> Snapshot.export main dir)
+  in
+  let info = Cmd.info "snapshot" ~doc in
+  Cmd.v info Term.(const run $ store_path $ output)
+
+let richlist_cmd _env =
+  let doc = "List the addresses with the highest balance" in
+  let store_path =
+    Arg.(
+      value
+      & opt string default_store
+      & info [ "s"; "store" ] ~docv:"PATH" ~doc:"Path to the Irmin store")
+  in
+  let count =
+    Arg.(
+      value & opt int 100
+      & info [ "k"; "count" ] ~docv:"K" ~doc:"Number of addresses to list")
+  in
+  let run store_path k =
+    let dir = Snapshot.dir_of_store store_path in
+    match Snapshot.Reader.open_ dir with
+    | None -> Printf.printf "No snapshot in %s (run snapshot first)\n" dir
+    | Some snap ->
+        List.iteri
+          (fun i (addr, balance) ->
+            Printf.printf "%d. %s %Ld satoshis = %.8f BTC\n" (i + 1) addr balance
+              (Query.satoshis_to_btc balance))
+          (Snapshot.Reader.top_balances snap k)
+  in
+  let info = Cmd.info "richlist" ~doc in
+  Cmd.v info Term.(const run $ store_path $ count)
+
+let cypher_cmd env =
+  let doc = "Run a Cypher query (MATCH ... RETURN subset) against the store" in
+  let query =
+    Arg.(
+      required
+      & pos 0 (some string) None
+      & info [] ~docv:"QUERY" ~doc:"Query, e.g. \"MATCH (t:Transaction) RETURN count(t)\"")
+  in
+  let params =
+    Arg.(
+      value & opt_all string []
+      & info [ "p"; "param" ] ~docv:"NAME=VALUE" ~doc:"Bind \\$NAME (repeatable)")
+  in
+  let store_path =
+    Arg.(
+      value
+      & opt string default_store
+      & info [ "s"; "store" ] ~docv:"PATH" ~doc:"Path to the Irmin store")
+  in
+  let no_cache =
+    Arg.(
+      value & flag
+      & info [ "no-cache" ] ~doc:"Recompute instead of using PATH.cache")
+  in
+  let run query params store_path no_cache =
+    Eio.Switch.run @@ fun sw ->
+    let fs = Eio.Stdenv.fs env in
+    let params =
+      List.filter_map
+        (fun p ->
+          match String.index_opt p '=' with
+          | Some i -> Some (String.sub p 0 i, String.sub p (i + 1) (String.length p - i - 1))
+          | None ->
+              Printf.printf "Ignoring parameter %s (use NAME=VALUE)\n" p;
+              None)
+        params
+    in
+    run_with_store ~sw ~fs store_path (fun main ->
+        let execute () =
+          let result =
+            Cypher.run
+              ~params:(List.map (fun (k, v) -> (k, Cypher.value_of_string v)) params)
+              main query
+          in
+          String.concat "\t" result.Cypher.columns
+          :: List.map
+               (fun row -> String.concat "\t" (List.map Cypher.to_string row))
+               result.Cypher.rows
+          |> List.map (fun line -> line ^ "\n")
+          |> String.concat ""
+        in
+        let cache =
+          if no_cache then None
+          else Result_cache.at_head (Result_cache.dir_of_store store_path) main
+        in
+        let output () =
+          match cache with
+          | Some cache ->
+              Result_cache.memo cache ~query:("cypher " ^ query) ~params execute
+          | None -> execute ()
+        in
+        match output () with
+        | exception Cypher.Error msg -> Printf.printf "Cypher error: %s\n" msg
+        | output -> print_string output)
+  in
+  let info = Cmd.info "cypher" ~doc in
+  Cmd.v info Term.(const run $ query $ params $ store_path $ no_cache)
+
+let aggregates_cmd env =
+  let doc = "Print the benchmark aggregates, updated from the last saved commit" in
+  let store_path =
+    Arg.(
+      value
+      & opt string default_store
+      & info [ "s"; "store" ] ~docv:"PATH" ~doc:"Path to the Irmin store")
+  in
+  let run store_path at =
+    Eio.Switch.run @@ fun sw ->
+    let fs = Eio.Stdenv.fs env in
+    run_with_store ~sw ~fs store_path (fun main ->
+        Option.iter
+          (fun store ->
+            match Incremental.update store (Incremental.dir_of_store store_path) with
+            | None -> print_endline "Store is empty"
+            | Some state ->
+                print_endline "Query,Result";
+                List.iter
+                  (fun (name, value) -> Printf.printf "%s,%Ld\n" name value)
+                  (Incremental.report state))
+          (as_of main store_path at))
+  in
+  let info = Cmd.info "aggregates" ~doc in
+  Cmd.v info Term.(const run $ store_path $ at_height)
+
+let reorg_cmd env =
+  let doc = "Replace orphaned blocks with those of a CSV export" in
+  let export_dir =
+    Arg.(
+      required
+      & pos 0 (some string) None
+      & info [] ~docv:"DIR" ~doc:"CSV export of the new chain tip")
+  in
+  let store_path =
+    Arg.(
+      value
+      & opt string default_store
+      & info [ "s"; "store" ] ~docv:"PATH" ~doc:"Path to the Irmin store")
+  in
+  let run export_dir store_path =
+    Eio.Switch.run @@ fun sw ->
+    let fs = Eio.Stdenv.fs env in
+    run_with_store ~sw ~fs store_path (fun main ->
+        let old_head = Store.Store.Head.find main in
+        let heights = History.file_of_store store_path in
+        match Reorg.run main ~heights Eio.Path.(fs / export_dir) with
+        | exception Failure msg -> Printf.printf "Reorg failed: %s\n" msg
+        | fork ->
+            Printf.printf "Chain replaced from block %d\n" fork;
+            Hash_index.update main (Hash_index.dir_of_store store_path);
+            let aggregates = Incremental.dir_of_store store_path in
+            if Sys.file_exists aggregates then
+              ignore (Incremental.update ?from:old_head main aggregates))
+  in
+  let info = Cmd.info "reorg" ~doc in
+  Cmd.v info Term.(const run $ export_dir $ store_path)
+
+let index_cmd env =
+  let doc = "Rebuild the hash lookup indexes of a store" in
+  let store_path =
+    Arg.(
+      value
+      & opt string default_store
+      & info [ "s"; "store" ] ~docv:"PATH" ~doc:"Path to the Irmin store")
+  in
+  let run store_path =
+    Eio.Switch.run @@ fun sw ->
+    let fs = Eio.Stdenv.fs env in
+    run_with_store ~sw ~fs store_path (fun main ->
+        Hash_index.build main (Hash_index.dir_of_store store_path))
+  in
+  let info = Cmd.info "index" ~doc in
+  Cmd.v info Term.(const run $ store_path)
 
 let main_cmd env =
   let doc = "BlockSci data stored in Irmin" in
@@ -305,18 +687,37 @@ let main_cmd env =
             "Store and query Bitcoin blockchain data from BlockSci CSV exports \
              using Irmin.";
           `S Manpage.s_commands;
-          `P "import DIR - Import CSV data from DIR";
+          `P "import DIR [--commit-per-block] - Import CSV data from DIR";
           `P "query block HEIGHT - Query block at HEIGHT";
+          `P "query blockhash HASH - Query block by hash";
           `P "query tx TX_ID - Query transaction TX_ID";
-          `P "query balance ADDRESS - Query balance for ADDRESS";
+          `P "query txhash HASH - Query transaction by hash";
+          `P "query balance ADDRESS [--at HEIGHT] - Query balance for ADDRESS";
+          `P "query address PREFIX [-n COUNT] - Find addresses by prefix";
           `P "query chain START [-n COUNT] - Query blocks from START";
           `P "query output TX_ID:VOUT - Query output";
           `P "query info - Show store information (last block height)";
-          `P "serve [-p PORT] - Start GraphQL server";
+          `P "serve [-p PORT] [--no-cache] - Start GraphQL server";
+          `P "snapshot [-o DIR] - Export a CSR snapshot of the graph";
+          `P "index - Rebuild the hash lookup indexes (PATH.index)";
+          `P "richlist [-k K] - List the K richest addresses (from the snapshot)";
+          `P "cypher QUERY [-p NAME=VALUE] [--no-cache] - Run a Cypher query (see lib/cypher.ml)";
+          `P "reorg DIR - Roll back orphaned blocks and import DIR (needs --commit-per-block)";
+          `P "aggregates [--at HEIGHT] - Print the benchmark aggregates (kept in PATH.aggregates)";
         ]
   in
   Cmd.group info ~default:Term.(ret (const (`Help (`Pager, None))))
-    [ import_cmd env; query_cmd env; serve_cmd env ]
+    [
+      import_cmd env;
+      query_cmd env;
+      serve_cmd env;
+      snapshot_cmd env;
+      index_cmd env;
+      richlist_cmd env;
+      cypher_cmd env;
+      aggregates_cmd env;
+      reorg_cmd env;
+    ]
 
 let () =
   Eio_main.run @@ fun env ->
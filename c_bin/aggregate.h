@@ -0,0 +1,85 @@
+/**
+ * Specialised aggregate scans for the benchmark queries.
+ *
+ * Most Table 7 queries are the same loop: walk the blocks, fetch the tx
+ * summaries of each one and fold a field into a count, sum or max. The
+ * macros here generate one static function per query with the field, the
+ * fold and the filter expanded inline, so the compiler sees a plain loop
+ * for each query while the scan itself is written once:
+ *
+ *     DEFINE_TX_AGGREGATE(query_total_fees, SUMMARY_TX, SUM, tx->fee, 1)
+ *
+ * The field and predicate are expressions over `const tx_summary_t *tx`.
+ * Each block is folded into a partial result that is then combined into
+ * the total; when `partials` is set, a block whose content key
+ * (block_content_key) already has a partial for the query skips its
+ * transactions (see partial_cache.h). Partials are only stored for blocks
+ * whose tx summaries came whole from their index/block_txs leaves, since
+ * the key covers nothing else. The including file must define
+ * tx_summary_t, block_tx_summaries, block_content_key, partials,
+ * find_last_block_height, list_path and repo before expanding them.
+ */
+
+#ifndef BLOCKSCI_AGGREGATE_H
+#define BLOCKSCI_AGGREGATE_H
+
+/* Fold steps: acc is the running result, v the field of a matching tx */
+#define AGG_INIT_COUNT 0
+#define AGG_INIT_SUM 0
+#define AGG_INIT_MAX 0
+#define AGG_STEP_COUNT(acc, v) ((void)(v), (acc)++)
+#define AGG_STEP_SUM(acc, v) ((acc) += (v))
+#define AGG_STEP_MAX(acc, v) do { int64_t v_ = (v); if (v_ > (acc)) (acc) = v_; } while (0)
+
+/* Combine a block's partial result into the total */
+#define AGG_COMBINE_COUNT(acc, part) ((acc) += (part))
+#define AGG_COMBINE_SUM(acc, part) ((acc) += (part))
+#define AGG_COMBINE_MAX(acc, part) AGG_STEP_MAX(acc, part)
+
+/*
+ * static int64_t name(void): fold field over every tx matching pred,
+ * fetching only the summary fields in needs (SUMMARY_* flags).
+ */
+#define DEFINE_TX_AGGREGATE(name, needs, op, field, pred)                     \
+    static int64_t name(void) {                                               \
+        int last_height = find_last_block_height();                           \
+        int64_t acc = AGG_INIT_##op;                                          \
+                                                                              \
+        for (int height = 0; height <= last_height; height++) {               \
+            char key[PARTIAL_KEY_MAX];                                        \
+            bool memo = partials && block_content_key(height, key, sizeof(key));\
+            int64_t part = AGG_INIT_##op;                                     \
+            if (memo && partial_cache_get(partials, key, #name, &part)) {     \
+                AGG_COMBINE_##op(acc, part);                                  \
+                continue;                                                     \
+            }                                                                 \
+                                                                              \
+            size_t num_txs;                                                   \
+            bool summarised = true;                                           \
+            tx_summary_t *txs =                                               \
+                block_tx_summaries(height, (needs), &num_txs, &summarised);   \
+            for (size_t i = 0; i < num_txs; i++) {                            \
+                const tx_summary_t *tx = &txs[i];                             \
+                if (pred) AGG_STEP_##op(part, field);                         \
+            }                                                                 \
+            free(txs);                                                        \
+                                                                              \
+            if (memo && summarised)                                           \
+                partial_cache_put(partials, key, #name, part);                \
+            AGG_COMBINE_##op(acc, part);                                      \
+        }                                                                     \
+                                                                              \
+        return acc;                                                           \
+    }
+
+/* static int64_t name(void): number of children of a store path */
+#define DEFINE_LIST_COUNT(name, path)                                         \
+    static int64_t name(void) {                                               \
+        IrminPathArray *children = list_path(path);                           \
+        if (!children) return 0;                                              \
+        int64_t count = (int64_t)irmin_path_array_length(repo, children);     \
+        irmin_path_array_free(children);                                      \
+        return count;                                                         \
+    }
+
+#endif
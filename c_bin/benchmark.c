@@ -12,6 +12,34 @@
  * Run (store must be beneath cwd due to Eio sandbox):
  *   cp -r /tmp/irmin-blocksci-store ./local-store
  *   ./benchmark ./local-store
+ *
+ * Pass -a ADDRESS_ID[,ADDRESS_ID...] to also run the address aggregates
+ * (e.g. the Satoshi Dice address, or every address of a cluster):
+ *   ./benchmark ./local-store -a 1234
+ *
+ * If a graph snapshot exists next to the store (./local-store.snapshot, see
+ * `irmin-blocksci snapshot`), the CSR graph queries and the script/address
+ * type distributions are run as well. Distributions are printed to stderr.
+ *
+ * Time-series mode computes every registered time aggregate per day, week
+ * or month from the snapshot instead of running the benchmarks:
+ *   ./benchmark ./local-store -t month
+ *
+ * Rich-list mode prints the K addresses with the highest balance (value of
+ * unspent outputs), also from the snapshot:
+ *   ./benchmark ./local-store -r 1000
+ *
+ * With -c, results are looked up in and saved to the commit-keyed result
+ * cache (./local-store.cache, see result_cache.h), so rerunning against an
+ * unchanged head only measures the lookups:
+ *   ./benchmark ./local-store -c
+ * After an import moves the head, the tx-level scans still reuse the
+ * partial result of every block whose subtrees are unchanged
+ * (./local-store.partials, see partial_cache.h).
+ *
+ * With --at H the store queries run against the commit recorded for block
+ * H by `irmin-blocksci import --commit-per-block` (./local-store.heights):
+ *   ./benchmark ./local-store --at 100000
  */
 
 #include <stdio.h>
@@ -20,7 +48,14 @@
 #include <sys/time.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "irmin.h"
+#include "snapshot.h"
+#include "record.h"
+#include "result_cache.h"
+#include "partial_cache.h"
+#include "aggregate.h"
 
 /* Simple JSON value extraction (for int64 values) */
 static int64_t json_get_int64(const char *json, const char *key) {
@@ -44,6 +79,56 @@ static double get_time_ms(void) {
     return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
 }
 
+/*
+ * Parallel sections. libirmin calls must stay on the main thread, so queries
+ * fetch what they need from the store first and only the CPU-bound
+ * aggregation runs on worker threads.
+ */
+#define MAX_THREADS 64
+
+typedef void (*parallel_fn)(int thread, int num_threads, void *ctx);
+
+/* Worker count: BENCH_THREADS if set, otherwise the number of CPUs */
+static int bench_threads(void) {
+    const char *env = getenv("BENCH_THREADS");
+    long n = env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) n = 1;
+    if (n > MAX_THREADS) n = MAX_THREADS;
+    return (int)n;
+}
+
+typedef struct {
+    parallel_fn fn;
+    void *ctx;
+    int thread;
+    int num_threads;
+} parallel_job_t;
+
+static void *parallel_worker(void *arg) {
+    parallel_job_t *job = arg;
+    job->fn(job->thread, job->num_threads, job->ctx);
+    return NULL;
+}
+
+/* Run fn on num_threads threads and wait for all of them */
+static void parallel_run(int num_threads, parallel_fn fn, void *ctx) {
+    pthread_t threads[MAX_THREADS];
+    parallel_job_t jobs[MAX_THREADS];
+    bool started[MAX_THREADS] = {false};
+
+    for (int t = 0; t < num_threads; t++)
+        jobs[t] = (parallel_job_t){fn, ctx, t, num_threads};
+
+    /* Thread 0 is the caller; a thread that fails to start runs inline */
+    for (int t = 1; t < num_threads; t++)
+        started[t] = pthread_create(&threads[t], NULL, parallel_worker, &jobs[t]) == 0;
+    parallel_worker(&jobs[0]);
+    for (int t = 1; t < num_threads; t++) {
+        if (started[t]) pthread_join(threads[t], NULL);
+        else parallel_worker(&jobs[t]);
+    }
+}
+
 /* Global store references */
 static IrminRepo *repo = NULL;
 static Irmin *store = NULL;
@@ -53,12 +138,46 @@ static IrminPath *make_path(const char *path_str) {
     return irmin_path_of_string(repo, (char *)path_str, strlen(path_str));
 }
 
+/* Copy an IrminString, NUL-terminated; its length goes to *len if not NULL */
+static char *string_copy(IrminString *value, size_t *len) {
+    size_t n = (size_t)irmin_string_length(value);
+    char *result = malloc(n + 1);
+    if (result) {
+        memcpy(result, irmin_string_data(value), n);
+        result[n] = '\0';
+        if (len) *len = n;
+    }
+    irmin_string_free(value);
+    return result;
+}
+
+/* Get content at path and its length (caller must free result) */
+static char *get_value(const char *path_str, size_t *len) {
+    IrminPath *path = make_path(path_str);
+    if (!path) return NULL;
+
+    IrminContents *contents = irmin_find(store, path);
+    irmin_path_free(path);
+    if (!contents) return NULL;
+
+    IrminString *value = irmin_contents_to_string(repo, contents);
+    irmin_contents_free(contents);
+    if (!value) return NULL;
+
+    return string_copy(value, len);
+}
+
 /* Get string content at path (caller must free result) */
 static char *get_content(const char *path_str) {
+    return get_value(path_str, NULL);
+}
+
+/* Get string content at path below tree (caller must free result) */
+static char *tree_get_content(IrminTree *tree, const char *path_str) {
     IrminPath *path = make_path(path_str);
     if (!path) return NULL;
 
-    IrminContents *contents = irmin_find(store, path);
+    IrminContents *contents = irmin_tree_find(repo, tree, path);
     irmin_path_free(path);
     if (!contents) return NULL;
 
@@ -66,9 +185,17 @@ static char *get_content(const char *path_str) {
     irmin_contents_free(contents);
     if (!value) return NULL;
 
-    char *result = strdup(irmin_string_data(value));
-    irmin_string_free(value);
-    return result;
+    return string_copy(value, NULL);
+}
+
+/* Get the subtree at path, or NULL */
+static IrminTree *get_tree(const char *path_str) {
+    IrminPath *path = make_path(path_str);
+    if (!path) return NULL;
+
+    IrminTree *tree = irmin_find_tree(store, path);
+    irmin_path_free(path);
+    return tree;
 }
 
 /* List keys under a path */
@@ -93,6 +220,118 @@ static char *path_to_string(IrminPath *path) {
     return result;
 }
 
+/* Missing or not embedded output value */
+#define VALUE_UNKNOWN INT64_MIN
+
+/* Reference to output <tx_id>:<vout> */
+typedef struct {
+    int tx_id;
+    int vout;
+    int64_t value; /* embedded by import --output-values, or VALUE_UNKNOWN */
+} output_ref_t;
+
+/*
+ * Index leaves. TxRef and OutputRef values are a tag byte and LEB128
+ * varints (see lib/types.ml):
+ *   0x01 zigzag(id - base)          TxRef
+ *   0x02 zigzag(tx - base) vout     OutputRef
+ *   0x03 n (zigzag(tx - base) vout)*n                      OutputRefs
+ *   0x04 n (zigzag(spent_tx - base) spent_vout idx seq)*n  Inputs
+ *   0x05 zigzag(id - base) ...                            Old TxSummary
+ *   0x06 zigzag(tx - base) vout zigzag(value) script       OutputRef with value
+ *   0x07 n (zigzag(tx - base) vout zigzag(value) script)*n  OutputRefs with values
+ *   0x0A zigzag(id - base) zigzag(fee) zigzag(locktime) zigzag(version)
+ *        inputs outputs zigzag(value) zigzag(max_value)    TxSummary
+ * where base is the tx ID in the leaf's key (0 under index/block_txs).
+ * Stores imported before this encoding hold JSON. Old summaries hold the
+ * version unzigzagged, so only their tx ID is used; the rest comes from
+ * the tx record as for a TxRef.
+ */
+#define INDEX_TXREF 0x01
+#define INDEX_OREF 0x02
+#define INDEX_OREFS 0x03
+#define INDEX_INPUTS 0x04
+#define INDEX_TXSUM_V1 0x05
+#define INDEX_OREF_VALUE 0x06
+#define INDEX_OREFS_VALUE 0x07
+#define INDEX_TXSUM 0x0A
+
+static const uint8_t *varint_read(const uint8_t *p, const uint8_t *end, uint64_t *v) {
+    uint64_t acc = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t b = *p++;
+        acc |= (uint64_t)(b & 0x7F) << shift;
+        if (b < 0x80) {
+            *v = acc;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static int64_t unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/*
+ * Decode a TxRef or TxSummary (vout set to 0) or an OutputRef leaf. value,
+ * if not NULL, receives an embedded output value or VALUE_UNKNOWN.
+ */
+static bool index_decode(const char *value, size_t len, int64_t base,
+                         int64_t *tx, int64_t *vout, int64_t *out_value) {
+    const uint8_t *p = (const uint8_t *)value, *end = p + len;
+    uint64_t delta, v = 0, embedded = 0;
+
+    if (out_value) *out_value = VALUE_UNKNOWN;
+    if (len == 0) return false;
+    if (*p != INDEX_TXREF && *p != INDEX_OREF && *p != INDEX_TXSUM &&
+        *p != INDEX_TXSUM_V1 && *p != INDEX_OREF_VALUE) {
+        /* JSON leaf */
+        *tx = json_get_int64(value, strstr(value, "\"id\":") ? "id" : "tx");
+        *vout = json_get_int64(value, "vout");
+        if (out_value && strstr(value, "\"value\":"))
+            *out_value = json_get_int64(value, "value");
+        return true;
+    }
+    bool oref = *p == INDEX_OREF || *p == INDEX_OREF_VALUE;
+    bool with_value = *p == INDEX_OREF_VALUE;
+    p = varint_read(p + 1, end, &delta);
+    if (p && oref) p = varint_read(p, end, &v);
+    if (p && with_value) p = varint_read(p, end, &embedded);
+    if (!p) return false;
+
+    *tx = base + unzigzag(delta);
+    *vout = (int64_t)v;
+    if (out_value && with_value) *out_value = unzigzag(embedded);
+    return true;
+}
+
+/* Transaction ID of the TxRef at path_str, or -1 */
+static int get_txref(const char *path_str, int base) {
+    size_t len;
+    char *value = get_value(path_str, &len);
+    if (!value) return -1;
+
+    int64_t tx, vout;
+    bool ok = index_decode(value, len, base, &tx, &vout, NULL);
+    free(value);
+    return ok ? (int)tx : -1;
+}
+
+/* The OutputRef at path_str */
+static bool get_oref(const char *path_str, int base, output_ref_t *ref) {
+    size_t len;
+    char *value = get_value(path_str, &len);
+    if (!value) return false;
+
+    int64_t tx, vout;
+    bool ok = index_decode(value, len, base, &tx, &vout, &ref->value);
+    free(value);
+    ref->tx_id = (int)tx;
+    ref->vout = (int)vout;
+    return ok;
+}
+
 /* Find last block height by scanning block keys */
 static int find_last_block_height(void) {
     IrminPathArray *blocks = list_path("block");
@@ -122,268 +361,663 @@ static int find_last_block_height(void) {
     return max_height;
 }
 
-/* ========================================================================= */
-/* Benchmark queries                                                         */
-/* ========================================================================= */
+/* Transaction IDs of a block, from index/block_txs (caller must free result) */
+static int *block_tx_ids(int height, size_t *n) {
+    char path[256];
+    snprintf(path, sizeof(path), "index/block_txs/%d", height);
 
-/* Block count */
-static int64_t query_block_count(void) {
-    IrminPathArray *blocks = list_path("block");
-    if (!blocks) return 0;
-    int64_t count = (int64_t)irmin_path_array_length(repo, blocks);
-    irmin_path_array_free(blocks);
-    return count;
-}
+    *n = 0;
+    IrminPathArray *tx_refs = list_path(path);
+    if (!tx_refs) return NULL;
 
-/* Tx count */
-static int64_t query_tx_count(void) {
-    IrminPathArray *txs = list_path("tx");
-    if (!txs) return 0;
-    int64_t count = (int64_t)irmin_path_array_length(repo, txs);
-    irmin_path_array_free(txs);
-    return count;
+    uint64_t num_txs = irmin_path_array_length(repo, tx_refs);
+    int *ids = malloc((num_txs ? num_txs : 1) * sizeof(int));
+    for (uint64_t i = 0; ids && i < num_txs; i++) {
+        IrminPath *tx_path = irmin_path_array_get(repo, tx_refs, i);
+        if (!tx_path) continue;
+
+        char *tx_path_str = path_to_string(tx_path);
+        irmin_path_free(tx_path);
+        if (!tx_path_str) continue;
+
+        int tx_id = get_txref(tx_path_str, 0);
+        free(tx_path_str);
+        if (tx_id >= 0) ids[(*n)++] = tx_id;
+    }
+
+    irmin_path_array_free(tx_refs);
+    return ids;
 }
 
-/* Address count */
-static int64_t query_address_count(void) {
-    IrminPathArray *addrs = list_path("address");
-    if (!addrs) return 0;
-    int64_t count = (int64_t)irmin_path_array_length(repo, addrs);
-    irmin_path_array_free(addrs);
-    return count;
+/* Open-addressing set of non-negative ints, sized once for n keys */
+typedef struct {
+    int *slots;
+    size_t mask;
+} int_set_t;
+
+static bool int_set_init(int_set_t *set, size_t n) {
+    size_t cap = 16;
+    while (cap < 2 * n) cap <<= 1;
+    set->slots = malloc(cap * sizeof(int));
+    set->mask = cap - 1;
+    if (!set->slots) return false;
+    memset(set->slots, 0xff, cap * sizeof(int)); /* -1 marks an empty slot */
+    return true;
 }
 
-/* Input count - count all entries under index/tx_inputs */
-static int64_t query_input_count(void) {
-    int last_height = find_last_block_height();
-    if (last_height < 0) return 0;
+static void int_set_free(int_set_t *set) {
+    free(set->slots);
+    set->slots = NULL;
+}
 
-    int64_t count = 0;
+static size_t int_set_slot(const int_set_t *set, int key) {
+    size_t i = ((uint32_t)key * 2654435761u) & set->mask;
+    while (set->slots[i] != -1 && set->slots[i] != key) i = (i + 1) & set->mask;
+    return i;
+}
 
-    /* Iterate through blocks to get transactions */
-    for (int height = 0; height <= last_height; height++) {
-        char path[256];
-        snprintf(path, sizeof(path), "index/block_txs/%d", height);
+static void int_set_add(int_set_t *set, int key) {
+    set->slots[int_set_slot(set, key)] = key;
+}
 
-        IrminPathArray *tx_refs = list_path(path);
-        if (!tx_refs) continue;
+static bool int_set_mem(const int_set_t *set, int key) {
+    return set->slots[int_set_slot(set, key)] == key;
+}
 
-        uint64_t num_txs = irmin_path_array_length(repo, tx_refs);
-        for (uint64_t i = 0; i < num_txs; i++) {
-            IrminPath *tx_path = irmin_path_array_get(repo, tx_refs, i);
-            if (!tx_path) continue;
+/* Open-addressing map from non-negative int keys to int counters */
+typedef struct {
+    int *keys;
+    int *values;
+    size_t mask;
+} int_map_t;
+
+static bool int_map_init(int_map_t *map, size_t n) {
+    size_t cap = 16;
+    while (cap < 2 * n) cap <<= 1;
+    map->keys = malloc(cap * sizeof(int));
+    map->values = calloc(cap, sizeof(int));
+    map->mask = cap - 1;
+    if (!map->keys || !map->values) {
+        free(map->keys);
+        free(map->values);
+        return false;
+    }
+    memset(map->keys, 0xff, cap * sizeof(int));
+    return true;
+}
 
-            char *tx_path_str = path_to_string(tx_path);
-            irmin_path_free(tx_path);
-            if (!tx_path_str) continue;
+static void int_map_free(int_map_t *map) {
+    free(map->keys);
+    free(map->values);
+}
 
-            /* Get tx_id from the tx_ref content */
-            char *tx_ref = get_content(tx_path_str);
-            free(tx_path_str);
-            if (!tx_ref) continue;
+/* Counter for key, inserted as 0 if absent */
+static int *int_map_slot(int_map_t *map, int key) {
+    size_t i = ((uint32_t)key * 2654435761u) & map->mask;
+    while (map->keys[i] != -1 && map->keys[i] != key) i = (i + 1) & map->mask;
+    map->keys[i] = key;
+    return &map->values[i];
+}
 
-            int tx_id = json_get_int(tx_ref, "tx_id");
-            free(tx_ref);
+/* Largest tx ID under tx/, or -1 */
+static int find_last_tx_id(void) {
+    IrminPathArray *txs = list_path("tx");
+    if (!txs) return -1;
 
-            /* Count inputs for this transaction */
-            char inputs_path[256];
-            snprintf(inputs_path, sizeof(inputs_path), "index/tx_inputs/%d", tx_id);
+    uint64_t count = irmin_path_array_length(repo, txs);
+    int max_id = -1;
 
-            IrminPathArray *inputs = list_path(inputs_path);
-            if (inputs) {
-                count += (int64_t)irmin_path_array_length(repo, inputs);
-                irmin_path_array_free(inputs);
-            }
+    for (uint64_t i = 0; i < count; i++) {
+        IrminPath *p = irmin_path_array_get(repo, txs, i);
+        if (!p) continue;
+        char *pstr = path_to_string(p);
+        irmin_path_free(p);
+        if (!pstr) continue;
+        const char *slash = strrchr(pstr, '/');
+        if (slash) {
+            int id = atoi(slash + 1);
+            if (id > max_id) max_id = id;
         }
-        irmin_path_array_free(tx_refs);
+        free(pstr);
     }
 
-    return count;
+    irmin_path_array_free(txs);
+    return max_id;
 }
 
-/* Output count - count all entries under index/tx_outputs */
-static int64_t query_output_count(void) {
-    int last_height = find_last_block_height();
-    if (last_height < 0) return 0;
-
-    int64_t count = 0;
-
-    for (int height = 0; height <= last_height; height++) {
-        char path[256];
-        snprintf(path, sizeof(path), "index/block_txs/%d", height);
+static int output_ref_cmp(const void *a, const void *b) {
+    const output_ref_t *x = a, *y = b;
+    if (x->tx_id != y->tx_id) return x->tx_id < y->tx_id ? -1 : 1;
+    return (x->vout > y->vout) - (x->vout < y->vout);
+}
 
-        IrminPathArray *tx_refs = list_path(path);
-        if (!tx_refs) continue;
+/*
+ * Output value cache, one direct-mapped slot per spent tx. A slot keeps the
+ * output/<tx> subtree and every value decoded from it, so several inputs
+ * spending outputs of the same tx cost one tree lookup and one decode per
+ * output.
+ */
+#define VALUE_CACHE_SLOTS 4096
 
-        uint64_t num_txs = irmin_path_array_length(repo, tx_refs);
-        for (uint64_t i = 0; i < num_txs; i++) {
-            IrminPath *tx_path = irmin_path_array_get(repo, tx_refs, i);
-            if (!tx_path) continue;
+typedef struct {
+    int tx_id; /* -1 when empty */
+    IrminTree *outputs;
+    int64_t *values;
+    int num_values;
+} value_cache_entry_t;
+
+static value_cache_entry_t value_cache[VALUE_CACHE_SLOTS];
+static bool value_cache_ready = false;
+
+static void value_cache_clear(void) {
+    for (int i = 0; i < VALUE_CACHE_SLOTS; i++) {
+        value_cache_entry_t *e = &value_cache[i];
+        if (value_cache_ready && e->outputs) irmin_tree_free(e->outputs);
+        if (value_cache_ready) free(e->values);
+        *e = (value_cache_entry_t){-1, NULL, NULL, 0};
+    }
+    value_cache_ready = true;
+}
 
-            char *tx_path_str = path_to_string(tx_path);
-            irmin_path_free(tx_path);
-            if (!tx_path_str) continue;
+/* Value of output <tx_id>:<vout>, or VALUE_UNKNOWN if it doesn't exist */
+static int64_t output_value_cached(int tx_id, int vout) {
+    if (!value_cache_ready) value_cache_clear();
+    if (tx_id < 0 || vout < 0) return VALUE_UNKNOWN;
+
+    value_cache_entry_t *e = &value_cache[(uint32_t)tx_id % VALUE_CACHE_SLOTS];
+    if (e->tx_id != tx_id) {
+        if (e->outputs) irmin_tree_free(e->outputs);
+        free(e->values);
+        char tx_path[256];
+        snprintf(tx_path, sizeof(tx_path), "output/%d", tx_id);
+        *e = (value_cache_entry_t){tx_id, get_tree(tx_path), NULL, 0};
+    }
+    if (!e->outputs) return VALUE_UNKNOWN;
+
+    if (vout >= e->num_values) {
+        int n = e->num_values ? e->num_values : 4;
+        while (n <= vout) n *= 2;
+        int64_t *values = realloc(e->values, (size_t)n * sizeof(int64_t));
+        if (!values) return VALUE_UNKNOWN;
+        for (int i = e->num_values; i < n; i++) values[i] = VALUE_UNKNOWN;
+        e->values = values;
+        e->num_values = n;
+    }
 
-            char *tx_ref = get_content(tx_path_str);
-            free(tx_path_str);
-            if (!tx_ref) continue;
+    if (e->values[vout] == VALUE_UNKNOWN) {
+        char vout_str[32];
+        snprintf(vout_str, sizeof(vout_str), "%d", vout);
+        char *output_json = tree_get_content(e->outputs, vout_str);
+        if (output_json) {
+            e->values[vout] = json_get_int64(output_json, "value");
+            free(output_json);
+        }
+    }
+    return e->values[vout];
+}
 
-            int tx_id = json_get_int(tx_ref, "tx_id");
-            free(tx_ref);
+/*
+ * Decode a packed OutputRefs or Inputs value into output refs (the spent
+ * outputs for Inputs, without values). Caller must free result.
+ */
+static output_ref_t *index_decode_packed(const char *value, size_t len, int64_t base,
+                                         size_t *n) {
+    const uint8_t *p = (const uint8_t *)value, *end = p + len;
+    uint64_t count;
+
+    *n = 0;
+    if (len == 0 || (*p != INDEX_OREFS && *p != INDEX_OREFS_VALUE && *p != INDEX_INPUTS))
+        return NULL;
+    bool with_value = *p == INDEX_OREFS_VALUE;
+    int arity = *p == INDEX_OREFS ? 2 : 4;
+    p = varint_read(p + 1, end, &count);
+    if (!p || count > len) return NULL;
+
+    output_ref_t *refs = malloc((count ? count : 1) * sizeof(output_ref_t));
+    for (uint64_t i = 0; refs && i < count; i++) {
+        uint64_t fields[4];
+        for (int k = 0; p && k < arity; k++) p = varint_read(p, end, &fields[k]);
+        if (!p) {
+            free(refs);
+            return NULL;
+        }
+        refs[i].tx_id = (int)(base + unzigzag(fields[0]));
+        refs[i].vout = (int)fields[1];
+        refs[i].value = with_value ? unzigzag(fields[2]) : VALUE_UNKNOWN;
+    }
+    if (refs) *n = (size_t)count;
+    return refs;
+}
 
-            char outputs_path[256];
-            snprintf(outputs_path, sizeof(outputs_path), "index/tx_outputs/%d", tx_id);
+/*
+ * Output refs under index/<dir>/<tx_id>: one get of the packed value, or a
+ * list and one get per leaf in the per-entry layout. Under tx_inputs they
+ * are the outputs the tx spends. Under tx_outputs without read_leaves the
+ * leaves are only listed: their names are the vouts, and the values are
+ * left unknown. Caller must free result.
+ */
+static output_ref_t *tx_index_refs(const char *dir, int tx_id, bool read_leaves,
+                                   size_t *n) {
+    char path[256];
+    snprintf(path, sizeof(path), "index/%s/%d", dir, tx_id);
+
+    size_t len;
+    char *value = get_value(path, &len);
+    if (value) {
+        output_ref_t *refs = index_decode_packed(value, len, tx_id, n);
+        free(value);
+        return refs;
+    }
 
-            IrminPathArray *outputs = list_path(outputs_path);
-            if (outputs) {
-                count += (int64_t)irmin_path_array_length(repo, outputs);
-                irmin_path_array_free(outputs);
+    *n = 0;
+    IrminPathArray *leaves = list_path(path);
+    if (!leaves) return NULL;
+
+    bool inputs = strcmp(dir, "tx_inputs") == 0;
+    uint64_t num_leaves = irmin_path_array_length(repo, leaves);
+    output_ref_t *refs = malloc((num_leaves ? num_leaves : 1) * sizeof(output_ref_t));
+    for (uint64_t i = 0; refs && i < num_leaves; i++) {
+        IrminPath *leaf_path = irmin_path_array_get(repo, leaves, i);
+        if (!leaf_path) continue;
+
+        char *leaf_path_str = path_to_string(leaf_path);
+        irmin_path_free(leaf_path);
+        if (!leaf_path_str) continue;
+
+        if (!inputs && !read_leaves) {
+            const char *vout = strrchr(leaf_path_str, '/');
+            refs[*n].tx_id = tx_id;
+            refs[*n].vout = atoi(vout ? vout + 1 : leaf_path_str);
+            refs[*n].value = VALUE_UNKNOWN;
+            (*n)++;
+        } else if (inputs) {
+            char *input_json = get_content(leaf_path_str);
+            if (input_json) {
+                refs[*n].tx_id = json_get_int(input_json, "spent_tx");
+                refs[*n].vout = json_get_int(input_json, "spent_vout");
+                refs[*n].value = VALUE_UNKNOWN;
+                (*n)++;
+                free(input_json);
             }
+        } else if (get_oref(leaf_path_str, tx_id, &refs[*n])) {
+            (*n)++;
         }
-        irmin_path_array_free(tx_refs);
+        free(leaf_path_str);
     }
 
-    return count;
+    irmin_path_array_free(leaves);
+    return refs;
 }
 
-/* Tx locktime > 0 */
-static int64_t query_tx_locktime_gt_0(void) {
-    IrminPathArray *txs = list_path("tx");
-    if (!txs) return 0;
+/* Outputs spent by a tx, from index/tx_inputs (caller must free result) */
+static output_ref_t *tx_spent_outputs(int tx_id, size_t *n) {
+    return tx_index_refs("tx_inputs", tx_id, true, n);
+}
 
-    int64_t count = 0;
-    uint64_t num_txs = irmin_path_array_length(repo, txs);
+/*
+ * Outputs created by a tx, from index/tx_outputs; see tx_index_refs for
+ * read_leaves (caller must free result)
+ */
+static output_ref_t *tx_output_refs(int tx_id, bool read_leaves, size_t *n) {
+    return tx_index_refs("tx_outputs", tx_id, read_leaves, n);
+}
 
-    for (uint64_t i = 0; i < num_txs; i++) {
-        IrminPath *tx_path = irmin_path_array_get(repo, txs, i);
-        if (!tx_path) continue;
+/*
+ * Number of entries under index/<dir>/<tx_id>: the count of the packed
+ * value, or the length of the list in the per-entry layout, without
+ * reading the leaves.
+ */
+static size_t tx_index_count(const char *dir, int tx_id) {
+    char path[256];
+    snprintf(path, sizeof(path), "index/%s/%d", dir, tx_id);
+
+    size_t len;
+    char *value = get_value(path, &len);
+    if (value) {
+        const uint8_t *p = (const uint8_t *)value;
+        uint64_t count = 0;
+        if (len > 0 && (*p == INDEX_OREFS || *p == INDEX_OREFS_VALUE || *p == INDEX_INPUTS) &&
+            !varint_read(p + 1, p + len, &count))
+            count = 0;
+        free(value);
+        return (size_t)count;
+    }
 
-        char *tx_path_str = path_to_string(tx_path);
-        irmin_path_free(tx_path);
-        if (!tx_path_str) continue;
+    IrminPathArray *leaves = list_path(path);
+    if (!leaves) return 0;
+    size_t count = (size_t)irmin_path_array_length(repo, leaves);
+    irmin_path_array_free(leaves);
+    return count;
+}
 
-        char *tx_json = get_content(tx_path_str);
-        free(tx_path_str);
-        if (!tx_json) continue;
+/* Whether OutputRefs carry their output's value (import --values) */
+static int values_embedded = -1;
 
-        int64_t locktime = json_get_int64(tx_json, "locktime");
-        if (locktime > 0) count++;
-        free(tx_json);
+static bool output_values_embedded(void) {
+    if (values_embedded < 0) {
+        char *meta = get_content("meta/output_values");
+        values_embedded = meta && strstr(meta, "\"on\"") != NULL;
+        free(meta);
     }
+    return values_embedded;
+}
 
-    irmin_path_array_free(txs);
-    return count;
+/* ========================================================================= */
+/* Transaction summaries                                                     */
+/* ========================================================================= */
+
+/*
+ * The per-tx fields of the Table 7 tx-level queries. Stores imported with
+ * `import --summaries` keep them in the index/block_txs leaves; otherwise
+ * block_tx_summaries looks up the fields a query asks for.
+ */
+typedef struct {
+    int tx_id;
+    int64_t fee;
+    int64_t locktime;
+    int version;
+    int64_t num_inputs;
+    int64_t num_outputs;
+    int64_t output_value;
+    int64_t max_output_value;
+} tx_summary_t;
+
+#define SUMMARY_TX 1      /* fee, locktime, version */
+#define SUMMARY_INPUTS 2  /* num_inputs */
+#define SUMMARY_OUTPUTS 4 /* num_outputs, output_value, max_output_value */
+
+/* Decode a TxSummary leaf */
+static bool tx_summary_decode(const char *value, size_t len, tx_summary_t *s) {
+    const uint8_t *p = (const uint8_t *)value, *end = p + len;
+    uint64_t f[8];
+
+    if (len == 0 || *p != INDEX_TXSUM) return false;
+    p++;
+    for (int k = 0; p && k < 8; k++) p = varint_read(p, end, &f[k]);
+    if (!p) return false;
+
+    s->tx_id = (int)unzigzag(f[0]);
+    s->fee = unzigzag(f[1]);
+    s->locktime = unzigzag(f[2]);
+    s->version = (int)unzigzag(f[3]);
+    s->num_inputs = (int64_t)f[4];
+    s->num_outputs = (int64_t)f[5];
+    s->output_value = unzigzag(f[6]);
+    s->max_output_value = unzigzag(f[7]);
+    return true;
 }
 
-/* Tx version > 1 */
-static int64_t query_tx_version_gt_1(void) {
-    IrminPathArray *txs = list_path("tx");
-    if (!txs) return 0;
+/* Fill the needed fields of s from the tx record and index */
+static void tx_summary_lookup(tx_summary_t *s, int needs) {
+    if (needs & SUMMARY_TX) {
+        char tx_path[64];
+        snprintf(tx_path, sizeof(tx_path), "tx/%d", s->tx_id);
+        size_t len;
+        char *value = get_value(tx_path, &len);
+        tx_record_t tx;
+        if (value && record_decode_tx(value, len, &tx)) {
+            s->fee = tx.fee;
+            s->locktime = tx.locktime;
+            s->version = (int)tx.version;
+        }
+        free(value);
+    }
+    if (needs & SUMMARY_INPUTS) s->num_inputs = (int64_t)tx_index_count("tx_inputs", s->tx_id);
+    if (needs & SUMMARY_OUTPUTS) {
+        /* Without embedded values the output records are read anyway, so
+           the refs are only listed */
+        size_t n;
+        output_ref_t *outputs = tx_output_refs(s->tx_id, output_values_embedded(), &n);
+        s->num_outputs = (int64_t)n;
+        for (size_t j = 0; j < n; j++) {
+            int64_t value = outputs[j].value;
+            if (value == VALUE_UNKNOWN) {
+                /* Not embedded in the ref: read the output record */
+                char output_path[256];
+                snprintf(output_path, sizeof(output_path), "output/%d/%d",
+                         outputs[j].tx_id, outputs[j].vout);
 
-    int64_t count = 0;
-    uint64_t num_txs = irmin_path_array_length(repo, txs);
+                char *output_json = get_content(output_path);
+                if (!output_json) continue;
+                value = json_get_int64(output_json, "value");
+                free(output_json);
+            }
+            s->output_value += value;
+            if (value > s->max_output_value) s->max_output_value = value;
+        }
+        free(outputs);
+    }
+}
 
-    for (uint64_t i = 0; i < num_txs; i++) {
-        IrminPath *tx_path = irmin_path_array_get(repo, txs, i);
+/*
+ * Summaries of the txs of a block: one list and one read per tx when the
+ * leaves are TxSummary, plus the lookups in needs otherwise. *summarised
+ * is cleared if any leaf was not a TxSummary, that is if the result
+ * depends on records outside index/block_txs/<h>. Caller must free
+ * result.
+ */
+static tx_summary_t *block_tx_summaries(int height, int needs, size_t *n, bool *summarised) {
+    char path[256];
+    snprintf(path, sizeof(path), "index/block_txs/%d", height);
+
+    *n = 0;
+    IrminPathArray *tx_refs = list_path(path);
+    if (!tx_refs) return NULL;
+
+    uint64_t num_txs = irmin_path_array_length(repo, tx_refs);
+    tx_summary_t *summaries = calloc(num_txs ? num_txs : 1, sizeof(tx_summary_t));
+    for (uint64_t i = 0; summaries && i < num_txs; i++) {
+        IrminPath *tx_path = irmin_path_array_get(repo, tx_refs, i);
         if (!tx_path) continue;
 
         char *tx_path_str = path_to_string(tx_path);
         irmin_path_free(tx_path);
         if (!tx_path_str) continue;
 
-        char *tx_json = get_content(tx_path_str);
+        size_t len;
+        char *value = get_value(tx_path_str, &len);
         free(tx_path_str);
-        if (!tx_json) continue;
+        if (!value) {
+            *summarised = false;
+            continue;
+        }
 
-        int version = json_get_int(tx_json, "version");
-        if (version > 1) count++;
-        free(tx_json);
+        tx_summary_t *s = &summaries[*n];
+        int64_t tx_id, vout;
+        if (tx_summary_decode(value, len, s)) {
+            (*n)++;
+        } else {
+            *summarised = false;
+            if (index_decode(value, len, 0, &tx_id, &vout, NULL)) {
+                s->tx_id = (int)tx_id;
+                tx_summary_lookup(s, needs);
+                (*n)++;
+            }
+        }
+        free(value);
     }
 
-    irmin_path_array_free(txs);
-    return count;
+    irmin_path_array_free(tx_refs);
+    return summaries;
 }
 
-/* Max output value */
-static int64_t query_max_output_value(void) {
-    int last_height = find_last_block_height();
-    if (last_height < 0) return 0;
-
-    int64_t max_val = 0;
-
-    for (int height = 0; height <= last_height; height++) {
-        char path[256];
-        snprintf(path, sizeof(path), "index/block_txs/%d", height);
+/* Per-block partial results of the tx-level scans, if -c was given */
+static partial_cache_t partial_cache;
+static partial_cache_t *partials = NULL;
+
+/* Irmin hash of the subtree at path into out; false if it is missing */
+static bool subtree_hash(const char *path_str, char *out, size_t size) {
+    IrminTree *tree = get_tree(path_str);
+    if (!tree) return false;
+
+    bool ok = false;
+    IrminHash *hash = irmin_tree_hash(repo, tree);
+    if (hash) {
+        IrminString *s = irmin_hash_to_string(repo, hash);
+        if (s) {
+            int n = snprintf(out, size, "%.*s", (int)irmin_string_length(s),
+                             irmin_string_data(s));
+            ok = n > 0 && (size_t)n < size;
+            irmin_string_free(s);
+        }
+        irmin_hash_free(hash);
+    }
+    irmin_tree_free(tree);
+    return ok;
+}
 
-        IrminPathArray *tx_refs = list_path(path);
-        if (!tx_refs) continue;
+/*
+ * Content key of a block: the hashes of its index/block_txs node and its
+ * block record. Only partials of blocks whose block_txs leaves are all
+ * TxSummary are stored (see aggregate.h): those read nothing else, so the
+ * key covers every value the partial was computed from. Without
+ * summaries the inputs, outputs and spenders a scan reads may not all be
+ * imported yet, and nothing in the key would change once they are.
+ */
+static bool block_content_key(int height, char *out, size_t size) {
+    char path[64], txs[PARTIAL_KEY_MAX / 2], block[PARTIAL_KEY_MAX / 2];
+    snprintf(path, sizeof(path), "index/block_txs/%d", height);
+    if (!subtree_hash(path, txs, sizeof(txs))) return false;
+    snprintf(path, sizeof(path), "block/%d", height);
+    if (!subtree_hash(path, block, sizeof(block))) return false;
+    int n = snprintf(out, size, "%s.%s", txs, block);
+    return n > 0 && (size_t)n < size;
+}
 
-        uint64_t num_txs = irmin_path_array_length(repo, tx_refs);
-        for (uint64_t i = 0; i < num_txs; i++) {
-            IrminPath *tx_path = irmin_path_array_get(repo, tx_refs, i);
-            if (!tx_path) continue;
+/* ========================================================================= */
+/* Benchmark queries                                                         */
+/* ========================================================================= */
 
-            char *tx_path_str = path_to_string(tx_path);
-            irmin_path_free(tx_path);
-            if (!tx_path_str) continue;
+DEFINE_LIST_COUNT(query_block_count, "block")
+DEFINE_LIST_COUNT(query_tx_count, "tx")
+DEFINE_LIST_COUNT(query_address_count, "address")
 
-            char *tx_ref = get_content(tx_path_str);
-            free(tx_path_str);
-            if (!tx_ref) continue;
+DEFINE_TX_AGGREGATE(query_input_count, SUMMARY_INPUTS, SUM, tx->num_inputs, 1)
+DEFINE_TX_AGGREGATE(query_output_count, SUMMARY_OUTPUTS, SUM, tx->num_outputs, 1)
+DEFINE_TX_AGGREGATE(query_tx_locktime_gt_0, SUMMARY_TX, COUNT, 1, tx->locktime > 0)
+DEFINE_TX_AGGREGATE(query_tx_version_gt_1, SUMMARY_TX, COUNT, 1, tx->version > 1)
+DEFINE_TX_AGGREGATE(query_max_output_value, SUMMARY_OUTPUTS, MAX, tx->max_output_value, 1)
 
-            int tx_id = json_get_int(tx_ref, "tx_id");
-            free(tx_ref);
+/* Calculate fee (max fee) */
+DEFINE_TX_AGGREGATE(query_calculate_fee, SUMMARY_TX, MAX, tx->fee, 1)
 
-            char outputs_path[256];
-            snprintf(outputs_path, sizeof(outputs_path), "index/tx_outputs/%d", tx_id);
+/*
+ * Zero-conf outputs: outputs spent in the block that created them.
+ *
+ * Streams one block at a time. Every tx listed in index/block_txs/<h> has
+ * height h, so the block's tx set is built once and each index/spent_by
+ * entry of its txs is a set lookup instead of a tx/<id> read.
+ */
+static int64_t query_zero_conf_outputs(void) {
+    int last_height = find_last_block_height();
+    if (last_height < 0) return 0;
 
-            IrminPathArray *outputs = list_path(outputs_path);
-            if (!outputs) continue;
+    int64_t count = 0;
 
-            uint64_t num_outputs = irmin_path_array_length(repo, outputs);
-            for (uint64_t j = 0; j < num_outputs; j++) {
-                IrminPath *out_path = irmin_path_array_get(repo, outputs, j);
-                if (!out_path) continue;
+    for (int height = 0; height <= last_height; height++) {
+        size_t num_txs;
+        int *tx_ids = block_tx_ids(height, &num_txs);
+        if (!tx_ids) continue;
+
+        int_set_t in_block;
+        if (!int_set_init(&in_block, num_txs)) {
+            free(tx_ids);
+            continue;
+        }
+        for (size_t i = 0; i < num_txs; i++) int_set_add(&in_block, tx_ids[i]);
 
-                char *out_path_str = path_to_string(out_path);
-                irmin_path_free(out_path);
-                if (!out_path_str) continue;
+        for (size_t i = 0; i < num_txs; i++) {
+            char spent_path[256];
+            snprintf(spent_path, sizeof(spent_path), "index/spent_by/%d", tx_ids[i]);
 
-                /* Get output ref to find actual output */
-                char *out_ref = get_content(out_path_str);
-                free(out_path_str);
-                if (!out_ref) continue;
+            IrminPathArray *vouts = list_path(spent_path);
+            if (!vouts) continue;
 
-                int out_tx_id = json_get_int(out_ref, "tx_id");
-                int out_vout = json_get_int(out_ref, "vout");
-                free(out_ref);
+            uint64_t num_vouts = irmin_path_array_length(repo, vouts);
+            for (uint64_t j = 0; j < num_vouts; j++) {
+                IrminPath *vout_path = irmin_path_array_get(repo, vouts, j);
+                if (!vout_path) continue;
 
-                char output_path[256];
-                snprintf(output_path, sizeof(output_path), "output/%d/%d", out_tx_id, out_vout);
+                char *vout_path_str = path_to_string(vout_path);
+                irmin_path_free(vout_path);
+                if (!vout_path_str) continue;
 
-                char *output_json = get_content(output_path);
-                if (output_json) {
-                    int64_t value = json_get_int64(output_json, "value");
-                    if (value > max_val) max_val = value;
-                    free(output_json);
-                }
+                int spender = get_txref(vout_path_str, tx_ids[i]);
+                free(vout_path_str);
+                if (spender >= 0 && int_set_mem(&in_block, spender)) count++;
             }
-            irmin_path_array_free(outputs);
+            irmin_path_array_free(vouts);
         }
-        irmin_path_array_free(tx_refs);
+
+        int_set_free(&in_block);
+        free(tx_ids);
     }
 
-    return max_val;
+    return count;
 }
 
-/* Calculate fee (max fee) */
-static int64_t query_calculate_fee(void) {
-    IrminPathArray *txs = list_path("tx");
-    if (!txs) return 0;
+/*
+ * Locktime change: creating txs with exactly one spent output whose spender
+ * has the same locktime-zero-ness.
+ *
+ * The store is read on the main thread into a locktime flag per tx and the
+ * (creator, spender) edges of index/spent_by, which come out grouped by
+ * creator. A spender without a tx record matches neither flag, as in the
+ * OCaml benchmark. The edges are then partitioned by creating tx at group
+ * boundaries and each thread aggregates its part in its own hash map.
+ */
+typedef struct {
+    const uint8_t *locked;   /* LOCK_* flag, indexed by tx ID */
+    int max_tx;
+    const int *creators;
+    const int *spenders;
+    size_t num_edges;
+    int64_t counts[MAX_THREADS];
+} locktime_change_t;
+
+#define LOCK_NONE 0 /* no tx record */
+#define LOCK_ZERO 1 /* locktime == 0 */
+#define LOCK_SET 2  /* locktime > 0 */
+
+/* Start of the part of the edges owned by thread t, aligned to a creator */
+static size_t locktime_change_split(const locktime_change_t *q, int t, int n) {
+    size_t i = q->num_edges * (size_t)t / (size_t)n;
+    while (i > 0 && i < q->num_edges && q->creators[i] == q->creators[i - 1]) i++;
+    return i;
+}
+
+static void locktime_change_worker(int t, int n, void *ctx) {
+    locktime_change_t *q = ctx;
+    size_t lo = locktime_change_split(q, t, n);
+    size_t hi = locktime_change_split(q, t + 1, n);
+
+    q->counts[t] = 0;
+    int_map_t matching;
+    if (lo >= hi || !int_map_init(&matching, hi - lo)) return;
+
+    for (size_t i = lo; i < hi; i++) {
+        int c = q->creators[i], sp = q->spenders[i];
+        int *count = int_map_slot(&matching, c);
+        if (sp >= 0 && sp <= q->max_tx && q->locked[sp] != LOCK_NONE &&
+            q->locked[c] == q->locked[sp])
+            (*count)++;
+    }
+
+    for (size_t i = 0; i <= matching.mask; i++)
+        if (matching.keys[i] != -1 && matching.values[i] == 1) q->counts[t]++;
+    int_map_free(&matching);
+}
 
-    int64_t max_fee = 0;
-    uint64_t num_txs = irmin_path_array_length(repo, txs);
+static int64_t query_locktime_change(void) {
+    int max_tx = find_last_tx_id();
+    if (max_tx < 0) return 0;
 
+    /* Locktime flag of every tx */
+    uint8_t *locked = calloc((size_t)max_tx + 1, 1);
+    if (!locked) return 0;
+
+    IrminPathArray *txs = list_path("tx");
+    uint64_t num_txs = txs ? irmin_path_array_length(repo, txs) : 0;
     for (uint64_t i = 0; i < num_txs; i++) {
         IrminPath *tx_path = irmin_path_array_get(repo, txs, i);
         if (!tx_path) continue;
@@ -392,115 +1026,122 @@ static int64_t query_calculate_fee(void) {
         irmin_path_free(tx_path);
         if (!tx_path_str) continue;
 
-        char *tx_json = get_content(tx_path_str);
+        size_t len;
+        char *value = get_value(tx_path_str, &len);
         free(tx_path_str);
-        if (!tx_json) continue;
-
-        int64_t fee = json_get_int64(tx_json, "fee");
-        if (fee > max_fee) max_fee = fee;
-        free(tx_json);
+        tx_record_t tx;
+        if (value && record_decode_tx(value, len, &tx) && tx.id >= 0 &&
+            tx.id <= max_tx)
+            locked[tx.id] = tx.locktime > 0 ? LOCK_SET : LOCK_ZERO;
+        free(value);
     }
+    if (txs) irmin_path_array_free(txs);
 
-    irmin_path_array_free(txs);
-    return max_fee;
-}
-
-/* Total output value */
-static int64_t query_total_output_value(void) {
-    int last_height = find_last_block_height();
-    if (last_height < 0) return 0;
-
-    int64_t total = 0;
-
-    for (int height = 0; height <= last_height; height++) {
-        char path[256];
-        snprintf(path, sizeof(path), "index/block_txs/%d", height);
-
-        IrminPathArray *tx_refs = list_path(path);
-        if (!tx_refs) continue;
-
-        uint64_t num_txs = irmin_path_array_length(repo, tx_refs);
-        for (uint64_t i = 0; i < num_txs; i++) {
-            IrminPath *tx_path = irmin_path_array_get(repo, tx_refs, i);
-            if (!tx_path) continue;
-
-            char *tx_path_str = path_to_string(tx_path);
-            irmin_path_free(tx_path);
-            if (!tx_path_str) continue;
-
-            char *tx_ref = get_content(tx_path_str);
-            free(tx_path_str);
-            if (!tx_ref) continue;
-
-            int tx_id = json_get_int(tx_ref, "tx_id");
-            free(tx_ref);
-
-            char outputs_path[256];
-            snprintf(outputs_path, sizeof(outputs_path), "index/tx_outputs/%d", tx_id);
+    /* (creator, spender) edges, grouped by creator */
+    size_t cap = 1024, num_edges = 0;
+    int *creators = malloc(cap * sizeof(int));
+    int *spenders = malloc(cap * sizeof(int));
 
-            IrminPathArray *outputs = list_path(outputs_path);
-            if (!outputs) continue;
-
-            uint64_t num_outputs = irmin_path_array_length(repo, outputs);
-            for (uint64_t j = 0; j < num_outputs; j++) {
-                IrminPath *out_path = irmin_path_array_get(repo, outputs, j);
-                if (!out_path) continue;
-
-                char *out_path_str = path_to_string(out_path);
-                irmin_path_free(out_path);
-                if (!out_path_str) continue;
-
-                char *out_ref = get_content(out_path_str);
-                free(out_path_str);
-                if (!out_ref) continue;
-
-                int out_tx_id = json_get_int(out_ref, "tx_id");
-                int out_vout = json_get_int(out_ref, "vout");
-                free(out_ref);
+    bool ok = creators && spenders;
+    IrminPathArray *spent = list_path("index/spent_by");
+    uint64_t num_creators = spent ? irmin_path_array_length(repo, spent) : 0;
+    for (uint64_t i = 0; ok && i < num_creators; i++) {
+        IrminPath *tx_path = irmin_path_array_get(repo, spent, i);
+        if (!tx_path) continue;
 
-                char output_path[256];
-                snprintf(output_path, sizeof(output_path), "output/%d/%d", out_tx_id, out_vout);
+        char *tx_path_str = path_to_string(tx_path);
+        irmin_path_free(tx_path);
+        if (!tx_path_str) continue;
 
-                char *output_json = get_content(output_path);
-                if (output_json) {
-                    total += json_get_int64(output_json, "value");
-                    free(output_json);
-                }
+        const char *slash = strrchr(tx_path_str, '/');
+        int creator = atoi(slash ? slash + 1 : tx_path_str);
+        IrminPathArray *vouts =
+            (creator >= 0 && creator <= max_tx) ? list_path(tx_path_str) : NULL;
+        free(tx_path_str);
+        if (!vouts) continue;
+
+        uint64_t num_vouts = irmin_path_array_length(repo, vouts);
+        for (uint64_t j = 0; ok && j < num_vouts; j++) {
+            IrminPath *vout_path = irmin_path_array_get(repo, vouts, j);
+            if (!vout_path) continue;
+
+            char *vout_path_str = path_to_string(vout_path);
+            irmin_path_free(vout_path);
+            if (!vout_path_str) continue;
+
+            int spender = get_txref(vout_path_str, creator);
+            free(vout_path_str);
+            if (spender < 0) continue;
+
+            if (num_edges == cap) {
+                cap *= 2;
+                int *c = realloc(creators, cap * sizeof(int));
+                if (c) creators = c;
+                int *sp = realloc(spenders, cap * sizeof(int));
+                if (sp) spenders = sp;
+                ok = c && sp;
+            }
+            if (ok) {
+                creators[num_edges] = creator;
+                spenders[num_edges] = spender;
+                num_edges++;
             }
-            irmin_path_array_free(outputs);
         }
-        irmin_path_array_free(tx_refs);
+        irmin_path_array_free(vouts);
     }
+    if (spent) irmin_path_array_free(spent);
 
-    return total;
-}
+    locktime_change_t q = {locked, max_tx, creators, spenders, num_edges, {0}};
+    int64_t count = 0;
+    if (ok) {
+        int n = bench_threads();
+        parallel_run(n, locktime_change_worker, &q);
+        for (int t = 0; t < n; t++) count += q.counts[t];
+    }
 
-/* Total fees */
-static int64_t query_total_fees(void) {
-    IrminPathArray *txs = list_path("tx");
-    if (!txs) return 0;
+    free(creators);
+    free(spenders);
+    free(locked);
+    return count;
+}
 
-    int64_t total = 0;
-    uint64_t num_txs = irmin_path_array_length(repo, txs);
+DEFINE_TX_AGGREGATE(query_total_output_value, SUMMARY_OUTPUTS, SUM, tx->output_value, 1)
+DEFINE_TX_AGGREGATE(query_total_fees, SUMMARY_TX, SUM, tx->fee, 1)
 
-    for (uint64_t i = 0; i < num_txs; i++) {
-        IrminPath *tx_path = irmin_path_array_get(repo, txs, i);
-        if (!tx_path) continue;
-
-        char *tx_path_str = path_to_string(tx_path);
-        irmin_path_free(tx_path);
-        if (!tx_path_str) continue;
+/*
+ * Max input value: the largest output spent by any input.
+ *
+ * Each tx's spent outputs are sorted so inputs spending the same tx are
+ * resolved together, and values go through output_value_cached.
+ */
+static int64_t query_max_input_value(void) {
+    int last_height = find_last_block_height();
+    if (last_height < 0) return 0;
 
-        char *tx_json = get_content(tx_path_str);
-        free(tx_path_str);
-        if (!tx_json) continue;
+    int64_t max_val = 0;
 
-        total += json_get_int64(tx_json, "fee");
-        free(tx_json);
+    for (int height = 0; height <= last_height; height++) {
+        size_t num_txs;
+        int *tx_ids = block_tx_ids(height, &num_txs);
+        if (!tx_ids) continue;
+
+        for (size_t i = 0; i < num_txs; i++) {
+            size_t num_refs;
+            output_ref_t *refs = tx_spent_outputs(tx_ids[i], &num_refs);
+            if (!refs) continue;
+
+            qsort(refs, num_refs, sizeof(output_ref_t), output_ref_cmp);
+            for (size_t j = 0; j < num_refs; j++) {
+                int64_t value = output_value_cached(refs[j].tx_id, refs[j].vout);
+                if (value != VALUE_UNKNOWN && value > max_val) max_val = value;
+            }
+            free(refs);
+        }
+        free(tx_ids);
     }
 
-    irmin_path_array_free(txs);
-    return total;
+    value_cache_clear();
+    return max_val;
 }
 
 /* Avg tx per block (returns value * 1000 for precision) */
@@ -571,70 +1212,500 @@ static int64_t query_unspent_outputs(void) {
 }
 
 /* High value tx (fee > 10 BTC = 1,000,000,000 satoshis) */
-static int64_t query_high_value_tx(void) {
-    IrminPathArray *txs = list_path("tx");
-    if (!txs) return 0;
+DEFINE_TX_AGGREGATE(query_high_value_tx, SUMMARY_TX, COUNT, 1, tx->fee > 1000000000LL)
 
-    int64_t count = 0;
-    const int64_t threshold = 1000000000LL;
-    uint64_t num_txs = irmin_path_array_length(repo, txs);
+/* Multi-input tx (> 10 inputs) */
+DEFINE_TX_AGGREGATE(query_multi_input_tx, SUMMARY_INPUTS, COUNT, 1, tx->num_inputs > 10)
 
-    for (uint64_t i = 0; i < num_txs; i++) {
-        IrminPath *tx_path = irmin_path_array_get(repo, txs, i);
-        if (!tx_path) continue;
+/* ========================================================================= */
+/* Address aggregates                                                        */
+/* ========================================================================= */
 
-        char *tx_path_str = path_to_string(tx_path);
-        irmin_path_free(tx_path);
-        if (!tx_path_str) continue;
+/* Comma-separated address IDs from -a */
+static const char *query_addresses = NULL;
+
+/* Append the outputs of index/addr_outputs/<addr> to *refs */
+static bool collect_address_outputs(const char *addr, output_ref_t **refs,
+                                    size_t *n, size_t *cap) {
+    char path[512];
+    snprintf(path, sizeof(path), "index/addr_outputs/%s", addr);
+
+    IrminPathArray *keys = list_path(path);
+    if (!keys) return true;
+
+    bool ok = true;
+    uint64_t num_keys = irmin_path_array_length(repo, keys);
+    for (uint64_t i = 0; ok && i < num_keys; i++) {
+        IrminPath *p = irmin_path_array_get(repo, keys, i);
+        if (!p) continue;
+
+        char *pstr = path_to_string(p);
+        irmin_path_free(p);
+        if (!pstr) continue;
+
+        /* The key itself is the output reference: ".../<tx_id>:<vout>" */
+        const char *slash = strrchr(pstr, '/');
+        output_ref_t ref = {0, 0, VALUE_UNKNOWN};
+        if (sscanf(slash ? slash + 1 : pstr, "%d:%d", &ref.tx_id, &ref.vout) == 2) {
+            if (*n == *cap) {
+                size_t new_cap = *cap ? *cap * 2 : 1024;
+                output_ref_t *r = realloc(*refs, new_cap * sizeof(output_ref_t));
+                if (r) {
+                    *refs = r;
+                    *cap = new_cap;
+                } else {
+                    ok = false;
+                }
+            }
+            if (ok) (*refs)[(*n)++] = ref;
+        }
+        free(pstr);
+    }
 
-        char *tx_json = get_content(tx_path_str);
-        free(tx_path_str);
-        if (!tx_json) continue;
+    irmin_path_array_free(keys);
+    return ok;
+}
+
+/*
+ * Satoshi Dice address: sum of all outputs sent to the -a addresses.
+ *
+ * Output references come straight from the index/addr_outputs keys. They
+ * are sorted by tx so the values are fetched in batches: output/<tx> is
+ * loaded once and each vout is read from that subtree.
+ */
+static int64_t query_satoshi_dice(void) {
+    output_ref_t *refs = NULL;
+    size_t n = 0, cap = 0;
+    bool ok = true;
+
+    char *addrs = strdup(query_addresses);
+    if (!addrs) return 0;
+    char *save = NULL;
+    for (char *addr = strtok_r(addrs, ",", &save); ok && addr;
+         addr = strtok_r(NULL, ",", &save))
+        ok = collect_address_outputs(addr, &refs, &n, &cap);
+    free(addrs);
+
+    int64_t total = 0;
+    if (ok && n > 0) {
+        qsort(refs, n, sizeof(output_ref_t), output_ref_cmp);
+
+        for (size_t i = 0; i < n;) {
+            char tx_path[256];
+            snprintf(tx_path, sizeof(tx_path), "output/%d", refs[i].tx_id);
+            IrminTree *outputs = get_tree(tx_path);
+
+            size_t j = i;
+            for (; j < n && refs[j].tx_id == refs[i].tx_id; j++) {
+                /* The same output may be listed under several addresses */
+                if (!outputs || (j > i && refs[j].vout == refs[j - 1].vout)) continue;
+
+                char vout[32];
+                snprintf(vout, sizeof(vout), "%d", refs[j].vout);
+                char *output_json = tree_get_content(outputs, vout);
+                if (output_json) {
+                    total += json_get_int64(output_json, "value");
+                    free(output_json);
+                }
+            }
 
-        int64_t fee = json_get_int64(tx_json, "fee");
-        if (fee > threshold) count++;
-        free(tx_json);
+            if (outputs) irmin_tree_free(outputs);
+            i = j;
+        }
     }
 
-    irmin_path_array_free(txs);
-    return count;
+    free(refs);
+    return total;
 }
 
-/* Multi-input tx (> 10 inputs) */
-static int64_t query_multi_input_tx(void) {
-    IrminPathArray *txs = list_path("tx");
-    if (!txs) return 0;
+/* ========================================================================= */
+/* Graph snapshot queries                                                    */
+/* ========================================================================= */
+
+static snapshot_t snapshot;
 
+/* Spent outputs, from the snapshot's out_spent_by column */
+static int64_t query_csr_spent_outputs(void) {
     int64_t count = 0;
-    uint64_t num_txs = irmin_path_array_length(repo, txs);
+    for (uint64_t i = 0; i < snapshot.num_outputs; i++)
+        if (snapshot.out_spent_by[i] != SNAPSHOT_NONE) count++;
+    return count;
+}
 
-    for (uint64_t i = 0; i < num_txs; i++) {
-        IrminPath *tx_path = irmin_path_array_get(repo, txs, i);
-        if (!tx_path) continue;
+/* Weakly connected components of the spending graph */
+static int64_t query_csr_components(void) {
+    return (int64_t)snapshot_components(&snapshot, NULL);
+}
 
-        char *tx_path_str = path_to_string(tx_path);
-        irmin_path_free(tx_path);
-        if (!tx_path_str) continue;
+/* Transactions reachable from the highest fan-out tx within 6 hops */
+static int64_t query_csr_bfs(void) {
+    uint32_t src = 0;
+    uint64_t best = 0;
+    for (uint64_t tx = 0; tx < snapshot.num_txs; tx++) {
+        uint64_t n = snapshot.tx_spenders_off[tx + 1] - snapshot.tx_spenders_off[tx];
+        if (n > best) {
+            best = n;
+            src = (uint32_t)tx;
+        }
+    }
+    return (int64_t)snapshot_bfs(&snapshot, src, 6, NULL, NULL);
+}
 
-        char *tx_json = get_content(tx_path_str);
-        free(tx_path_str);
-        if (!tx_json) continue;
+/*
+ * Group-by over a dictionary code column: a parallel histogram of bytes,
+ * merged at the end. Groups are printed to stderr in descending count
+ * order; the result is the number of non-empty groups.
+ */
+typedef struct {
+    const uint8_t *codes;
+    uint64_t n;
+    uint64_t (*counts)[256]; /* one histogram per thread */
+} histogram_t;
+
+static void histogram_worker(int t, int n, void *ctx) {
+    histogram_t *h = ctx;
+    memset(h->counts[t], 0, sizeof(h->counts[t]));
+    snapshot_histogram(h->codes, h->n * (uint64_t)t / (uint64_t)n,
+                       h->n * (uint64_t)(t + 1) / (uint64_t)n, h->counts[t]);
+}
+
+static int64_t group_by_code(const char *label, const uint8_t *codes,
+                             uint64_t n, const snapshot_dict_t *dict) {
+    int num_threads = bench_threads();
+    histogram_t h = {codes, n, malloc((size_t)num_threads * sizeof(*h.counts))};
+    if (!h.counts) return 0;
+
+    parallel_run(num_threads, histogram_worker, &h);
+
+    uint64_t counts[256] = {0};
+    for (int t = 0; t < num_threads; t++)
+        for (int c = 0; c < 256; c++) counts[c] += h.counts[t][c];
+    free(h.counts);
+
+    int64_t groups = 0;
+    for (;;) {
+        int best = -1;
+        for (int c = 0; c < 256; c++)
+            if (counts[c] > 0 && (best < 0 || counts[c] > counts[best])) best = c;
+        if (best < 0) break;
+        fprintf(stderr, "%s,%s,%lu\n", label, snapshot_dict_name(dict, (uint8_t)best),
+                (unsigned long)counts[best]);
+        counts[best] = 0;
+        groups++;
+    }
+    return groups;
+}
+
+/* Script type distribution */
+static int64_t query_script_type_distribution(void) {
+    return group_by_code("script_type", snapshot.out_script, snapshot.num_outputs,
+                         &snapshot.script_types);
+}
+
+/* Address type distribution */
+static int64_t query_address_type_distribution(void) {
+    return group_by_code("address_type", snapshot.addr_type, snapshot.num_addresses,
+                         &snapshot.addr_types);
+}
+
+/* Tx with the highest flow score after 20 iterations */
+static int64_t query_csr_flow(void) {
+    double *rank = malloc(snapshot.num_txs * sizeof(double));
+    if (!rank) return 0;
+
+    snapshot_flow(&snapshot, rank, 20, 0.85);
+
+    int64_t best = -1;
+    for (uint64_t tx = 0; tx < snapshot.num_txs; tx++)
+        if (best < 0 || rank[tx] > rank[best]) best = (int64_t)tx;
+    free(rank);
+    return best;
+}
+
+/* ========================================================================= */
+/* Rich list                                                                 */
+/* ========================================================================= */
+
+#define RICH_LIST_QUERY_K 1000
+
+typedef struct {
+    int64_t *balance; /* [num_addresses] */
+    snapshot_topk_t heaps[MAX_THREADS];
+} rich_list_t;
+
+static void balance_worker(int t, int n, void *ctx) {
+    rich_list_t *r = ctx;
+    uint64_t lo = snapshot.num_outputs * (uint64_t)t / (uint64_t)n;
+    uint64_t hi = snapshot.num_outputs * (uint64_t)(t + 1) / (uint64_t)n;
+    snapshot_add_balances(&snapshot, lo, hi, r->balance);
+}
+
+static void top_k_worker(int t, int n, void *ctx) {
+    rich_list_t *r = ctx;
+    uint64_t lo = snapshot.num_addresses * (uint64_t)t / (uint64_t)n;
+    uint64_t hi = snapshot.num_addresses * (uint64_t)(t + 1) / (uint64_t)n;
+    for (uint64_t a = lo; a < hi; a++)
+        if (r->balance[a] > 0)
+            snapshot_topk_push(&r->heaps[t], (snapshot_rank_t){(uint32_t)a, r->balance[a]});
+}
+
+/*
+ * The k addresses with the highest balance (value of unspent outputs),
+ * best first. Balances are summed over output ranges in parallel, then
+ * each thread keeps a bounded heap over a range of addresses and the
+ * heaps are merged into result.
+ */
+static bool rich_list(size_t k, snapshot_topk_t *result) {
+    int threads = bench_threads();
+    rich_list_t r;
+    /* Every heap is allocated at size k */
+    if (k > snapshot.num_addresses) k = (size_t)snapshot.num_addresses;
+    r.balance = calloc(snapshot.num_addresses + 1, sizeof(int64_t));
+    bool have_result = r.balance != NULL && snapshot_topk_init(result, k);
+    bool ok = have_result;
+    int ready = 0;
+    for (; ok && ready < threads; ready++)
+        ok = snapshot_topk_init(&r.heaps[ready], k);
+
+    if (ok) {
+        parallel_run(threads, balance_worker, &r);
+        parallel_run(threads, top_k_worker, &r);
+        for (int t = 0; t < threads; t++)
+            for (size_t i = 0; i < r.heaps[t].size; i++)
+                snapshot_topk_push(result, r.heaps[t].items[i]);
+        snapshot_topk_sort(result);
+    }
+
+    for (int t = 0; t < ready; t++) snapshot_topk_free(&r.heaps[t]);
+    if (!ok && have_result) snapshot_topk_free(result);
+    free(r.balance);
+    return ok;
+}
+
+/* Balance of the richest address, via a top-1000 rich list */
+static int64_t query_rich_list(void) {
+    snapshot_topk_t top;
+    if (!rich_list(RICH_LIST_QUERY_K, &top)) return -1;
+    int64_t best = top.size > 0 ? top.items[0].balance : 0;
+    snapshot_topk_free(&top);
+    return best;
+}
+
+/* Print the k richest addresses as CSV */
+static bool run_rich_list(size_t k) {
+    snapshot_topk_t top;
+    if (!rich_list(k, &top)) return false;
+
+    printf("Rank,Address,Balance\n");
+    for (size_t i = 0; i < top.size; i++) {
+        size_t len;
+        const char *key = snapshot_addr_key(&snapshot, top.items[i].addr, &len);
+        printf("%zu,%.*s,%ld\n", i + 1, (int)len, key, (long)top.items[i].balance);
+    }
+    snapshot_topk_free(&top);
+    return true;
+}
+
+/* ========================================================================= */
+/* Time-bucketed aggregates                                                  */
+/* ========================================================================= */
 
-        int tx_id = json_get_int(tx_json, "tx_id");
-        free(tx_json);
+typedef enum { BUCKET_DAY, BUCKET_WEEK, BUCKET_MONTH } bucket_unit_t;
+typedef enum { AGG_COUNT, AGG_SUM, AGG_MAX } agg_op_t;
+typedef enum { ON_TX, ON_OUTPUT } agg_entity_t;
 
-        char inputs_path[256];
-        snprintf(inputs_path, sizeof(inputs_path), "index/tx_inputs/%d", tx_id);
+/* An aggregate over the txs or outputs of each time bucket */
+typedef struct {
+    const char *name;
+    agg_entity_t entity;
+    agg_op_t op;
+    int64_t (*value)(uint64_t i); /* of tx or output ordinal i; NULL for AGG_COUNT */
+} time_aggregate_t;
+
+static int64_t tx_fee_of(uint64_t tx) { return snapshot.tx_fee[tx]; }
+static int64_t out_value_of(uint64_t o) { return snapshot.out_value[o]; }
+static int64_t out_unspent_of(uint64_t o) { return snapshot.out_spent_by[o] == SNAPSHOT_NONE; }
+
+/* Registered time aggregates: adding a row adds a column to the report */
+static const time_aggregate_t time_aggregates[] = {
+    {"txs", ON_TX, AGG_COUNT, NULL},
+    {"fees", ON_TX, AGG_SUM, tx_fee_of},
+    {"max_fee", ON_TX, AGG_MAX, tx_fee_of},
+    {"outputs", ON_OUTPUT, AGG_COUNT, NULL},
+    {"output_value", ON_OUTPUT, AGG_SUM, out_value_of},
+    {"max_output_value", ON_OUTPUT, AGG_MAX, out_value_of},
+    {"unspent_outputs", ON_OUTPUT, AGG_SUM, out_unspent_of},
+};
 
-        IrminPathArray *inputs = list_path(inputs_path);
-        if (inputs) {
-            if (irmin_path_array_length(repo, inputs) > 10) count++;
-            irmin_path_array_free(inputs);
+#define NUM_TIME_AGGREGATES (sizeof(time_aggregates) / sizeof(time_aggregates[0]))
+
+/* Days since 1970-01-01 to a civil date (H. Hinnant's civil_from_days) */
+static void civil_from_days(int64_t z, int *y, int *m, int *d) {
+    z += 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    int64_t doe = z - era * 146097;
+    int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int64_t mp = (5 * doy + 2) / 153;
+    *d = (int)(doy - (153 * mp + 2) / 5 + 1);
+    *m = (int)(mp < 10 ? mp + 3 : mp - 9);
+    *y = (int)(yoe + era * 400 + (*m <= 2));
+}
+
+static int64_t floor_div(int64_t a, int64_t b) {
+    return a / b - ((a % b != 0) && ((a < 0) != (b < 0)));
+}
+
+/* Bucket key of a timestamp: days, weeks (starting Monday) or months since epoch */
+static int64_t bucket_key(bucket_unit_t unit, int64_t timestamp) {
+    int64_t days = floor_div(timestamp, 86400);
+    if (unit == BUCKET_DAY) return days;
+    if (unit == BUCKET_WEEK) return floor_div(days + 3, 7); /* 1970-01-01 was a Thursday */
+    int y, m, d;
+    civil_from_days(days, &y, &m, &d);
+    return (int64_t)y * 12 + (m - 1);
+}
+
+static void bucket_label(bucket_unit_t unit, int64_t key, char *buf, size_t len) {
+    int y, m, d;
+    if (unit == BUCKET_MONTH) {
+        snprintf(buf, len, "%04d-%02d", (int)floor_div(key, 12), (int)(key - floor_div(key, 12) * 12) + 1);
+        return;
+    }
+    civil_from_days(unit == BUCKET_DAY ? key : key * 7 - 3, &y, &m, &d);
+    snprintf(buf, len, "%04d-%02d-%02d", y, m, d);
+}
+
+typedef struct {
+    const uint32_t *height_bucket; /* [num_blocks] bucket index of each height */
+    uint64_t num_buckets;
+    int64_t **acc;                 /* per thread: [num_buckets][NUM_TIME_AGGREGATES] */
+    uint64_t **txs;                /* per thread: txs seen in each bucket */
+} time_series_t;
+
+static void time_series_worker(int t, int n, void *ctx) {
+    time_series_t *ts = ctx;
+    int64_t *acc = ts->acc[t];
+    uint64_t *txs = ts->txs[t];
+    uint64_t lo = snapshot.num_txs * (uint64_t)t / (uint64_t)n;
+    uint64_t hi = snapshot.num_txs * (uint64_t)(t + 1) / (uint64_t)n;
+
+    for (uint64_t b = 0; b < ts->num_buckets; b++)
+        for (size_t a = 0; a < NUM_TIME_AGGREGATES; a++)
+            acc[b * NUM_TIME_AGGREGATES + a] =
+                time_aggregates[a].op == AGG_MAX ? INT64_MIN : 0;
+
+    for (uint64_t tx = lo; tx < hi; tx++) {
+        uint32_t height = snapshot.tx_height[tx];
+        if (height >= snapshot.num_blocks || ts->height_bucket[height] == SNAPSHOT_NONE)
+            continue;
+        uint64_t b = ts->height_bucket[height];
+        int64_t *row = &acc[b * NUM_TIME_AGGREGATES];
+        txs[b]++;
+
+        uint64_t first;
+        uint64_t num_outputs = snapshot_tx_outputs(&snapshot, (uint32_t)tx, &first);
+
+        for (size_t a = 0; a < NUM_TIME_AGGREGATES; a++) {
+            const time_aggregate_t *agg = &time_aggregates[a];
+            uint64_t i = agg->entity == ON_TX ? tx : first;
+            uint64_t end = agg->entity == ON_TX ? tx + 1 : first + num_outputs;
+            for (; i < end; i++) {
+                if (agg->op == AGG_COUNT) {
+                    row[a]++;
+                } else {
+                    int64_t v = agg->value(i);
+                    if (agg->op == AGG_SUM) row[a] += v;
+                    else if (v > row[a]) row[a] = v;
+                }
+            }
         }
     }
+}
 
-    irmin_path_array_free(txs);
-    return count;
+/*
+ * Compute every registered time aggregate per bucket in one parallel scan
+ * over the snapshot's txs, and print them as CSV.
+ */
+static bool run_time_series(bucket_unit_t unit) {
+    if (snapshot.num_blocks == 0) return false;
+
+    /* Dense height -> bucket array, built once; heights without a block
+       record have no time and no bucket */
+    uint32_t *height_bucket = malloc(snapshot.num_blocks * sizeof(uint32_t));
+    if (!height_bucket) return false;
+    int64_t min_key = INT64_MAX, max_key = INT64_MIN;
+    for (uint64_t h = 0; h < snapshot.num_blocks; h++) {
+        if (snapshot.block_time[h] == SNAPSHOT_NO_TIME) continue;
+        int64_t key = bucket_key(unit, snapshot.block_time[h]);
+        if (key < min_key) min_key = key;
+        if (key > max_key) max_key = key;
+    }
+    if (min_key > max_key) {
+        free(height_bucket);
+        return false;
+    }
+    for (uint64_t h = 0; h < snapshot.num_blocks; h++)
+        height_bucket[h] = snapshot.block_time[h] == SNAPSHOT_NO_TIME
+                               ? SNAPSHOT_NONE
+                               : (uint32_t)(bucket_key(unit, snapshot.block_time[h]) - min_key);
+
+    int num_threads = bench_threads();
+    time_series_t ts = {height_bucket, (uint64_t)(max_key - min_key + 1),
+                        calloc((size_t)num_threads, sizeof(int64_t *)),
+                        calloc((size_t)num_threads, sizeof(uint64_t *))};
+    bool ok = ts.acc && ts.txs;
+    for (int t = 0; ok && t < num_threads; t++) {
+        ts.acc[t] = malloc(ts.num_buckets * NUM_TIME_AGGREGATES * sizeof(int64_t));
+        ts.txs[t] = calloc(ts.num_buckets, sizeof(uint64_t));
+        ok = ts.acc[t] && ts.txs[t];
+    }
+
+    if (ok) {
+        double start = get_time_ms();
+        parallel_run(num_threads, time_series_worker, &ts);
+
+        /* Merge into thread 0 */
+        for (int t = 1; t < num_threads; t++) {
+            for (uint64_t b = 0; b < ts.num_buckets; b++) {
+                ts.txs[0][b] += ts.txs[t][b];
+                for (size_t a = 0; a < NUM_TIME_AGGREGATES; a++) {
+                    int64_t *dst = &ts.acc[0][b * NUM_TIME_AGGREGATES + a];
+                    int64_t v = ts.acc[t][b * NUM_TIME_AGGREGATES + a];
+                    if (time_aggregates[a].op == AGG_MAX) {
+                        if (v > *dst) *dst = v;
+                    } else {
+                        *dst += v;
+                    }
+                }
+            }
+        }
+        fprintf(stderr, "Time series: %.3f ms\n", get_time_ms() - start);
+
+        printf("Bucket");
+        for (size_t a = 0; a < NUM_TIME_AGGREGATES; a++) printf(",%s", time_aggregates[a].name);
+        printf("\n");
+        for (uint64_t b = 0; b < ts.num_buckets; b++) {
+            if (ts.txs[0][b] == 0) continue;
+            char label[32];
+            bucket_label(unit, min_key + (int64_t)b, label, sizeof(label));
+            printf("%s", label);
+            for (size_t a = 0; a < NUM_TIME_AGGREGATES; a++) {
+                int64_t v = ts.acc[0][b * NUM_TIME_AGGREGATES + a];
+                printf(",%ld", (long)(v == INT64_MIN ? 0 : v));
+            }
+            printf("\n");
+        }
+    }
+
+    for (int t = 0; t < num_threads; t++) {
+        if (ts.acc) free(ts.acc[t]);
+        if (ts.txs) free(ts.txs[t]);
+    }
+    free(ts.acc);
+    free(ts.txs);
+    free(height_bucket);
+    return ok;
 }
 
 /* ========================================================================= */
@@ -655,8 +1726,11 @@ static benchmark_t benchmarks[] = {
     {"Tx locktime > 0", query_tx_locktime_gt_0},
     {"Max output value", query_max_output_value},
     {"Calculate fee", query_calculate_fee},
+    {"Zero-conf outputs", query_zero_conf_outputs},
+    {"Locktime change", query_locktime_change},
     {"Total output value", query_total_output_value},
     {"Total fees", query_total_fees},
+    {"Max input value", query_max_input_value},
     {"Tx version > 1", query_tx_version_gt_1},
     {"Avg tx per block", query_avg_tx_per_block},
     {"Max tx per block", query_max_tx_per_block},
@@ -667,8 +1741,145 @@ static benchmark_t benchmarks[] = {
     {NULL, NULL}
 };
 
+static benchmark_t address_benchmarks[] = {
+    {"Satoshi Dice address", query_satoshi_dice},
+    {NULL, NULL}
+};
+
+static benchmark_t graph_benchmarks[] = {
+    {"Spent outputs (CSR)", query_csr_spent_outputs},
+    {"Graph components (CSR)", query_csr_components},
+    {"Graph BFS depth 6 (CSR)", query_csr_bfs},
+    {"Graph flow top tx (CSR)", query_csr_flow},
+    {"Script type distribution", query_script_type_distribution},
+    {"Address type distribution", query_address_type_distribution},
+    {"Rich list top 1000 (CSR)", query_rich_list},
+    {NULL, NULL}
+};
+
+/* Result cache for the head commit, if -c was given */
+static result_cache_t result_cache;
+static bool use_cache = false;
+
+/* Hash of the head commit, as printed by Irmin; false if there is none */
+static bool head_commit(char *out, size_t size) {
+    IrminCommit *head = irmin_get_head(store);
+    if (!head) return false;
+
+    bool ok = false;
+    IrminHash *hash = irmin_commit_hash(repo, head);
+    if (hash) {
+        IrminString *s = irmin_hash_to_string(repo, hash);
+        if (s) {
+            snprintf(out, size, "%.*s", (int)irmin_string_length(s), irmin_string_data(s));
+            irmin_string_free(s);
+            ok = true;
+        }
+        irmin_hash_free(hash);
+    }
+    irmin_commit_free(head);
+    return ok;
+}
+
+/*
+ * The store as of block height: a read-only checkout of the commit that
+ * `import --commit-per-block` recorded for it in store_path.heights
+ * (last line wins, see lib/history.ml). NULL if there is none.
+ */
+static Irmin *store_at_height(const char *store_path, long height) {
+    char path[4096], line[256], hash[128] = "";
+    snprintf(path, sizeof(path), "%s.heights", store_path);
+    FILE *f = fopen(path, "r");
+    if (!f) return NULL;
+    while (fgets(line, sizeof(line), f)) {
+        char *tab = strchr(line, '\t');
+        if (!tab || strtol(line, NULL, 10) != height) continue;
+        snprintf(hash, sizeof(hash), "%s", tab + 1);
+        hash[strcspn(hash, "\r\n")] = '\0';
+    }
+    fclose(f);
+    if (!hash[0]) return NULL;
+
+    IrminHash *h = irmin_hash_of_string(repo, hash, (int64_t)strlen(hash));
+    if (!h) return NULL;
+    IrminCommit *commit = irmin_commit_of_hash(repo, h);
+    irmin_hash_free(h);
+    if (!commit) return NULL;
+    Irmin *at = irmin_of_commit(repo, commit);
+    irmin_commit_free(commit);
+    return at;
+}
+
+/* Run a table; params ("name=value" lines) are part of the cache key */
+static void run_benchmarks(const benchmark_t *table, const char *params) {
+    for (int i = 0; table[i].name != NULL; i++) {
+        char query[256];
+        snprintf(query, sizeof(query), "bench %s", table[i].name);
+
+        double start = get_time_ms();
+        int64_t result;
+        char *cached = use_cache ? result_cache_get(&result_cache, query, params, NULL) : NULL;
+        if (cached) {
+            result = strtoll(cached, NULL, 10);
+            free(cached);
+        } else {
+            result = table[i].query();
+        }
+        double elapsed = get_time_ms() - start;
+
+        if (use_cache && !cached) {
+            char value[32];
+            int n = snprintf(value, sizeof(value), "%ld", (long)result);
+            result_cache_put(&result_cache, query, params, value, (size_t)n);
+        }
+
+        printf("%s,%.3f,%ld\n", table[i].name, elapsed, (long)result);
+        fflush(stdout);
+    }
+}
+
 int main(int argc, char *argv[]) {
-    const char *store_path = (argc > 1) ? argv[1] : "./local-store";
+    const char *store_path = "./local-store";
+    const char *time_unit = NULL;
+    long rich_k = 0;
+    long at_height = -1;
+
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-a") == 0 || strcmp(argv[i], "--address") == 0) &&
+            i + 1 < argc) {
+            query_addresses = argv[++i];
+        } else if ((strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--time-series") == 0) &&
+                   i + 1 < argc) {
+            time_unit = argv[++i];
+            if (strcmp(time_unit, "day") != 0 && strcmp(time_unit, "week") != 0 &&
+                strcmp(time_unit, "month") != 0) {
+                fprintf(stderr, "Error: -t takes day, week or month, not %s\n", time_unit);
+                return 1;
+            }
+        } else if ((strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "--rich-list") == 0) &&
+                   i + 1 < argc) {
+            rich_k = atol(argv[++i]);
+        } else if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--cache") == 0) {
+            use_cache = true;
+        } else if (strcmp(argv[i], "--at") == 0 && i + 1 < argc) {
+            at_height = atol(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr,
+                    "Usage: %s [STORE] [-a ADDRESS_ID[,ADDRESS_ID...]] [-t day|week|month]"
+                    " [-r K] [-c] [--at HEIGHT]\n",
+                    argv[0]);
+            return 1;
+        } else {
+            store_path = argv[i];
+        }
+    }
+
+    /* -r and -t read the snapshot, which is of the head */
+    if (at_height >= 0 && (rich_k > 0 || time_unit)) {
+        fprintf(stderr, "Error: --at can't be combined with -r or -t, which read the snapshot"
+                        " of the head\n");
+        return 1;
+    }
 
     /* Create config for pack store with string contents */
     IrminConfig *config = irmin_config_pack(NULL, "string");
@@ -710,20 +1921,87 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    if (at_height >= 0) {
+        Irmin *at = store_at_height(store_path, at_height);
+        if (!at) {
+            fprintf(stderr, "Error: no commit recorded for block %ld in %s.heights\n",
+                    at_height, store_path);
+            irmin_free(store);
+            irmin_repo_free(repo);
+            irmin_config_free(config);
+            return 1;
+        }
+        irmin_free(store);
+        store = at;
+    }
+
+    /* Graph snapshot is optional */
+    char snapshot_dir[4096];
+    snprintf(snapshot_dir, sizeof(snapshot_dir), "%s.snapshot", store_path);
+    bool have_snapshot = snapshot_open(&snapshot, snapshot_dir);
+
+    if (rich_k > 0) {
+        int status = 0;
+        if (!have_snapshot) {
+            fprintf(stderr, "Error: the rich list needs a snapshot in %s\n", snapshot_dir);
+            status = 1;
+        } else {
+            if (!run_rich_list((size_t)rich_k)) status = 1;
+            snapshot_close(&snapshot);
+        }
+        irmin_free(store);
+        irmin_repo_free(repo);
+        irmin_config_free(config);
+        return status;
+    }
+
+    if (time_unit) {
+        bucket_unit_t unit = strcmp(time_unit, "day") == 0    ? BUCKET_DAY
+                             : strcmp(time_unit, "week") == 0 ? BUCKET_WEEK
+                                                              : BUCKET_MONTH;
+        int status = 0;
+        if (!have_snapshot) {
+            fprintf(stderr, "Error: time series need a snapshot in %s\n", snapshot_dir);
+            status = 1;
+        } else {
+            if (!run_time_series(unit)) status = 1;
+            snapshot_close(&snapshot);
+        }
+        irmin_free(store);
+        irmin_repo_free(repo);
+        irmin_config_free(config);
+        return status;
+    }
+
+    if (use_cache) {
+        char commit[128];
+        use_cache = head_commit(commit, sizeof(commit)) &&
+                    result_cache_init(&result_cache, store_path, commit);
+        if (!use_cache) fprintf(stderr, "Warning: no head commit, not caching results\n");
+        if (use_cache && partial_cache_open(&partial_cache, store_path)) partials = &partial_cache;
+    }
+
     /* Print CSV header */
     printf("Query,Time_ms,Result\n");
 
     /* Run benchmarks */
-    for (int i = 0; benchmarks[i].name != NULL; i++) {
-        double start = get_time_ms();
-        int64_t result = benchmarks[i].query();
-        double elapsed = get_time_ms() - start;
-
-        printf("%s,%.3f,%ld\n", benchmarks[i].name, elapsed, (long)result);
-        fflush(stdout);
+    run_benchmarks(benchmarks, "");
+    if (query_addresses) {
+        char params[4096];
+        snprintf(params, sizeof(params), "addresses=%s", query_addresses);
+        run_benchmarks(address_benchmarks, params);
+    }
+    if (have_snapshot) {
+        /* The snapshot is of the head, not of block --at. It is rebuilt
+           apart from the store, so its commit is part of the key. */
+        char params[256];
+        snprintf(params, sizeof(params), "snapshot=%s", snapshot.commit);
+        if (at_height < 0) run_benchmarks(graph_benchmarks, params);
+        snapshot_close(&snapshot);
     }
 
     /* Cleanup */
+    if (partials) partial_cache_close(partials);
     irmin_free(store);
     irmin_repo_free(repo);
     irmin_config_free(config);
@@ -0,0 +1,253 @@
+/**
+ * Lookup index loading and search (see hash_index.h).
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hash_index.h"
+#include "record.h"
+
+#define HASH_INDEX_MAGIC "BSHIDX01"
+#define HASH_INDEX_HEADER 16
+
+bool hash_index_open(hash_index_t *idx, const char *dir, const char *name) {
+    memset(idx, 0, sizeof(*idx));
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < HASH_INDEX_HEADER) {
+        close(fd);
+        return false;
+    }
+
+    void *addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) return false;
+
+    const uint8_t *base = addr;
+    uint64_t count;
+    memcpy(&count, base + 8, sizeof(count));
+    if (memcmp(base, HASH_INDEX_MAGIC, 8) != 0 ||
+        (uint64_t)st.st_size != HASH_INDEX_HEADER + count * 12) {
+        fprintf(stderr, "Hash index: bad file %s\n", path);
+        munmap(addr, (size_t)st.st_size);
+        return false;
+    }
+
+    idx->count = count;
+    idx->prefixes = (const uint64_t *)(base + HASH_INDEX_HEADER);
+    idx->ids = (const uint32_t *)(base + HASH_INDEX_HEADER + count * 8);
+    idx->addr = addr;
+    idx->len = (size_t)st.st_size;
+    return true;
+}
+
+void hash_index_close(hash_index_t *idx) {
+    if (idx->addr) munmap(idx->addr, idx->len);
+    memset(idx, 0, sizeof(*idx));
+}
+
+bool hash_index_prefix(const char *hash, uint64_t *prefix) {
+    uint8_t raw[8];
+    if (strnlen(hash, 16) < 16 || !hex_decode(hash, 8, raw)) return false;
+
+    uint64_t p = 0;
+    for (int i = 0; i < 8; i++) p = (p << 8) | raw[i];
+    *prefix = p;
+    return true;
+}
+
+/*
+ * First entry whose prefix is not below p. Interpolation steps alternate
+ * with bisection, so skewed prefixes still cost O(log n).
+ */
+static uint64_t lower_bound(const hash_index_t *idx, uint64_t p) {
+    const uint64_t *k = idx->prefixes;
+    uint64_t lo = 0, hi = idx->count;
+    bool interpolate = true;
+
+    while (hi - lo > 8) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (interpolate && k[hi - 1] > k[lo]) {
+            double span = (double)(hi - 1 - lo);
+            double off = ((double)p - (double)k[lo]) /
+                         ((double)k[hi - 1] - (double)k[lo]) * span;
+            if (off < 0) off = 0;
+            if (off > span) off = span;
+            mid = lo + (uint64_t)off;
+        }
+        if (k[mid] < p) lo = mid + 1;
+        else hi = mid;
+        interpolate = !interpolate;
+    }
+    while (lo < hi && k[lo] < p) lo++;
+    return lo;
+}
+
+uint64_t hash_index_find(const hash_index_t *idx, const char *hash,
+                         uint64_t *first) {
+    uint64_t p;
+    *first = 0;
+    if (!hash_index_prefix(hash, &p)) return 0;
+
+    uint64_t i = lower_bound(idx, p), n = 0;
+    *first = i;
+    while (i + n < idx->count && idx->prefixes[i + n] == p) n++;
+    return n;
+}
+
+/* ========================================================================= */
+/* Address index                                                             */
+/* ========================================================================= */
+
+#define ADDR_INDEX_MAGIC "BSADDR01"
+#define ADDR_INDEX_HEADER 24
+
+bool addr_index_open(addr_index_t *idx, const char *dir) {
+    memset(idx, 0, sizeof(*idx));
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, ADDR_INDEX_FILE);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < ADDR_INDEX_HEADER + 8) {
+        close(fd);
+        return false;
+    }
+
+    void *addr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) return false;
+
+    const uint8_t *base = addr;
+    uint64_t count, blocks;
+    memcpy(&count, base + 8, sizeof(count));
+    memcpy(&blocks, base + 16, sizeof(blocks));
+    uint64_t data_pos = ADDR_INDEX_HEADER + (blocks + 1) * 8;
+    const uint64_t *block_off = (const uint64_t *)(base + ADDR_INDEX_HEADER);
+    bool ok = memcmp(base, ADDR_INDEX_MAGIC, 8) == 0 &&
+              blocks < (uint64_t)st.st_size / 8 &&
+              (uint64_t)st.st_size >= data_pos &&
+              (uint64_t)st.st_size == data_pos + block_off[blocks];
+    /* Block offsets must rise within the data, so scans stay in the file */
+    for (uint64_t b = 0; ok && b < blocks; b++) ok = block_off[b] <= block_off[b + 1];
+    if (!ok) {
+        fprintf(stderr, "Address index: bad file %s\n", path);
+        munmap(addr, (size_t)st.st_size);
+        return false;
+    }
+
+    idx->count = count;
+    idx->blocks = blocks;
+    idx->block_off = block_off;
+    idx->data = base + data_pos;
+    idx->addr = addr;
+    idx->len = (size_t)st.st_size;
+    return true;
+}
+
+void addr_index_close(addr_index_t *idx) {
+    if (idx->addr) munmap(idx->addr, idx->len);
+    memset(idx, 0, sizeof(*idx));
+}
+
+/* LEB128 varint at *p, reading nothing at or past end; false on overrun */
+static bool read_varint(const uint8_t **p, const uint8_t *end, uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; *p < end && shift < 64; shift += 7) {
+        uint8_t b = *(*p)++;
+        *v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+/* Compare the first key of block b with key; a corrupt head sorts last */
+static int head_cmp(const addr_index_t *idx, uint64_t b, const char *key) {
+    const uint8_t *p = idx->data + idx->block_off[b];
+    const uint8_t *end = idx->data + idx->block_off[b + 1];
+    uint64_t len;
+    if (!read_varint(&p, end, &len) || len > (uint64_t)(end - p)) return 1;
+    size_t klen = strlen(key);
+    int c = memcmp(p, key, len < klen ? len : klen);
+    if (c != 0) return c;
+    return len < klen ? -1 : len > klen;
+}
+
+uint64_t addr_index_search(const addr_index_t *idx, const char *prefix,
+                           uint64_t limit, addr_index_fn fn, void *ctx) {
+    /* Start one block before the first head not below prefix */
+    uint64_t lo = 0, hi = idx->blocks;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (head_cmp(idx, mid, prefix) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    size_t plen = strlen(prefix);
+    char key[ADDR_INDEX_MAX_KEY + 1], id[ADDR_INDEX_MAX_KEY + 1];
+    uint64_t found = 0;
+    for (uint64_t b = lo > 0 ? lo - 1 : 0; b < idx->blocks; b++) {
+        const uint8_t *p = idx->data + idx->block_off[b];
+        const uint8_t *end = idx->data + idx->block_off[b + 1];
+        size_t klen = 0;
+        for (bool first = true; p < end; first = false) {
+            uint64_t shared = 0, len, id_len;
+            if (!first && !read_varint(&p, end, &shared)) return found;
+            if (!read_varint(&p, end, &len)) return found;
+            if (shared > klen || shared + len > ADDR_INDEX_MAX_KEY ||
+                len > (uint64_t)(end - p))
+                return found;
+            memcpy(key + shared, p, len);
+            klen = shared + len;
+            key[klen] = '\0';
+            p += len;
+            if (!read_varint(&p, end, &id_len) || id_len > ADDR_INDEX_MAX_KEY ||
+                id_len > (uint64_t)(end - p))
+                return found;
+            memcpy(id, p, id_len);
+            id[id_len] = '\0';
+            p += id_len;
+
+            int c = strncmp(key, prefix, plen);
+            if (c < 0) continue;
+            if (c > 0 || found >= limit) return found;
+            found++;
+            if (!fn(key, id, ctx)) return found;
+        }
+    }
+    return found;
+}
+
+typedef struct {
+    const char *addr;
+    char *id;
+    size_t size;
+    bool found;
+} find_ctx_t;
+
+static bool find_exact(const char *addr, const char *id, void *ctx) {
+    find_ctx_t *f = ctx;
+    if (strcmp(addr, f->addr) != 0) return true;
+    snprintf(f->id, f->size, "%s", id);
+    f->found = true;
+    return false;
+}
+
+bool addr_index_find(const addr_index_t *idx, const char *addr, char *id,
+                     size_t size) {
+    /* The exact key is the first entry with it as a prefix, if present */
+    find_ctx_t f = {addr, id, size, false};
+    addr_index_search(idx, addr, 1, find_exact, &f);
+    return f.found;
+}
@@ -0,0 +1,94 @@
+/**
+ * Read-only access to the irmin-blocksci lookup indexes.
+ *
+ * `irmin-blocksci import` (or `index`) writes STORE.index/ with one file
+ * per index (see lib/hash_index.ml):
+ *
+ *   magic   "BSHIDX01"
+ *   count   u64
+ *   prefix  u64 [count]   first 8 hash bytes, big-endian, sorted
+ *   id      u32 [count]
+ *
+ * Lookups interpolate on the prefix. Prefixes may collide, so callers
+ * check the full hash of each candidate against the store. Addresses use
+ * a front-coded index with prefix search instead (see below).
+ */
+
+#ifndef BLOCKSCI_HASH_INDEX_H
+#define BLOCKSCI_HASH_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define HASH_INDEX_TX "tx_hash.idx"
+#define HASH_INDEX_BLOCK "block_hash.idx"
+
+typedef struct {
+    uint64_t count;
+    const uint64_t *prefixes;  /* [count] */
+    const uint32_t *ids;       /* [count] */
+    void *addr;
+    size_t len;
+} hash_index_t;
+
+/* Map dir/name. Returns false if it is missing or malformed. */
+bool hash_index_open(hash_index_t *idx, const char *dir, const char *name);
+void hash_index_close(hash_index_t *idx);
+
+/* Prefix of a hex hash; false if it has fewer than 16 hex digits */
+bool hash_index_prefix(const char *hash, uint64_t *prefix);
+
+/*
+ * Entries whose prefix equals that of hash, as the range
+ * [*first, *first + n) of idx->ids.
+ */
+uint64_t hash_index_find(const hash_index_t *idx, const char *hash,
+                         uint64_t *first);
+
+/* ========================================================================= */
+/* Address index                                                             */
+/* ========================================================================= */
+
+/*
+ * Address string -> address ID, as sorted front-coded blocks of up to 16
+ * entries (see Hash_index.Address in lib/hash_index.ml):
+ *
+ *   magic      "BSADDR01"
+ *   count      u64
+ *   blocks     u64
+ *   block_off  u64 [blocks + 1]
+ *   data       first entry: len key len id
+ *              others:      shared len suffix len id   (LEB128 lengths)
+ */
+
+#define ADDR_INDEX_FILE "addresses.idx"
+#define ADDR_INDEX_MAX_KEY 256
+
+typedef struct {
+    uint64_t count;
+    uint64_t blocks;
+    const uint64_t *block_off;  /* [blocks + 1] */
+    const uint8_t *data;
+    void *addr;
+    size_t len;
+} addr_index_t;
+
+bool addr_index_open(addr_index_t *idx, const char *dir);
+void addr_index_close(addr_index_t *idx);
+
+/* Called with each match (NUL-terminated); return false to stop */
+typedef bool (*addr_index_fn)(const char *addr, const char *id, void *ctx);
+
+/*
+ * Visit the entries whose address starts with prefix, in address order,
+ * up to limit. Returns the number visited.
+ */
+uint64_t addr_index_search(const addr_index_t *idx, const char *prefix,
+                           uint64_t limit, addr_index_fn fn, void *ctx);
+
+/* Copy the ID of address addr into id; false if it is not indexed */
+bool addr_index_find(const addr_index_t *idx, const char *addr, char *id,
+                     size_t size);
+
+#endif
@@ -0,0 +1,213 @@
+/**
+ * Look up store records by hash through the STORE.index/ hash indexes.
+ *
+ * Usage:
+ *   ./lookup STORE tx HASH
+ *   ./lookup STORE block HASH
+ *   ./lookup STORE address ADDRESS
+ *   ./lookup STORE search PREFIX [LIMIT]
+ *
+ * The hash indexes narrow a hash to a few candidate IDs without touching
+ * the store; each candidate record is then read through libirmin and its
+ * full hash compared. The address index maps address strings to IDs
+ * exactly, and `search` lists the addresses starting with PREFIX without
+ * opening the store at all. Build the indexes with
+ * `irmin-blocksci index -s STORE` (import does this too).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "irmin.h"
+#include "hash_index.h"
+#include "record.h"
+
+/*
+ * Contents at path_str as a malloc'd, NUL-terminated copy, or NULL. Binary
+ * records may contain NUL bytes; their length goes to *len if not NULL.
+ */
+static char *find_value(IrminRepo *repo, Irmin *store, const char *path_str,
+                        size_t *len) {
+    IrminPath *path = irmin_path_of_string(repo, (char *)path_str, strlen(path_str));
+    if (!path) return NULL;
+
+    char *result = NULL;
+    IrminContents *contents = irmin_find(store, path);
+    if (contents) {
+        IrminString *value = irmin_contents_to_string(repo, contents);
+        if (value) {
+            size_t n = (size_t)irmin_string_length(value);
+            result = malloc(n + 1);
+            if (result) {
+                memcpy(result, irmin_string_data(value), n);
+                result[n] = '\0';
+                if (len) *len = n;
+            }
+            irmin_string_free(value);
+        }
+        irmin_contents_free(contents);
+    }
+    irmin_path_free(path);
+    return result;
+}
+
+/* Contents at path_str as a malloc'd string, or NULL */
+static char *find_string(IrminRepo *repo, Irmin *store, const char *path_str) {
+    return find_value(repo, store, path_str, NULL);
+}
+
+/* Whether a block or tx record (JSON or binary) has hash, ignoring case */
+static bool has_hash(const char *value, size_t len, const char *hash) {
+    block_record_t b;
+    tx_record_t t;
+    const char *h = record_decode_block(value, len, &b) ? b.hash
+                  : record_decode_tx(value, len, &t)    ? t.hash
+                                                        : NULL;
+    return h && strcasecmp(h, hash) == 0;
+}
+
+/* Print the record under prefix/<id> whose hash matches; 0 if found */
+static int lookup(IrminRepo *repo, Irmin *store, const char *index_dir,
+                  const char *file, const char *prefix, const char *hash) {
+    hash_index_t idx;
+    if (!hash_index_open(&idx, index_dir, file)) {
+        fprintf(stderr, "No hash index %s/%s (run irmin-blocksci index)\n",
+                index_dir, file);
+        return 2;
+    }
+
+    uint64_t first;
+    uint64_t n = hash_index_find(&idx, hash, &first);
+    int status = 1;
+    for (uint64_t i = 0; i < n && status != 0; i++) {
+        char path[64];
+        snprintf(path, sizeof(path), "%s/%u", prefix, idx.ids[first + i]);
+        size_t len;
+        char *record = find_value(repo, store, path, &len);
+        if (record && has_hash(record, len, hash)) {
+            char *json = record_to_json(record, len);
+            printf("%s\n", json ? json : "(undecodable record)");
+            free(json);
+            status = 0;
+        }
+        free(record);
+    }
+    if (status != 0) printf("%s not found\n", hash);
+
+    hash_index_close(&idx);
+    return status;
+}
+
+static bool print_match(const char *addr, const char *id, void *ctx) {
+    (void)ctx;
+    printf("%s\t%s\n", addr, id);
+    return true;
+}
+
+/* List up to limit indexed addresses starting with prefix */
+static int search(const char *index_dir, const char *prefix, uint64_t limit) {
+    addr_index_t idx;
+    if (!addr_index_open(&idx, index_dir)) {
+        fprintf(stderr, "No address index in %s (run irmin-blocksci index)\n",
+                index_dir);
+        return 2;
+    }
+    uint64_t n = addr_index_search(&idx, prefix, limit, print_match, NULL);
+    addr_index_close(&idx);
+    return n > 0 ? 0 : 1;
+}
+
+/* Print the record of the address with string addr; 0 if found */
+static int lookup_address(IrminRepo *repo, Irmin *store, const char *index_dir,
+                          const char *addr) {
+    addr_index_t idx;
+    if (!addr_index_open(&idx, index_dir)) {
+        fprintf(stderr, "No address index in %s (run irmin-blocksci index)\n",
+                index_dir);
+        return 2;
+    }
+
+    char id[ADDR_INDEX_MAX_KEY + 1];
+    bool found = addr_index_find(&idx, addr, id, sizeof(id));
+    addr_index_close(&idx);
+    if (!found) {
+        printf("%s not found\n", addr);
+        return 1;
+    }
+
+    char path[ADDR_INDEX_MAX_KEY + 16];
+    snprintf(path, sizeof(path), "address/%s", id);
+    char *record = find_string(repo, store, path);
+    printf("address ID %s: %s\n", id, record ? record : "(no record)");
+    free(record);
+    return 0;
+}
+
+/* Record kinds: index file and the store prefix its IDs live under */
+static const struct {
+    const char *kind;
+    const char *file;
+    const char *prefix;
+} kinds[] = {
+    {"tx", HASH_INDEX_TX, "tx"},
+    {"block", HASH_INDEX_BLOCK, "block"},
+};
+
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        fprintf(stderr,
+                "Usage: %s STORE tx|block HASH\n"
+                "       %s STORE address ADDRESS\n"
+                "       %s STORE search PREFIX [LIMIT]\n",
+                argv[0], argv[0], argv[0]);
+        return 2;
+    }
+    const char *store_path = argv[1];
+
+    char index_dir[4096];
+    snprintf(index_dir, sizeof(index_dir), "%s.index", store_path);
+
+    /* Prefix search only reads the index */
+    if (strcmp(argv[2], "search") == 0)
+        return search(index_dir, argv[3],
+                      argc > 4 ? strtoull(argv[4], NULL, 10) : 20);
+
+    int k = -1;
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++)
+        if (strcmp(argv[2], kinds[i].kind) == 0) k = (int)i;
+    if (k < 0 && strcmp(argv[2], "address") != 0) {
+        fprintf(stderr, "Unknown lookup kind: %s\n", argv[2]);
+        return 2;
+    }
+
+    IrminConfig *config = irmin_config_pack(NULL, "string");
+    if (!config || !irmin_config_set_root(config, store_path)) {
+        fprintf(stderr, "Error: Failed to create config\n");
+        if (config) irmin_config_free(config);
+        return 1;
+    }
+    IrminRepo *repo = irmin_repo_new(config);
+    if (!repo || irmin_repo_has_error(repo)) {
+        fprintf(stderr, "Error: Failed to open repository\n");
+        if (repo) irmin_repo_free(repo);
+        irmin_config_free(config);
+        return 1;
+    }
+    Irmin *store = irmin_main(repo);
+    if (!store) {
+        fprintf(stderr, "Error: Failed to get main store\n");
+        irmin_repo_free(repo);
+        irmin_config_free(config);
+        return 1;
+    }
+
+    int status = k < 0
+        ? lookup_address(repo, store, index_dir, argv[3])
+        : lookup(repo, store, index_dir, kinds[k].file, kinds[k].prefix, argv[3]);
+
+    irmin_free(store);
+    irmin_repo_free(repo);
+    irmin_config_free(config);
+    return status;
+}
@@ -0,0 +1,110 @@
+/**
+ * Per-block partial aggregates keyed by subtree content hash (see
+ * partial_cache.h).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "partial_cache.h"
+#include "result_cache.h"
+
+static size_t entry_slot(const partial_cache_t *c, const char *entry, size_t len) {
+    uint64_t h = result_cache_fnv1a(RESULT_CACHE_FNV_OFFSET, entry, len);
+    size_t mask = c->capacity - 1, i = (size_t)h & mask;
+    while (c->slots[i].key && strcmp(c->slots[i].key, entry) != 0) i = (i + 1) & mask;
+    return i;
+}
+
+static bool grow(partial_cache_t *c) {
+    size_t capacity = c->capacity ? c->capacity * 2 : 1024;
+    partial_entry_t *slots = calloc(capacity, sizeof(partial_entry_t));
+    if (!slots) return false;
+
+    partial_cache_t bigger = {slots, capacity, c->count, c->log};
+    for (size_t i = 0; i < c->capacity; i++) {
+        char *key = c->slots[i].key;
+        if (key) bigger.slots[entry_slot(&bigger, key, strlen(key))] = c->slots[i];
+    }
+    free(c->slots);
+    *c = bigger;
+    return true;
+}
+
+/* Insert or overwrite the entry "key\tquery"; takes ownership of entry */
+static void insert(partial_cache_t *c, char *entry, int64_t value) {
+    if ((c->count + 1) * 2 > c->capacity && !grow(c)) {
+        free(entry);
+        return;
+    }
+    partial_entry_t *e = &c->slots[entry_slot(c, entry, strlen(entry))];
+    if (e->key) {
+        free(entry);
+    } else {
+        e->key = entry;
+        c->count++;
+    }
+    e->value = value;
+}
+
+static char *make_entry(const char *key, const char *query) {
+    size_t klen = strlen(key), qlen = strlen(query);
+    char *entry = malloc(klen + qlen + 2);
+    if (!entry) return NULL;
+    memcpy(entry, key, klen);
+    entry[klen] = '\t';
+    memcpy(entry + klen + 1, query, qlen + 1);
+    return entry;
+}
+
+bool partial_cache_open(partial_cache_t *c, const char *store_path) {
+    *c = (partial_cache_t){NULL, 0, 0, NULL};
+    char path[4096];
+    int n = snprintf(path, sizeof(path), "%s.partials", store_path);
+    if (n < 0 || (size_t)n >= sizeof(path) || !grow(c)) return false;
+
+    FILE *f = fopen(path, "r");
+    if (f) {
+        char line[1024];
+        while (fgets(line, sizeof(line), f)) {
+            /* "<key>\t<query>\t<value>\n"; skip torn or foreign lines */
+            char *value = strrchr(line, '\t');
+            if (!value || !strchr(line, '\t') || strchr(line, '\t') == value) continue;
+            *value++ = '\0';
+            char *end;
+            long long v = strtoll(value, &end, 10);
+            if (end == value || *end != '\n') continue;
+            char *entry = strdup(line);
+            if (entry) insert(c, entry, (int64_t)v);
+        }
+        fclose(f);
+    }
+
+    c->log = fopen(path, "a");
+    return true;
+}
+
+void partial_cache_close(partial_cache_t *c) {
+    for (size_t i = 0; i < c->capacity; i++) free(c->slots[i].key);
+    free(c->slots);
+    if (c->log) fclose(c->log);
+    *c = (partial_cache_t){NULL, 0, 0, NULL};
+}
+
+bool partial_cache_get(const partial_cache_t *c, const char *key, const char *query,
+                       int64_t *value) {
+    char *entry = make_entry(key, query);
+    if (!entry) return false;
+    const partial_entry_t *e = &c->slots[entry_slot(c, entry, strlen(entry))];
+    free(entry);
+    if (!e->key) return false;
+    *value = e->value;
+    return true;
+}
+
+void partial_cache_put(partial_cache_t *c, const char *key, const char *query,
+                       int64_t value) {
+    char *entry = make_entry(key, query);
+    if (!entry) return;
+    if (c->log) fprintf(c->log, "%s\t%lld\n", entry, (long long)value);
+    insert(c, entry, value);
+}
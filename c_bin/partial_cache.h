@@ -0,0 +1,52 @@
+/**
+ * Per-block partial aggregates keyed by subtree content hash.
+ *
+ * Irmin hashes every subtree, so a block whose index/block_txs/<h> node
+ * and block/<h> record did not change has the same key in every commit
+ * and on every branch. The tx-level scans (aggregate.h) fold each block
+ * into a partial result first; with the cache enabled a block whose key
+ * and query are known reuses the stored partial instead of reading its
+ * transactions, so a rerun after an import only scans the new blocks.
+ *
+ * Entries live in memory and in STORE.partials, an append-only text file
+ * of "<block key>\t<query>\t<value>\n" lines; a later line for the same
+ * key and query wins. The file can be deleted at any time.
+ */
+
+#ifndef BLOCKSCI_PARTIAL_CACHE_H
+#define BLOCKSCI_PARTIAL_CACHE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Longest block key: two Irmin hashes and a separator */
+#define PARTIAL_KEY_MAX 160
+
+typedef struct {
+    char *key;   /* "<block key>\t<query>", NULL if the slot is free */
+    int64_t value;
+} partial_entry_t;
+
+typedef struct {
+    partial_entry_t *slots;
+    size_t capacity; /* power of two */
+    size_t count;
+    FILE *log;       /* append handle, NULL if the file can't be written */
+} partial_cache_t;
+
+/* Load store_path.partials (missing is empty) and open it for appending */
+bool partial_cache_open(partial_cache_t *c, const char *store_path);
+
+void partial_cache_close(partial_cache_t *c);
+
+/* Partial result of query over the block with key, if known */
+bool partial_cache_get(const partial_cache_t *c, const char *key, const char *query,
+                       int64_t *value);
+
+/* Remember a partial result. Failing to log it only loses it for later runs. */
+void partial_cache_put(partial_cache_t *c, const char *key, const char *query,
+                       int64_t value);
+
+#endif
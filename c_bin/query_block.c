@@ -13,12 +13,126 @@
  *
  * Run:
  *   LD_LIBRARY_PATH=~/caml/irmin-eio/_build/default/src/libirmin/lib ./query_block
+ *
+ *   # Look up a block by hash through STORE.index/ instead of block 0
+ *   ./query_block ./local-store HASH
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include "irmin.h"
+#include "hash_index.h"
+#include "record.h"
+
+/*
+ * Contents at path_str as a malloc'd, NUL-terminated copy, or NULL. Binary
+ * records may contain NUL bytes; their length goes to *len if not NULL.
+ */
+static char *find_value(IrminRepo *repo, Irmin *store, const char *path_str,
+                        size_t *len) {
+    IrminPath *path = irmin_path_of_string(repo, (char *)path_str, strlen(path_str));
+    if (!path) return NULL;
+
+    char *result = NULL;
+    IrminContents *contents = irmin_find(store, path);
+    if (contents) {
+        IrminString *value = irmin_contents_to_string(repo, contents);
+        if (value) {
+            size_t n = (size_t)irmin_string_length(value);
+            result = malloc(n + 1);
+            if (result) {
+                memcpy(result, irmin_string_data(value), n);
+                result[n] = '\0';
+                if (len) *len = n;
+            }
+            irmin_string_free(value);
+        }
+        irmin_contents_free(contents);
+    }
+    irmin_path_free(path);
+    return result;
+}
+
+/* Contents at path_str as a malloc'd string, or NULL */
+static char *find_string(IrminRepo *repo, Irmin *store, const char *path_str) {
+    return find_value(repo, store, path_str, NULL);
+}
+
+/*
+ * Name of a script/address type field. Records store a dictionary code
+ * resolved through meta/dict/<dict>/<code>; older stores hold the string.
+ */
+static char *decode_type(IrminRepo *repo, Irmin *store, const char *json,
+                         const char *field, const char *dict) {
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", field);
+    const char *p = strstr(json, pattern);
+    if (!p) return NULL;
+    p += strlen(pattern);
+
+    if (*p == '"') {
+        const char *end = strchr(p + 1, '"');
+        return end ? strndup(p + 1, (size_t)(end - p - 1)) : NULL;
+    }
+
+    char path_str[128];
+    snprintf(path_str, sizeof(path_str), "meta/dict/%s/%d", dict, atoi(p));
+    char *meta = find_string(repo, store, path_str);
+    if (!meta) return NULL;
+
+    char *name = NULL;
+    const char *data = strstr(meta, "\"data\":\"");
+    if (data) {
+        data += strlen("\"data\":\"");
+        const char *end = strchr(data, '"');
+        if (end) name = strndup(data, (size_t)(end - data));
+    }
+    free(meta);
+    return name;
+}
+
+/* Whether a block or tx record (JSON or binary) has hash, ignoring case */
+static bool has_hash(const char *value, size_t len, const char *hash) {
+    block_record_t b;
+    tx_record_t t;
+    const char *h = record_decode_block(value, len, &b) ? b.hash
+                  : record_decode_tx(value, len, &t)    ? t.hash
+                                                        : NULL;
+    return h && strcasecmp(h, hash) == 0;
+}
+
+/*
+ * Height of the block with the given hash, or -1. The index yields
+ * candidate heights; the block record confirms the full hash.
+ */
+static long block_by_hash(IrminRepo *repo, Irmin *store, const char *store_path,
+                          const char *hash) {
+    char index_dir[4096];
+    snprintf(index_dir, sizeof(index_dir), "%s.index", store_path);
+
+    hash_index_t idx;
+    if (!hash_index_open(&idx, index_dir, HASH_INDEX_BLOCK)) {
+        fprintf(stderr, "No block hash index in %s (run irmin-blocksci index)\n",
+                index_dir);
+        return -1;
+    }
+
+    long height = -1;
+    uint64_t first;
+    uint64_t n = hash_index_find(&idx, hash, &first);
+    for (uint64_t i = 0; i < n && height < 0; i++) {
+        char path_str[64];
+        snprintf(path_str, sizeof(path_str), "block/%u", idx.ids[first + i]);
+        size_t len;
+        char *block = find_value(repo, store, path_str, &len);
+        if (block && has_hash(block, len, hash)) height = idx.ids[first + i];
+        free(block);
+    }
+    hash_index_close(&idx);
+    return height;
+}
 
 int main(int argc, char *argv[]) {
     /* Use store path from command line or default */
@@ -71,9 +185,22 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    /* Create path for block/0 (the genesis block) */
-    printf("5. Creating path for 'block/0'...\n");
-    const char *path_str = "block/0";
+    /* Block 0 (the genesis block) unless a hash was given */
+    long height = 0;
+    if (argc > 2) {
+        height = block_by_hash(repo, store, store_path, argv[2]);
+        if (height < 0) {
+            fprintf(stderr, "Error: Block %s not found\n", argv[2]);
+            irmin_free(store);
+            irmin_repo_free(repo);
+            irmin_config_free(config);
+            return 1;
+        }
+    }
+
+    char path_str[64];
+    snprintf(path_str, sizeof(path_str), "block/%ld", height);
+    printf("5. Creating path for '%s'...\n", path_str);
     IrminPath *path = irmin_path_of_string(repo, (char *)path_str, strlen(path_str));
     if (!path) {
         fprintf(stderr, "Error: Failed to create path\n");
@@ -84,25 +211,42 @@ int main(int argc, char *argv[]) {
     }
 
     /* Find contents at path */
-    printf("6. Looking up block 0...\n");
+    printf("6. Looking up block %ld...\n", height);
     IrminContents *contents = irmin_find(store, path);
     if (!contents) {
-        printf("   Block 0 not found in store.\n");
+        printf("   Block %ld not found in store.\n", height);
         printf("   Make sure you have imported data first:\n");
         printf("   dune exec irmin-blocksci -- import <csv-export-dir>\n");
     } else {
-        /* Convert contents to string */
+        /* Convert contents to string; binary records are printed as JSON */
         IrminString *value = irmin_contents_to_string(repo, contents);
         if (value) {
-            printf("\n=== Block 0 (Genesis Block) ===\n");
-            printf("%s\n", irmin_string_data(value));
+            char *json = record_to_json(irmin_string_data(value),
+                                        (size_t)irmin_string_length(value));
+            if (height == 0) printf("\n=== Block 0 (Genesis Block) ===\n");
+            else printf("\n=== Block %ld ===\n", height);
+            printf("%s\n", json ? json : "(undecodable record)");
+            free(json);
             irmin_string_free(value);
         }
         irmin_contents_free(contents);
     }
 
+    /* Outputs store their script type as a dictionary code */
+    printf("\n7. Looking up output 0/0...\n");
+    char *output = find_string(repo, store, "output/0/0");
+    if (output) {
+        char *script = decode_type(repo, store, output, "script", "script_type");
+        printf("%s\n", output);
+        printf("   Script type: %s\n", script ? script : "unknown");
+        free(script);
+        free(output);
+    } else {
+        printf("   Output 0/0 not found in store.\n");
+    }
+
     /* Cleanup */
-    printf("\n7. Cleaning up...\n");
+    printf("\n8. Cleaning up...\n");
     irmin_path_free(path);
     irmin_free(store);
     irmin_repo_free(repo);
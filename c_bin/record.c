@@ -0,0 +1,168 @@
+/**
+ * Record decoding and hex conversion (see record.h).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "record.h"
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/* ========================================================================= */
+/* Hex                                                                       */
+/* ========================================================================= */
+
+void hex_encode(const uint8_t *raw, size_t n, char *out) {
+    for (size_t i = 0; i < n; i++) {
+        out[2 * i] = hex_digits[raw[i] >> 4];
+        out[2 * i + 1] = hex_digits[raw[i] & 0x0F];
+    }
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool hex_decode(const char *hex, size_t n, uint8_t *out) {
+    for (size_t i = 0; i < n; i++) {
+        int hi = hex_value(hex[2 * i]), lo = hex_value(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0) return false;
+        out[i] = (uint8_t)(hi << 4 | lo);
+    }
+    return true;
+}
+
+/* ========================================================================= */
+/* Records                                                                   */
+/* ========================================================================= */
+
+static const uint8_t *varint_read(const uint8_t *p, const uint8_t *end, uint64_t *v) {
+    uint64_t acc = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t b = *p++;
+        acc |= (uint64_t)(b & 0x7F) << shift;
+        if (b < 0x80) {
+            *v = acc;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static int64_t unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/*
+ * Fields of a binary record with the given tag: the leading varint, the
+ * hex hash, then n varints.
+ */
+static bool decode_binary(const char *value, size_t len, uint8_t tag,
+                          int64_t *first, char *hash, uint64_t *f, int n) {
+    const uint8_t *p = (const uint8_t *)value, *end = p + len;
+    uint64_t v;
+    if (len == 0 || p[0] != tag) return false;
+    p = varint_read(p + 1, end, &v);
+    if (!p || end - p < RECORD_HASH_BYTES) return false;
+    *first = (int64_t)v;
+    hex_encode(p, RECORD_HASH_BYTES, hash);
+    hash[2 * RECORD_HASH_BYTES] = '\0';
+    p += RECORD_HASH_BYTES;
+    for (int k = 0; p && k < n; k++) p = varint_read(p, end, &f[k]);
+    return p != NULL;
+}
+
+static int64_t json_int64(const char *json, const char *key) {
+    char search[64];
+    snprintf(search, sizeof(search), "\"%s\":", key);
+    const char *pos = strstr(json, search);
+    return pos ? strtoll(pos + strlen(search), NULL, 10) : 0;
+}
+
+static void json_hash(const char *json, char *hash) {
+    const char *pos = strstr(json, "\"hash\":\"");
+    hash[0] = '\0';
+    if (!pos) return;
+    pos += strlen("\"hash\":\"");
+    size_t n = strcspn(pos, "\"");
+    if (n > 2 * RECORD_HASH_BYTES) n = 2 * RECORD_HASH_BYTES;
+    memcpy(hash, pos, n);
+    hash[n] = '\0';
+}
+
+bool record_decode_block(const char *value, size_t len, block_record_t *b) {
+    memset(b, 0, sizeof(*b));
+    if (record_is_binary(value, len)) {
+        uint64_t f[4];
+        if (!decode_binary(value, len, RECORD_BLOCK, &b->height, b->hash, f, 4))
+            return false;
+        b->timestamp = unzigzag(f[0]);
+        b->nonce = unzigzag(f[1]);
+        b->bits = unzigzag(f[2]);
+        b->version = unzigzag(f[3]);
+        return true;
+    }
+    if (!strstr(value, "\"type\":\"block\"")) return false;
+    b->height = json_int64(value, "height");
+    json_hash(value, b->hash);
+    b->timestamp = json_int64(value, "timestamp");
+    b->nonce = json_int64(value, "nonce");
+    b->bits = json_int64(value, "bits");
+    b->version = json_int64(value, "version");
+    return true;
+}
+
+bool record_decode_tx(const char *value, size_t len, tx_record_t *t) {
+    memset(t, 0, sizeof(*t));
+    if (record_is_binary(value, len)) {
+        uint64_t f[6];
+        if (!decode_binary(value, len, RECORD_TX, &t->id, t->hash, f, 6))
+            return false;
+        t->locktime = unzigzag(f[0]);
+        t->version = unzigzag(f[1]);
+        t->fee = unzigzag(f[2]);
+        t->size = (int64_t)f[3];
+        t->weight = (int64_t)f[4];
+        t->block = unzigzag(f[5]);
+        return true;
+    }
+    if (!strstr(value, "\"type\":\"tx\"")) return false;
+    t->id = json_int64(value, "id");
+    json_hash(value, t->hash);
+    t->locktime = json_int64(value, "locktime");
+    t->version = json_int64(value, "version");
+    t->fee = json_int64(value, "fee");
+    t->size = json_int64(value, "size");
+    t->weight = json_int64(value, "weight");
+    t->block = json_int64(value, "block");
+    return true;
+}
+
+char *record_to_json(const char *value, size_t len) {
+    char buf[512];
+    block_record_t b;
+    tx_record_t t;
+
+    if (!record_is_binary(value, len)) return strndup(value, len);
+    if (record_decode_block(value, len, &b)) {
+        snprintf(buf, sizeof(buf),
+                 "{\"type\":\"block\",\"height\":%lld,\"hash\":\"%s\",\"timestamp\":%lld,"
+                 "\"nonce\":%lld,\"bits\":%lld,\"version\":%lld}",
+                 (long long)b.height, b.hash, (long long)b.timestamp,
+                 (long long)b.nonce, (long long)b.bits, (long long)b.version);
+    } else if (record_decode_tx(value, len, &t)) {
+        snprintf(buf, sizeof(buf),
+                 "{\"type\":\"tx\",\"id\":%lld,\"hash\":\"%s\",\"locktime\":%lld,"
+                 "\"version\":%lld,\"fee\":%lld,\"size\":%lld,\"weight\":%lld,\"block\":%lld}",
+                 (long long)t.id, t.hash, (long long)t.locktime, (long long)t.version,
+                 (long long)t.fee, (long long)t.size, (long long)t.weight,
+                 (long long)t.block);
+    } else {
+        return NULL;
+    }
+    return strdup(buf);
+}
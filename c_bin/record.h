@@ -0,0 +1,67 @@
+/**
+ * Block and transaction records, in either stored form.
+ *
+ * Records are JSON, or with `import --binary-records` a tag byte, LEB128
+ * varints and the hash as 32 raw bytes (see lib/types.ml):
+ *
+ *   0x08 height hash[32] zigzag(timestamp) zigzag(nonce) zigzag(bits)
+ *        zigzag(version)                                   Block
+ *   0x09 id hash[32] zigzag(locktime) zigzag(version) zigzag(fee) size
+ *        weight zigzag(block)                              Transaction
+ *
+ * Decoded records always carry the hash as 64 lowercase hex digits. Binary
+ * records may contain NUL bytes, so values are passed with their length.
+ */
+
+#ifndef BLOCKSCI_RECORD_H
+#define BLOCKSCI_RECORD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define RECORD_BLOCK 0x08
+#define RECORD_TX 0x09
+#define RECORD_HASH_BYTES 32
+
+typedef struct {
+    int64_t height;
+    char hash[2 * RECORD_HASH_BYTES + 1];
+    int64_t timestamp;
+    int64_t nonce;
+    int64_t bits;
+    int64_t version;
+} block_record_t;
+
+typedef struct {
+    int64_t id;
+    char hash[2 * RECORD_HASH_BYTES + 1];
+    int64_t locktime;
+    int64_t version;
+    int64_t fee;
+    int64_t size;
+    int64_t weight;
+    int64_t block;
+} tx_record_t;
+
+bool record_decode_block(const char *value, size_t len, block_record_t *b);
+bool record_decode_tx(const char *value, size_t len, tx_record_t *t);
+
+/* Whether value is a binary (non-JSON) record */
+static inline bool record_is_binary(const char *value, size_t len) {
+    return len > 0 && (value[0] == RECORD_BLOCK || value[0] == RECORD_TX);
+}
+
+/*
+ * The record as JSON, converting binary records to the form JSON records
+ * are stored in (caller must free result).
+ */
+char *record_to_json(const char *value, size_t len);
+
+/* Lowercase hex of n raw bytes into out (2n chars, not NUL-terminated) */
+void hex_encode(const uint8_t *raw, size_t n, char *out);
+
+/* Raw bytes of 2n hex digits; false if any is not a hex digit */
+bool hex_decode(const char *hex, size_t n, uint8_t *out);
+
+#endif
@@ -0,0 +1,139 @@
+/**
+ * Commit-keyed query result cache (see result_cache.h).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "result_cache.h"
+
+#define RESULT_CACHE_MAGIC "BSCACHE1"
+
+bool result_cache_init(result_cache_t *c, const char *store_path, const char *commit) {
+    int n = snprintf(c->dir, sizeof(c->dir), "%s.cache", store_path);
+    int m = snprintf(c->commit, sizeof(c->commit), "%s", commit);
+    return n > 0 && (size_t)n < sizeof(c->dir) && m >= 0 && (size_t)m < sizeof(c->commit);
+}
+
+uint64_t result_cache_fnv1a(uint64_t h, const void *data, size_t len) {
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+size_t result_cache_normalise(const char *query, char *out) {
+    size_t n = 0;
+    char quote = 0;
+    bool space = false;
+    for (const char *p = query; *p; p++) {
+        char ch = *p;
+        if (quote) {
+            if (ch == quote) quote = 0;
+            out[n++] = ch;
+        } else if (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r') {
+            space = true;
+        } else {
+            if (space && n > 0) out[n++] = ' ';
+            space = false;
+            if (ch == '\'' || ch == '"') quote = ch;
+            out[n++] = ch;
+        }
+    }
+    if (n > 0 && out[n - 1] == ';') {
+        n--;
+        while (n > 0 && out[n - 1] == ' ') n--;
+    }
+    out[n] = '\0';
+    return n;
+}
+
+/*
+ * Header and file path of an entry. The header is malloc'd; NULL if out
+ * of memory or the query is too long.
+ */
+static char *entry_key(const result_cache_t *c, const char *query, const char *params,
+                       char *path, size_t path_size, size_t *header_len) {
+    size_t qcap = strlen(query) + 1;
+    char *q = malloc(qcap);
+    if (!q) return NULL;
+    size_t qlen = result_cache_normalise(query, q);
+    size_t clen = strlen(c->commit), plen = strlen(params);
+
+    uint64_t h = RESULT_CACHE_FNV_OFFSET;
+    h = result_cache_fnv1a(h, c->commit, clen);
+    h = result_cache_fnv1a(h, "", 1);
+    h = result_cache_fnv1a(h, q, qlen);
+    h = result_cache_fnv1a(h, "", 1);
+    h = result_cache_fnv1a(h, params, plen);
+    snprintf(path, path_size, "%s/%016llx", c->dir, (unsigned long long)h);
+
+    char line[128];
+    int n = snprintf(line, sizeof(line), "%s %zu %zu %zu\n", RESULT_CACHE_MAGIC, clen, qlen,
+                     plen);
+    size_t total = (size_t)n + clen + qlen + plen;
+    char *header = malloc(total + 1);
+    if (header) {
+        memcpy(header, line, (size_t)n);
+        memcpy(header + n, c->commit, clen);
+        memcpy(header + n + clen, q, qlen);
+        memcpy(header + n + clen + qlen, params, plen);
+        header[total] = '\0';
+        *header_len = total;
+    }
+    free(q);
+    return header;
+}
+
+char *result_cache_get(const result_cache_t *c, const char *query, const char *params,
+                       size_t *len) {
+    char path[4200];
+    size_t header_len;
+    char *header = entry_key(c, query, params, path, sizeof(path), &header_len);
+    if (!header) return NULL;
+
+    char *result = NULL;
+    FILE *f = fopen(path, "rb");
+    if (f) {
+        struct stat st;
+        char *buf = NULL;
+        if (fstat(fileno(f), &st) == 0 && (size_t)st.st_size >= header_len &&
+            (buf = malloc((size_t)st.st_size + 1)) &&
+            fread(buf, 1, (size_t)st.st_size, f) == (size_t)st.st_size &&
+            memcmp(buf, header, header_len) == 0) {
+            size_t n = (size_t)st.st_size - header_len;
+            memmove(buf, buf + header_len, n);
+            buf[n] = '\0';
+            if (len) *len = n;
+            result = buf;
+        } else {
+            free(buf);
+        }
+        fclose(f);
+    }
+    free(header);
+    return result;
+}
+
+bool result_cache_put(const result_cache_t *c, const char *query, const char *params,
+                      const char *value, size_t len) {
+    char path[4200], tmp[4300];
+    size_t header_len;
+    char *header = entry_key(c, query, params, path, sizeof(path), &header_len);
+    if (!header) return false;
+
+    mkdir(c->dir, 0755);
+    snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", path, (long)getpid());
+    FILE *f = fopen(tmp, "wb");
+    bool ok = f && fwrite(header, 1, header_len, f) == header_len &&
+              fwrite(value, 1, len, f) == len;
+    if (f && fclose(f) != 0) ok = false;
+    if (ok) ok = rename(tmp, path) == 0;
+    if (!ok && f) unlink(tmp);
+    free(header);
+    return ok;
+}
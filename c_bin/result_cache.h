@@ -0,0 +1,53 @@
+/**
+ * Commit-keyed query result cache shared with the OCaml tools.
+ *
+ * A result computed over an Irmin commit never changes, so it is stored in
+ * STORE.cache/ under the 64-bit FNV-1a hash of (commit, normalised query,
+ * parameters), one file per result (see lib/result_cache.ml):
+ *
+ *   "BSCACHE1 <commit len> <query len> <params len>\n"
+ *   commit query params result
+ *
+ * The key fields are compared on lookup, so a hash collision is a miss.
+ * Entries are written to a temporary file and renamed into place.
+ */
+
+#ifndef BLOCKSCI_RESULT_CACHE_H
+#define BLOCKSCI_RESULT_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define RESULT_CACHE_FNV_OFFSET 0xcbf29ce484222325ULL
+
+typedef struct {
+    char dir[4096];
+    char commit[128];
+} result_cache_t;
+
+/* Cache for results over commit, in store_path.cache. False if a path is too long. */
+bool result_cache_init(result_cache_t *c, const char *store_path, const char *commit);
+
+/* Continue an FNV-1a hash h (start with RESULT_CACHE_FNV_OFFSET) over data */
+uint64_t result_cache_fnv1a(uint64_t h, const void *data, size_t len);
+
+/*
+ * Collapse whitespace runs outside quotes to one space and drop a trailing
+ * ';'. out must hold strlen(query) + 1 bytes. Returns the length written.
+ */
+size_t result_cache_normalise(const char *query, char *out);
+
+/*
+ * Cached result of query with params ("name=value" lines, sorted by name),
+ * NUL-terminated, or NULL on a miss. Caller must free; its length goes to
+ * *len if not NULL.
+ */
+char *result_cache_get(const result_cache_t *c, const char *query, const char *params,
+                       size_t *len);
+
+/* Store a result. Failures only lose the entry. */
+bool result_cache_put(const result_cache_t *c, const char *query, const char *params,
+                      const char *value, size_t len);
+
+#endif
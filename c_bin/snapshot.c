@@ -0,0 +1,334 @@
+/**
+ * Graph snapshot loading and traversals (see snapshot.h).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+
+/* Map dir/name read-only; empty files map to a non-NULL dummy */
+static const void *map_file(snapshot_t *s, const char *dir, const char *name,
+                            size_t expected) {
+    static const uint64_t empty = 0;
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size != expected ||
+        s->num_maps >= SNAPSHOT_MAX_MAPS) {
+        fprintf(stderr, "Snapshot: bad file %s\n", path);
+        close(fd);
+        return NULL;
+    }
+    if (expected == 0) {
+        close(fd);
+        return &empty;
+    }
+
+    void *addr = mmap(NULL, expected, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) return NULL;
+
+    s->maps[s->num_maps].addr = addr;
+    s->maps[s->num_maps].len = expected;
+    s->num_maps++;
+    return addr;
+}
+
+static bool read_meta(snapshot_t *s, const char *dir) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/meta", dir);
+
+    FILE *f = fopen(path, "r");
+    if (!f) return false;
+
+    char key[64], value[128];
+    int version = 0;
+    while (fscanf(f, "%63s %127s", key, value) == 2) {
+        if (strcmp(key, "version") == 0) version = atoi(value);
+        else if (strcmp(key, "commit") == 0) snprintf(s->commit, sizeof(s->commit), "%s", value);
+        else if (strcmp(key, "blocks") == 0) s->num_blocks = strtoull(value, NULL, 10);
+        else if (strcmp(key, "txs") == 0) s->num_txs = strtoull(value, NULL, 10);
+        else if (strcmp(key, "outputs") == 0) s->num_outputs = strtoull(value, NULL, 10);
+        else if (strcmp(key, "edges") == 0) s->num_edges = strtoull(value, NULL, 10);
+        else if (strcmp(key, "addresses") == 0) s->num_addresses = strtoull(value, NULL, 10);
+    }
+    fclose(f);
+    return version == 4;
+}
+
+/* Load dir/name, one dictionary value per line */
+static bool read_dict(snapshot_dict_t *d, const char *dir, const char *name) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    FILE *f = fopen(path, "r");
+    if (!f) return false;
+
+    char line[256];
+    while (d->size < 256 && fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = '\0';
+        d->names[d->size++] = strdup(line);
+    }
+    fclose(f);
+    return true;
+}
+
+static void free_dict(snapshot_dict_t *d) {
+    for (int i = 0; i < d->size; i++) free(d->names[i]);
+    d->size = 0;
+}
+
+bool snapshot_open(snapshot_t *s, const char *dir) {
+    memset(s, 0, sizeof(*s));
+    if (!read_meta(s, dir)) return false;
+
+    uint64_t txs = s->num_txs, outs = s->num_outputs, addrs = s->num_addresses;
+    s->tx_outputs_off = map_file(s, dir, "tx_outputs.off", (txs + 1) * 8);
+    s->out_addr = map_file(s, dir, "out_addr.u32", outs * 4);
+    s->out_spent_by = map_file(s, dir, "out_spent_by.u32", outs * 4);
+    s->tx_spenders_off = map_file(s, dir, "tx_spenders.off", (txs + 1) * 8);
+    s->tx_spenders = map_file(s, dir, "tx_spenders.u32", s->num_edges * 4);
+    s->addr_keys_off = map_file(s, dir, "addr_keys.off", (addrs + 1) * 8);
+    s->addr_keys = s->addr_keys_off
+        ? map_file(s, dir, "addr_keys.str", s->addr_keys_off[addrs])
+        : NULL;
+    s->out_script = map_file(s, dir, "out_script.u8", outs);
+    s->addr_type = map_file(s, dir, "addr_type.u8", addrs);
+    s->block_time = map_file(s, dir, "block_time.i64", s->num_blocks * 8);
+    s->tx_height = map_file(s, dir, "tx_height.u32", txs * 4);
+    s->tx_fee = map_file(s, dir, "tx_fee.i64", txs * 8);
+    s->out_value = map_file(s, dir, "out_value.i64", outs * 8);
+
+    if (!s->tx_outputs_off || !s->out_addr || !s->out_spent_by ||
+        !s->tx_spenders_off || !s->tx_spenders || !s->addr_keys_off ||
+        !s->addr_keys || !s->out_script || !s->addr_type || !s->block_time ||
+        !s->tx_height || !s->tx_fee || !s->out_value ||
+        !read_dict(&s->script_types, dir, "script_types.dict") ||
+        !read_dict(&s->addr_types, dir, "addr_types.dict")) {
+        snapshot_close(s);
+        return false;
+    }
+    return true;
+}
+
+void snapshot_close(snapshot_t *s) {
+    for (int i = 0; i < s->num_maps; i++)
+        munmap(s->maps[i].addr, s->maps[i].len);
+    free_dict(&s->script_types);
+    free_dict(&s->addr_types);
+    memset(s, 0, sizeof(*s));
+}
+
+void snapshot_histogram(const uint8_t *codes, uint64_t lo, uint64_t hi,
+                        uint64_t counts[256]) {
+    uint64_t sub[4][256];
+    memset(sub, 0, sizeof(sub));
+
+    uint64_t i = lo;
+    for (; i + 4 <= hi; i += 4) {
+        sub[0][codes[i]]++;
+        sub[1][codes[i + 1]]++;
+        sub[2][codes[i + 2]]++;
+        sub[3][codes[i + 3]]++;
+    }
+    for (; i < hi; i++) sub[0][codes[i]]++;
+
+    for (int c = 0; c < 256; c++)
+        counts[c] += sub[0][c] + sub[1][c] + sub[2][c] + sub[3][c];
+}
+
+/* ========================================================================= */
+/* Balances and top-K                                                        */
+/* ========================================================================= */
+
+void snapshot_add_balances(const snapshot_t *s, uint64_t lo, uint64_t hi,
+                           int64_t *balance) {
+    for (uint64_t o = lo; o < hi; o++) {
+        uint32_t addr = s->out_addr[o];
+        if (s->out_spent_by[o] != SNAPSHOT_NONE || addr >= s->num_addresses) continue;
+        __atomic_fetch_add(&balance[addr], s->out_value[o], __ATOMIC_RELAXED);
+    }
+}
+
+/* Whether a ranks below b */
+static bool rank_below(snapshot_rank_t a, snapshot_rank_t b) {
+    return a.balance < b.balance || (a.balance == b.balance && a.addr > b.addr);
+}
+
+bool snapshot_topk_init(snapshot_topk_t *h, size_t k) {
+    h->items = malloc((k > 0 ? k : 1) * sizeof(snapshot_rank_t));
+    h->size = 0;
+    h->k = k;
+    return h->items != NULL;
+}
+
+void snapshot_topk_free(snapshot_topk_t *h) {
+    free(h->items);
+    h->items = NULL;
+    h->size = h->k = 0;
+}
+
+static void topk_sift_down(snapshot_rank_t *items, size_t n, size_t i) {
+    for (;;) {
+        size_t l = 2 * i + 1, r = l + 1, min = i;
+        if (l < n && rank_below(items[l], items[min])) min = l;
+        if (r < n && rank_below(items[r], items[min])) min = r;
+        if (min == i) return;
+        snapshot_rank_t t = items[i];
+        items[i] = items[min];
+        items[min] = t;
+        i = min;
+    }
+}
+
+void snapshot_topk_push(snapshot_topk_t *h, snapshot_rank_t r) {
+    if (h->size < h->k) {
+        /* Sift up */
+        size_t i = h->size++;
+        while (i > 0 && rank_below(r, h->items[(i - 1) / 2])) {
+            h->items[i] = h->items[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        h->items[i] = r;
+    } else if (h->k > 0 && rank_below(h->items[0], r)) {
+        h->items[0] = r;
+        topk_sift_down(h->items, h->size, 0);
+    }
+}
+
+void snapshot_topk_sort(snapshot_topk_t *h) {
+    /* Heapsort on the min-heap leaves the best entry first */
+    for (size_t n = h->size; n > 1; n--) {
+        snapshot_rank_t t = h->items[0];
+        h->items[0] = h->items[n - 1];
+        h->items[n - 1] = t;
+        topk_sift_down(h->items, n - 1, 0);
+    }
+}
+
+/* ========================================================================= */
+/* Traversals                                                                */
+/* ========================================================================= */
+
+uint64_t snapshot_bfs(const snapshot_t *s, uint32_t src, int max_depth,
+                      snapshot_visit_fn visit, void *ctx) {
+    if (src >= s->num_txs) return 0;
+
+    uint8_t *seen = calloc((s->num_txs + 7) / 8, 1);
+    uint32_t *queue = malloc(s->num_txs * sizeof(uint32_t));
+    if (!seen || !queue) {
+        free(seen);
+        free(queue);
+        return 0;
+    }
+
+    uint64_t head = 0, tail = 0;
+    queue[tail++] = src;
+    seen[src / 8] |= 1 << (src % 8);
+
+    /* Level-synchronous: [head, level_end) holds the current depth */
+    for (int depth = 0; head < tail && depth <= max_depth; depth++) {
+        uint64_t level_end = tail;
+        for (; head < level_end; head++) {
+            uint32_t tx = queue[head];
+            if (visit) visit(tx, depth, ctx);
+            if (depth == max_depth) continue;
+
+            uint64_t n;
+            const uint32_t *next = snapshot_tx_spenders(s, tx, &n);
+            for (uint64_t i = 0; i < n; i++) {
+                uint32_t t = next[i];
+                if (t >= s->num_txs || (seen[t / 8] & (1 << (t % 8)))) continue;
+                seen[t / 8] |= 1 << (t % 8);
+                queue[tail++] = t;
+            }
+        }
+    }
+
+    free(seen);
+    free(queue);
+    return tail;
+}
+
+static uint32_t uf_find(uint32_t *parent, uint32_t x) {
+    while (parent[x] != x) {
+        parent[x] = parent[parent[x]];
+        x = parent[x];
+    }
+    return x;
+}
+
+uint64_t snapshot_components(const snapshot_t *s, uint32_t *component) {
+    uint32_t *parent = component ? component
+                                 : malloc(s->num_txs * sizeof(uint32_t));
+    if (!parent) return 0;
+
+    for (uint64_t tx = 0; tx < s->num_txs; tx++) parent[tx] = (uint32_t)tx;
+
+    uint64_t count = s->num_txs;
+    for (uint64_t tx = 0; tx < s->num_txs; tx++) {
+        uint64_t n;
+        const uint32_t *next = snapshot_tx_spenders(s, (uint32_t)tx, &n);
+        for (uint64_t i = 0; i < n; i++) {
+            if (next[i] >= s->num_txs) continue;
+            uint32_t a = uf_find(parent, (uint32_t)tx);
+            uint32_t b = uf_find(parent, next[i]);
+            if (a == b) continue;
+            /* Link towards the smaller id so the root is the earliest tx */
+            if (a < b) parent[b] = a; else parent[a] = b;
+            count--;
+        }
+    }
+
+    if (component) {
+        for (uint64_t tx = 0; tx < s->num_txs; tx++)
+            component[tx] = uf_find(parent, (uint32_t)tx);
+    } else {
+        free(parent);
+    }
+    return count;
+}
+
+void snapshot_flow(const snapshot_t *s, double *rank, int iterations,
+                   double damping) {
+    uint64_t n = s->num_txs;
+    if (n == 0) return;
+
+    double *next = malloc(n * sizeof(double));
+    if (!next) return;
+
+    for (uint64_t tx = 0; tx < n; tx++) rank[tx] = 1.0 / (double)n;
+
+    for (int it = 0; it < iterations; it++) {
+        /* Mass held by transactions with no spenders is spread uniformly */
+        double dangling = 0.0;
+        for (uint64_t tx = 0; tx < n; tx++) {
+            next[tx] = 0.0;
+            if (s->tx_spenders_off[tx + 1] == s->tx_spenders_off[tx])
+                dangling += rank[tx];
+        }
+
+        for (uint64_t tx = 0; tx < n; tx++) {
+            uint64_t deg;
+            const uint32_t *out = snapshot_tx_spenders(s, (uint32_t)tx, &deg);
+            if (deg == 0) continue;
+            double share = damping * rank[tx] / (double)deg;
+            for (uint64_t i = 0; i < deg; i++)
+                if (out[i] < n) next[out[i]] += share;
+        }
+
+        double base = (1.0 - damping) / (double)n + damping * dangling / (double)n;
+        for (uint64_t tx = 0; tx < n; tx++) rank[tx] = next[tx] + base;
+    }
+
+    free(next);
+}
@@ -0,0 +1,172 @@
+/**
+ * Read-only access to an irmin-blocksci graph snapshot.
+ *
+ * `irmin-blocksci snapshot` exports the transaction graph into
+ * STORE.snapshot/ as little-endian arrays in compressed sparse row (CSR)
+ * form (see lib/snapshot.ml). The arrays are mmapped, so opening a
+ * snapshot is cheap and traversals never go through libirmin.
+ *
+ * Transactions are indexed by BlockSci tx_id, outputs by ordinal
+ * (tx_outputs_off[tx] + vout) and addresses by their rank in the sorted
+ * list of address IDs. Script and address types are stored as one-byte
+ * dictionary codes (see lib/dict.ml).
+ */
+
+#ifndef BLOCKSCI_SNAPSHOT_H
+#define BLOCKSCI_SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Missing u32 entry (no address, unspent output) */
+#define SNAPSHOT_NONE UINT32_MAX
+
+/* Missing dictionary code */
+#define SNAPSHOT_NO_CODE 0xFF
+
+/* Time of a height without a block record */
+#define SNAPSHOT_NO_TIME INT64_MIN
+
+#define SNAPSHOT_MAX_MAPS 32
+
+/* Code -> name table loaded from a .dict file */
+typedef struct {
+    char *names[256];
+    int size;
+} snapshot_dict_t;
+
+typedef struct {
+    void *addr;
+    size_t len;
+} snapshot_map_t;
+
+typedef struct {
+    uint64_t num_blocks;
+    uint64_t num_txs;
+    uint64_t num_outputs;
+    uint64_t num_edges;
+    uint64_t num_addresses;
+    char commit[128];
+
+    const uint64_t *tx_outputs_off;  /* [num_txs + 1] */
+    const uint32_t *out_addr;        /* [num_outputs] */
+    const uint32_t *out_spent_by;    /* [num_outputs] */
+    const uint64_t *tx_spenders_off; /* [num_txs + 1] */
+    const uint32_t *tx_spenders;     /* [num_edges] */
+    const uint64_t *addr_keys_off;   /* [num_addresses + 1] */
+    const char *addr_keys;
+    const uint8_t *out_script;       /* [num_outputs] script type codes */
+    const uint8_t *addr_type;        /* [num_addresses] address type codes */
+    snapshot_dict_t script_types;
+    snapshot_dict_t addr_types;
+    const int64_t *block_time;       /* [num_blocks] timestamp by height or NO_TIME */
+    const uint32_t *tx_height;       /* [num_txs] block height or NONE */
+    const int64_t *tx_fee;           /* [num_txs] */
+    const int64_t *out_value;        /* [num_outputs] */
+
+    snapshot_map_t maps[SNAPSHOT_MAX_MAPS];
+    int num_maps;
+} snapshot_t;
+
+/* Map the snapshot in dir. Returns false if it is missing or malformed. */
+bool snapshot_open(snapshot_t *s, const char *dir);
+void snapshot_close(snapshot_t *s);
+
+/* Outputs of a transaction, as the ordinal range [*first, *first + n) */
+static inline uint64_t snapshot_tx_outputs(const snapshot_t *s, uint32_t tx,
+                                           uint64_t *first) {
+    *first = s->tx_outputs_off[tx];
+    return s->tx_outputs_off[tx + 1] - *first;
+}
+
+/* Distinct transactions spending any output of tx */
+static inline const uint32_t *snapshot_tx_spenders(const snapshot_t *s,
+                                                   uint32_t tx, uint64_t *n) {
+    uint64_t first = s->tx_spenders_off[tx];
+    *n = s->tx_spenders_off[tx + 1] - first;
+    return s->tx_spenders + first;
+}
+
+/* Address ID string of an address index (not NUL-terminated) */
+static inline const char *snapshot_addr_key(const snapshot_t *s, uint32_t addr,
+                                            size_t *len) {
+    *len = (size_t)(s->addr_keys_off[addr + 1] - s->addr_keys_off[addr]);
+    return s->addr_keys + s->addr_keys_off[addr];
+}
+
+/* Name of a dictionary code, or "unknown" */
+static inline const char *snapshot_dict_name(const snapshot_dict_t *d, uint8_t code) {
+    return code < d->size && d->names[code] ? d->names[code] : "unknown";
+}
+
+/*
+ * Add the code counts of codes[lo, hi) into counts[256]. Four interleaved
+ * sub-histograms avoid stalling on repeated increments of the same counter.
+ */
+void snapshot_histogram(const uint8_t *codes, uint64_t lo, uint64_t hi,
+                        uint64_t counts[256]);
+
+/* ========================================================================= */
+/* Balances and top-K                                                        */
+/* ========================================================================= */
+
+/*
+ * Add the value of each unspent output in [lo, hi) to the balance of its
+ * address (balance holds num_addresses entries). The adds are atomic, so
+ * disjoint output ranges can run on different threads.
+ */
+void snapshot_add_balances(const snapshot_t *s, uint64_t lo, uint64_t hi,
+                           int64_t *balance);
+
+typedef struct {
+    uint32_t addr;
+    int64_t balance;
+} snapshot_rank_t;
+
+/*
+ * Bounded min-heap keeping the k highest-ranked entries: higher balance
+ * first, lower address index on ties, so results do not depend on how
+ * the input was split.
+ */
+typedef struct {
+    snapshot_rank_t *items; /* [k] */
+    size_t size;
+    size_t k;
+} snapshot_topk_t;
+
+bool snapshot_topk_init(snapshot_topk_t *h, size_t k);
+void snapshot_topk_free(snapshot_topk_t *h);
+void snapshot_topk_push(snapshot_topk_t *h, snapshot_rank_t r);
+
+/* Sort the kept entries best first; the heap is unusable afterwards */
+void snapshot_topk_sort(snapshot_topk_t *h);
+
+/* ========================================================================= */
+/* Traversals                                                                */
+/* ========================================================================= */
+
+typedef void (*snapshot_visit_fn)(uint32_t tx, int depth, void *ctx);
+
+/*
+ * Breadth-first search along spending edges from src, up to max_depth hops.
+ * visit may be NULL. Returns the number of transactions reached (src included).
+ */
+uint64_t snapshot_bfs(const snapshot_t *s, uint32_t src, int max_depth,
+                      snapshot_visit_fn visit, void *ctx);
+
+/*
+ * Weakly connected components of the spending graph. If component is not
+ * NULL it receives a representative tx for each tx (num_txs entries).
+ * Returns the number of components.
+ */
+uint64_t snapshot_components(const snapshot_t *s, uint32_t *component);
+
+/*
+ * PageRank-style value flow: each transaction passes damping of its score
+ * evenly to the transactions spending it. rank must hold num_txs entries.
+ */
+void snapshot_flow(const snapshot_t *s, double *rank, int iterations,
+                   double damping);
+
+#endif
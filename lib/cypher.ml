@@ -0,0 +1,1232 @@
+(** Executor for a subset of Cypher over the store.
+
+    Runs the read queries of [queries.cypher], and new ones of the same
+    shape, directly against the store layout:
+
+    {v
+    MATCH pattern [WHERE expr]
+    [WITH items [WHERE expr]]...
+    RETURN items [ORDER BY expr [DESC], ...] [LIMIT n]
+    v}
+
+    A pattern is one chain of nodes over the fixed schema
+
+    {v
+    (:Block)-[:CONTAINS]->(:Transaction)
+    (:Transaction)-[:TX_OUTPUT]->(:Output)
+    (:Transaction)-[:TX_INPUT]->(:Output)
+    (:Output)-[:TO_ADDRESS]->(:Address)
+    v}
+
+    and missing labels and relationship types are inferred from it. The
+    chain compiles to a scan of its first node, or a point lookup when a
+    key property ([height], [txId], [txId] and [vout], [addressId]) is
+    fixed, followed by one index join per relationship along the [index/]
+    paths, in either direction. Each WHERE conjunct runs as soon as its
+    variables are bound, and property reads are lazy, so [count(t)] never
+    loads a record and tx summaries answer [fee], [locktime] and [version].
+
+    Items may aggregate with [count], [sum], [min], [max] and [avg]
+    (optionally DISTINCT), grouping by the other items as in Cypher. WHERE
+    also takes pattern predicates on bound variables, such as
+    [NOT (o)<-[:TX_INPUT]-()]. *)
+
+exception Error of string
+
+let error fmt = Printf.ksprintf (fun msg -> raise (Error msg)) fmt
+
+(** {1 Values} *)
+
+type node = Block of int | Tx of int | Output of int * int | Address of string
+
+type value =
+  | Null
+  | Bool of bool
+  | Int of int64
+  | Float of float
+  | Str of string
+  | Node of node_value
+  | Rel
+
+and node_value = {
+  node : node;
+  record : Types.entity option Lazy.t;  (** Read on first property access *)
+  summary : Types.tx_summary option;  (** From the [block_txs] leaf *)
+}
+
+let of_int i = Int (Int64.of_int i)
+
+let to_string = function
+  | Null -> "null"
+  | Bool b -> string_of_bool b
+  | Int i -> Int64.to_string i
+  | Float f -> Printf.sprintf "%.12g" f
+  | Str s -> s
+  | Rel -> "[]"
+  | Node n -> (
+      match n.node with
+      | Block h -> Printf.sprintf "(:Block {height: %d})" h
+      | Tx id -> Printf.sprintf "(:Transaction {txId: %d})" id
+      | Output (tx, vout) -> Printf.sprintf "(:Output {txId: %d, vout: %d})" tx vout
+      | Address a -> Printf.sprintf "(:Address {addressId: '%s'})" a)
+
+(** Parse a [--param] value: an integer, or else a string. *)
+let value_of_string s =
+  match Int64.of_string_opt s with Some i -> Int i | None -> Str s
+
+(** Hashable identity of a value, for grouping and DISTINCT. *)
+let key_of = function
+  | Null -> `Null
+  | Bool b -> `Bool b
+  | Int i -> `Int i
+  | Float f -> `Float f
+  | Str s -> `Str s
+  | Node n -> `Node n.node
+  | Rel -> `Rel
+
+let truthy = function Bool b -> b | _ -> false
+
+let compare_values a b =
+  match (a, b) with
+  | Int x, Int y -> Some (Int64.compare x y)
+  | Float x, Float y -> Some (Float.compare x y)
+  | Int x, Float y -> Some (Float.compare (Int64.to_float x) y)
+  | Float x, Int y -> Some (Float.compare x (Int64.to_float y))
+  | Str x, Str y -> Some (String.compare x y)
+  | Bool x, Bool y -> Some (Bool.compare x y)
+  | Node x, Node y -> Some (compare x.node y.node)
+  | _ -> None
+
+(** Address IDs are numeric strings, so an integer compared with or
+    looked up as an [addressId] is taken as its decimal string. *)
+let address_id = function Int i -> Str (Int64.to_string i) | v -> v
+
+let to_float = function Int i -> Int64.to_float i | Float f -> f | _ -> nan
+
+let arith op a b =
+  match (a, b) with
+  | Int x, Int y -> (
+      match op with
+      | "+" -> Int (Int64.add x y)
+      | "-" -> Int (Int64.sub x y)
+      | "*" -> Int (Int64.mul x y)
+      | "/" -> if y = 0L then Null else Int (Int64.div x y)
+      | _ -> if y = 0L then Null else Int (Int64.rem x y))
+  | (Int _ | Float _), (Int _ | Float _) -> (
+      let x = to_float a and y = to_float b in
+      match op with
+      | "+" -> Float (x +. y)
+      | "-" -> Float (x -. y)
+      | "*" -> Float (x *. y)
+      | "/" -> Float (x /. y)
+      | _ -> Float (Float.rem x y))
+  | Str x, Str y when op = "+" -> Str (x ^ y)
+  | _ -> Null
+
+(** {1 Syntax} *)
+
+type token =
+  | T_ident of string
+  | T_int of int64
+  | T_str of string
+  | T_param of string
+  | T_sym of string
+  | T_eof
+
+let describe = function
+  | T_ident s -> s
+  | T_int i -> Int64.to_string i
+  | T_str s -> Printf.sprintf "'%s'" s
+  | T_param s -> "$" ^ s
+  | T_sym s -> Printf.sprintf "'%s'" s
+  | T_eof -> "end of query"
+
+let tokenize s =
+  let n = String.length s in
+  let toks = ref [] in
+  let push t = toks := t :: !toks in
+  let is_word c =
+    match c with 'a' .. 'z' | 'A' .. 'Z' | '0' .. '9' | '_' -> true | _ -> false
+  in
+  let word_end i =
+    let j = ref i in
+    while !j < n && is_word s.[!j] do incr j done;
+    !j
+  in
+  let i = ref 0 in
+  while !i < n do
+    let c = s.[!i] in
+    let next = if !i + 1 < n then s.[!i + 1] else '\000' in
+    match c with
+    | ' ' | '\t' | '\n' | '\r' -> incr i
+    | '/' when next = '/' -> (
+        match String.index_from_opt s !i '\n' with Some j -> i := j + 1 | None -> i := n)
+    | '0' .. '9' ->
+        let j = word_end !i in
+        let lit = String.sub s !i (j - !i) in
+        (match Int64.of_string_opt lit with
+        | Some v -> push (T_int v)
+        | None -> error "Invalid number %s" lit);
+        i := j
+    | 'a' .. 'z' | 'A' .. 'Z' | '_' ->
+        let j = word_end !i in
+        push (T_ident (String.sub s !i (j - !i)));
+        i := j
+    | '`' -> (
+        match String.index_from_opt s (!i + 1) '`' with
+        | Some j ->
+            push (T_ident (String.sub s (!i + 1) (j - !i - 1)));
+            i := j + 1
+        | None -> error "Unterminated `name`")
+    | '$' ->
+        let j = word_end (!i + 1) in
+        if j = !i + 1 then error "Expected a parameter name after $";
+        push (T_param (String.sub s (!i + 1) (j - !i - 1)));
+        i := j
+    | '\'' | '"' -> (
+        match String.index_from_opt s (!i + 1) c with
+        | Some j ->
+            push (T_str (String.sub s (!i + 1) (j - !i - 1)));
+            i := j + 1
+        | None -> error "Unterminated string")
+    | ('<' | '>') when next = '=' ->
+        push (T_sym (String.make 1 c ^ "="));
+        i := !i + 2
+    | '<' when next = '>' ->
+        push (T_sym "<>");
+        i := !i + 2
+    | '(' | ')' | '[' | ']' | '{' | '}' | ':' | ',' | '.' | ';' | '*' | '=' | '<'
+    | '>' | '-' | '+' | '/' | '%' ->
+        push (T_sym (String.make 1 c));
+        incr i
+    | _ -> error "Unexpected character '%c'" c
+  done;
+  List.rev (T_eof :: !toks)
+
+type direction = Right | Left
+
+type expr =
+  | Lit of value
+  | Param of string
+  | Var of string
+  | Prop of string * string
+  | Not of expr
+  | And of expr * expr
+  | Or of expr * expr
+  | Cmp of string * expr * expr
+  | Arith of string * expr * expr
+  | Neg of expr
+  | Is_null of expr
+  | Agg of string * bool * expr option  (** Function, DISTINCT, argument ([*] is [None]) *)
+  | Exists of pattern
+
+and node_pat = {
+  var : string;  (** Generated for anonymous nodes, see {!is_anonymous} *)
+  label : string option;
+  props : (string * expr) list;
+}
+
+and rel_pat = { rvar : string option; rtype : string option; dir : direction }
+and pattern = { first : node_pat; rest : (rel_pat * node_pat) list }
+
+type item = { expr : expr; alias : string }
+
+type query = {
+  pattern : pattern;
+  where : expr option;
+  stages : (item list * expr option) list;  (** WITH clauses *)
+  return : item list;
+  order : (expr * bool) list;  (** Key, descending *)
+  limit : int option;
+}
+
+(* Generated names start with a space, which no identifier can *)
+let is_anonymous v = v <> "" && v.[0] = ' '
+
+let rec show = function
+  | Lit (Str s) -> Printf.sprintf "'%s'" s
+  | Lit v -> to_string v
+  | Param p -> "$" ^ p
+  | Var v -> v
+  | Prop (v, k) -> v ^ "." ^ k
+  | Not e -> "NOT " ^ show e
+  | And (a, b) -> show a ^ " AND " ^ show b
+  | Or (a, b) -> show a ^ " OR " ^ show b
+  | Cmp (op, a, b) | Arith (op, a, b) -> show a ^ " " ^ op ^ " " ^ show b
+  | Neg e -> "-" ^ show e
+  | Is_null e -> show e ^ " IS NULL"
+  | Agg (fn, distinct, arg) ->
+      Printf.sprintf "%s(%s%s)" (String.lowercase_ascii fn)
+        (if distinct then "DISTINCT " else "")
+        (match arg with Some e -> show e | None -> "*")
+  | Exists _ -> "EXISTS {...}"
+
+type parser = { toks : token array; mutable pos : int; mutable anon : int }
+
+let peek p = p.toks.(p.pos)
+let advance p = if p.pos < Array.length p.toks - 1 then p.pos <- p.pos + 1
+let is_sym p s = peek p = T_sym s
+
+let is_kw p kw =
+  match peek p with T_ident s -> String.uppercase_ascii s = kw | _ -> false
+
+let accept p s =
+  if is_sym p s then begin
+    advance p;
+    true
+  end
+  else false
+
+let accept_kw p kw =
+  if is_kw p kw then begin
+    advance p;
+    true
+  end
+  else false
+
+let expect p s =
+  if not (accept p s) then error "Expected '%s' near %s" s (describe (peek p))
+
+let expect_kw p kw =
+  if not (accept_kw p kw) then error "Expected %s near %s" kw (describe (peek p))
+
+let ident p =
+  match peek p with
+  | T_ident s ->
+      advance p;
+      s
+  | t -> error "Expected a name near %s" (describe t)
+
+let fresh p =
+  p.anon <- p.anon + 1;
+  Printf.sprintf " %d" p.anon
+
+(* At '(': whether a node pattern rather than a parenthesised expression
+   follows, i.e. "()" or "(x)" before a relationship, or a label *)
+let is_pattern p =
+  let tok k =
+    if p.pos + k < Array.length p.toks then p.toks.(p.pos + k) else T_eof
+  in
+  let before_rel k = tok k = T_sym "-" || tok k = T_sym "<" in
+  match tok 1 with
+  | T_sym ")" -> before_rel 2
+  | T_sym ":" -> true
+  | T_ident _ -> (
+      match tok 2 with T_sym ")" -> before_rel 3 | T_sym ":" -> true | _ -> false)
+  | _ -> false
+
+let rec parse_expr p = parse_or p
+
+and parse_or p =
+  let l = parse_and p in
+  if accept_kw p "OR" then Or (l, parse_or p) else l
+
+and parse_and p =
+  let l = parse_not p in
+  if accept_kw p "AND" then And (l, parse_and p) else l
+
+and parse_not p = if accept_kw p "NOT" then Not (parse_not p) else parse_cmp p
+
+and parse_cmp p =
+  let l = parse_add p in
+  match peek p with
+  | T_sym (("=" | "<>" | "<" | "<=" | ">" | ">=") as op) ->
+      advance p;
+      Cmp (op, l, parse_add p)
+  | _ when accept_kw p "IS" ->
+      let negated = accept_kw p "NOT" in
+      expect_kw p "NULL";
+      if negated then Not (Is_null l) else Is_null l
+  | _ -> l
+
+and parse_add p =
+  let rec loop l =
+    match peek p with
+    | T_sym (("+" | "-") as op) ->
+        advance p;
+        loop (Arith (op, l, parse_mul p))
+    | _ -> l
+  in
+  loop (parse_mul p)
+
+and parse_mul p =
+  let rec loop l =
+    match peek p with
+    | T_sym (("*" | "/" | "%") as op) ->
+        advance p;
+        loop (Arith (op, l, parse_unary p))
+    | _ -> l
+  in
+  loop (parse_unary p)
+
+and parse_unary p = if accept p "-" then Neg (parse_unary p) else parse_atom p
+
+and parse_atom p =
+  match peek p with
+  | T_int i ->
+      advance p;
+      Lit (Int i)
+  | T_str s ->
+      advance p;
+      Lit (Str s)
+  | T_param s ->
+      advance p;
+      Param s
+  | T_sym "(" when is_pattern p -> Exists (parse_pattern p)
+  | T_sym "(" ->
+      advance p;
+      let e = parse_expr p in
+      expect p ")";
+      e
+  | T_ident s -> (
+      advance p;
+      match String.uppercase_ascii s with
+      | "TRUE" -> Lit (Bool true)
+      | "FALSE" -> Lit (Bool false)
+      | "NULL" -> Lit Null
+      | "EXISTS" when accept p "{" ->
+          let pat = parse_pattern p in
+          expect p "}";
+          Exists pat
+      | fn when accept p "(" -> (
+          let distinct = accept_kw p "DISTINCT" in
+          let arg = if accept p "*" then None else Some (parse_expr p) in
+          expect p ")";
+          match fn with
+          | "COUNT" -> Agg (fn, distinct, arg)
+          | ("SUM" | "MIN" | "MAX" | "AVG") when Option.is_some arg ->
+              Agg (fn, distinct, arg)
+          | _ -> error "Unsupported function %s" s)
+      | _ -> if accept p "." then Prop (s, ident p) else Var s)
+  | t -> error "Unexpected %s" (describe t)
+
+and parse_node p =
+  expect p "(";
+  let var = match peek p with T_ident _ -> ident p | _ -> fresh p in
+  let label = if accept p ":" then Some (ident p) else None in
+  let props = if accept p "{" then parse_props p else [] in
+  expect p ")";
+  { var; label; props }
+
+and parse_props p =
+  let rec loop acc =
+    let key = ident p in
+    expect p ":";
+    let acc = (key, parse_expr p) :: acc in
+    if accept p "," then loop acc
+    else begin
+      expect p "}";
+      List.rev acc
+    end
+  in
+  if accept p "}" then [] else loop []
+
+and parse_rel p =
+  let left = accept p "<" in
+  expect p "-";
+  let rvar, rtype =
+    if accept p "[" then begin
+      let rvar = match peek p with T_ident _ -> Some (ident p) | _ -> None in
+      let rtype = if accept p ":" then Some (ident p) else None in
+      expect p "]";
+      (rvar, rtype)
+    end
+    else (None, None)
+  in
+  expect p "-";
+  let right = accept p ">" in
+  match (left, right) with
+  | false, true -> { rvar; rtype; dir = Right }
+  | true, false -> { rvar; rtype; dir = Left }
+  | _ -> error "Relationships must have exactly one direction"
+
+and parse_pattern p =
+  let first = parse_node p in
+  let rec loop acc =
+    if is_sym p "-" || is_sym p "<" then begin
+      let rel = parse_rel p in
+      let node = parse_node p in
+      loop ((rel, node) :: acc)
+    end
+    else List.rev acc
+  in
+  { first; rest = loop [] }
+
+let parse_items p =
+  let rec loop acc =
+    let expr = parse_expr p in
+    let alias = if accept_kw p "AS" then ident p else show expr in
+    let acc = { expr; alias } :: acc in
+    if accept p "," then loop acc else List.rev acc
+  in
+  loop []
+
+let parse_order p =
+  let rec loop acc =
+    let key = parse_expr p in
+    let desc =
+      if accept_kw p "DESC" || accept_kw p "DESCENDING" then true
+      else begin
+        ignore (accept_kw p "ASC" || accept_kw p "ASCENDING");
+        false
+      end
+    in
+    let acc = (key, desc) :: acc in
+    if accept p "," then loop acc else List.rev acc
+  in
+  loop []
+
+(** Parse a query. Raises {!Error} outside the supported subset. *)
+let parse text =
+  let p = { toks = Array.of_list (tokenize text); pos = 0; anon = 0 } in
+  expect_kw p "MATCH";
+  let pattern = parse_pattern p in
+  if is_sym p "," then error "Only one pattern per MATCH is supported";
+  let where = if accept_kw p "WHERE" then Some (parse_expr p) else None in
+  let rec stages acc =
+    if accept_kw p "WITH" then begin
+      let items = parse_items p in
+      let where = if accept_kw p "WHERE" then Some (parse_expr p) else None in
+      stages ((items, where) :: acc)
+    end
+    else List.rev acc
+  in
+  let stages = stages [] in
+  expect_kw p "RETURN";
+  let return = parse_items p in
+  let order =
+    if accept_kw p "ORDER" then begin
+      expect_kw p "BY";
+      parse_order p
+    end
+    else []
+  in
+  let limit =
+    if accept_kw p "LIMIT" then (
+      match peek p with
+      | T_int n ->
+          advance p;
+          Some (Int64.to_int n)
+      | t -> error "Expected a number after LIMIT near %s" (describe t))
+    else None
+  in
+  ignore (accept p ";");
+  if peek p <> T_eof then error "Unexpected %s" (describe (peek p));
+  { pattern; where; stages; return; order; limit }
+
+(** {1 Schema} *)
+
+type label = L_block | L_tx | L_output | L_address
+
+let label_of_name = function
+  | "Block" -> L_block
+  | "Transaction" -> L_tx
+  | "Output" -> L_output
+  | "Address" -> L_address
+  | l -> error "Unknown label :%s" l
+
+let label_name = function
+  | L_block -> "Block"
+  | L_tx -> "Transaction"
+  | L_output -> "Output"
+  | L_address -> "Address"
+
+(** Source and target labels of a relationship type. *)
+let rel_ends = function
+  | "CONTAINS" -> (L_block, L_tx)
+  | "TX_OUTPUT" | "TX_INPUT" -> (L_tx, L_output)
+  | "TO_ADDRESS" -> (L_output, L_address)
+  | t -> error "Unknown relationship type :%s" t
+
+let rel_between src dst =
+  match (src, dst) with
+  | L_block, L_tx -> "CONTAINS"
+  | L_output, L_address -> "TO_ADDRESS"
+  | L_tx, L_output -> error "Give the type of Transaction->Output (TX_OUTPUT or TX_INPUT)"
+  | _ -> error "No relationship from :%s to :%s" (label_name src) (label_name dst)
+
+(** Properties identifying a node, which turn a scan into a point lookup. *)
+let key_props = function
+  | L_block -> [ "height" ]
+  | L_tx -> [ "txId" ]
+  | L_output -> [ "txId"; "vout" ]
+  | L_address -> [ "addressId" ]
+
+let block_property = function
+  | "height" -> Some (fun (b : Types.block) -> of_int b.height)
+  | "hash" -> Some (fun (b : Types.block) -> Str b.hash)
+  | "timestamp" -> Some (fun (b : Types.block) -> Int b.timestamp)
+  | "nonce" -> Some (fun (b : Types.block) -> Int b.nonce)
+  | "bits" -> Some (fun (b : Types.block) -> Int b.bits)
+  | "version" -> Some (fun (b : Types.block) -> of_int b.version)
+  | _ -> None
+
+let tx_property = function
+  | "txId" -> Some (fun (t : Types.transaction) -> of_int t.tx_id)
+  | "hash" -> Some (fun (t : Types.transaction) -> Str t.tx_hash)
+  | "blockHeight" -> Some (fun (t : Types.transaction) -> of_int t.tx_block_height)
+  | "fee" -> Some (fun (t : Types.transaction) -> Int t.tx_fee)
+  | "size" -> Some (fun (t : Types.transaction) -> of_int t.tx_size)
+  | "weight" -> Some (fun (t : Types.transaction) -> of_int t.tx_weight)
+  | "locktime" -> Some (fun (t : Types.transaction) -> Int t.tx_locktime)
+  | "version" -> Some (fun (t : Types.transaction) -> of_int t.tx_version)
+  | _ -> None
+
+let summary_property = function
+  | "fee" -> Some (fun (s : Types.tx_summary) -> Int s.sum_fee)
+  | "locktime" -> Some (fun (s : Types.tx_summary) -> Int s.sum_locktime)
+  | "version" -> Some (fun (s : Types.tx_summary) -> of_int s.sum_version)
+  | _ -> None
+
+let output_property = function
+  | "value" -> Some (fun (o : Types.output) -> Int o.out_value)
+  | "scriptType" -> Some (fun (o : Types.output) -> Str o.out_script_type)
+  | _ -> None
+
+let address_property = function
+  | "address" -> Some (fun (a : Types.address) -> Str a.addr_str)
+  | "type" -> Some (fun (a : Types.address) -> Str a.addr_type)
+  | _ -> None
+
+(** Getter for property [name]. Keys come from the node itself and tx
+    summary fields from the [block_txs] leaf; anything else reads the
+    record, once per node. *)
+let property name =
+  let block = block_property name
+  and tx = tx_property name
+  and summary = summary_property name
+  and output = output_property name
+  and address = address_property name in
+  function
+  | Node { node = Block h; _ } when name = "height" -> of_int h
+  | Node { node = Tx id; _ } when name = "txId" -> of_int id
+  | Node { node = Output (tx, _); _ } when name = "txId" -> of_int tx
+  | Node { node = Output (_, vout); _ } when name = "vout" -> of_int vout
+  | Node { node = Address a; _ } when name = "addressId" -> Str a
+  | Node { summary = Some s; _ } when Option.is_some summary -> (Option.get summary) s
+  | Node n -> (
+      match (Lazy.force n.record, block, tx, output, address) with
+      | Some (Types.Block b), Some f, _, _, _ -> f b
+      | Some (Types.Transaction t), _, Some f, _, _ -> f t
+      | Some (Types.Output o), _, _, Some f, _ -> f o
+      | Some (Types.Address a), _, _, _, Some f -> f a
+      | _ -> Null)
+  | _ -> Null
+
+(** {1 Store access} *)
+
+let block_node store h =
+  Node
+    {
+      node = Block h;
+      record = lazy (Option.map (fun b -> Types.Block b) (Query.get_block store h));
+      summary = None;
+    }
+
+let tx_node ?summary store id =
+  Node
+    {
+      node = Tx id;
+      record =
+        lazy (Option.map (fun t -> Types.Transaction t) (Query.get_transaction store id));
+      summary;
+    }
+
+let output_node store tx vout =
+  Node
+    {
+      node = Output (tx, vout);
+      record = lazy (Option.map (fun o -> Types.Output o) (Query.get_output store tx vout));
+      summary = None;
+    }
+
+(* Outputs whose value and script are embedded in the reference need no read *)
+let output_of_ref store (r : Types.output_ref) =
+  match (r.ref_value, Option.bind r.ref_script (Dict.name Dict.script_types)) with
+  | Some value, Some script ->
+      let o =
+        {
+          Types.out_value = value;
+          out_script_type = script;
+          out_tx_id = r.ref_tx_id;
+          out_vout = r.ref_vout;
+        }
+      in
+      Node
+        {
+          node = Output (r.ref_tx_id, r.ref_vout);
+          record = Lazy.from_val (Some (Types.Output o));
+          summary = None;
+        }
+  | _ -> output_node store r.ref_tx_id r.ref_vout
+
+let address_node store a =
+  Node
+    {
+      node = Address a;
+      record = lazy (Option.map (fun x -> Types.Address x) (Query.get_address store a));
+      summary = None;
+    }
+
+let exists = function Node n -> Option.is_some (Lazy.force n.record) | _ -> false
+
+(* Transactions of a block, with their summaries when the leaves hold them *)
+let block_txs store h emit =
+  let path = Store.block_txs_path h in
+  List.iter
+    (fun key ->
+      match Store.get store (path @ [ key ]) with
+      | Some (Types.TxRef id) -> emit (tx_node store id)
+      | Some (Types.TxSummary s) -> emit (tx_node ~summary:s store s.Types.sum_tx_id)
+      | _ -> ())
+    (Store.list store path)
+
+let address_outputs store a emit =
+  let path = Store.addr_outputs_path a in
+  List.iter
+    (fun key ->
+      match Store.get store (path @ [ key ]) with
+      | Some (Types.OutputRef r) -> emit (output_of_ref store r)
+      | _ -> ())
+    (Store.list store path)
+
+(** Index join: the nodes across relationship [rel] from [v], following
+    the arrow if [forward] and against it otherwise. *)
+let expand store rel ~forward v emit =
+  match v with
+  | Node n -> (
+      match (rel, forward, n.node) with
+      | "CONTAINS", true, Block h -> block_txs store h emit
+      | "CONTAINS", false, Tx _ -> (
+          match Lazy.force n.record with
+          | Some (Types.Transaction t) -> emit (block_node store t.Types.tx_block_height)
+          | _ -> ())
+      | "TX_OUTPUT", true, Tx id ->
+          List.iter (fun r -> emit (output_of_ref store r)) (Query.tx_output_refs store id)
+      | "TX_OUTPUT", false, Output (tx, _) -> emit (tx_node store tx)
+      | "TX_INPUT", true, Tx id ->
+          List.iter
+            (fun (i : Types.input) ->
+              emit (output_node store i.in_spent_tx_id i.in_spent_vout))
+            (Query.tx_inputs store id)
+      | "TX_INPUT", false, Output (tx, vout) ->
+          Option.iter
+            (fun spender -> emit (tx_node store spender))
+            (Query.output_spent_by store tx vout)
+      | "TO_ADDRESS", true, Output (tx, vout) ->
+          Option.iter (fun a -> emit (address_node store a)) (Query.output_address store tx vout)
+      | "TO_ADDRESS", false, Address a -> address_outputs store a emit
+      | _ -> ())
+  | _ -> ()
+
+(** All nodes with [label]. *)
+let scan store label emit =
+  match label with
+  | L_block ->
+      for h = 0 to Query.last_block_height store do
+        emit (block_node store h)
+      done
+  | L_tx ->
+      for h = 0 to Query.last_block_height store do
+        block_txs store h emit
+      done
+  | L_output ->
+      for h = 0 to Query.last_block_height store do
+        block_txs store h (fun tx -> expand store "TX_OUTPUT" ~forward:true tx emit)
+      done
+  | L_address -> List.iter (fun a -> emit (address_node store a)) (Store.list store [ "address" ])
+
+(** The node with [label] and key properties [keys], if it exists. *)
+let seek store label keys emit =
+  let int_key k =
+    match List.assoc_opt k keys with Some (Int i) -> Some (Int64.to_int i) | _ -> None
+  in
+  let node =
+    match (label, Option.map address_id (List.assoc_opt "addressId" keys)) with
+    | L_block, _ -> Option.map (block_node store) (int_key "height")
+    | L_tx, _ -> Option.map (tx_node store) (int_key "txId")
+    | L_output, _ -> (
+        match (int_key "txId", int_key "vout") with
+        | Some tx, Some vout -> Some (output_node store tx vout)
+        | _ -> None)
+    | L_address, Some (Str a) -> Some (address_node store a)
+    | L_address, _ -> None
+  in
+  Option.iter (fun n -> if exists n then emit n) node
+
+(** {1 Compilation} *)
+
+type ctx = { store : Store.Store.t; params : (string * value) list }
+
+(** Variables of a stage, mapped to row slots. *)
+type scope = {
+  slots : (string, int) Hashtbl.t;
+  labels : (string, label) Hashtbl.t;
+  mutable size : int;
+}
+
+let new_scope () = { slots = Hashtbl.create 16; labels = Hashtbl.create 16; size = 0 }
+
+let alloc scope v =
+  match Hashtbl.find_opt scope.slots v with
+  | Some i -> i
+  | None ->
+      let i = scope.size in
+      Hashtbl.add scope.slots v i;
+      scope.size <- i + 1;
+      i
+
+let slot scope v =
+  match Hashtbl.find_opt scope.slots v with
+  | Some i -> i
+  | None -> error "Unknown variable %s" v
+
+let param ctx name =
+  match List.assoc_opt name ctx.params with
+  | Some v -> v
+  | None -> error "Missing parameter $%s" name
+
+let constant ctx = function
+  | Lit v -> Some v
+  | Param p -> Some (param ctx p)
+  | _ -> None
+
+let rec conjuncts = function And (a, b) -> conjuncts a @ conjuncts b | e -> [ e ]
+
+let rec free_vars acc = function
+  | Lit _ | Param _ -> acc
+  | Var v | Prop (v, _) -> v :: acc
+  | Not e | Neg e | Is_null e -> free_vars acc e
+  | And (a, b) | Or (a, b) | Cmp (_, a, b) | Arith (_, a, b) ->
+      free_vars (free_vars acc a) b
+  | Agg (_, _, arg) -> Option.fold ~none:acc ~some:(free_vars acc) arg
+  | Exists pat ->
+      (pat.first.var :: List.concat_map (fun (r, n) -> n.var :: Option.to_list r.rvar) pat.rest)
+      |> List.filter (fun v -> not (is_anonymous v))
+      |> List.rev_append acc
+
+(** Run each step with a row and a continuation for the rows it produces. *)
+type step = value array -> (value array -> unit) -> unit
+
+let chain (steps : step list) sink =
+  List.fold_right (fun step next row -> step row next) steps sink
+
+exception Found
+
+let rec compile_expr ctx scope e : value array -> value =
+  match e with
+  | Lit v -> fun _ -> v
+  | Param p ->
+      let v = param ctx p in
+      fun _ -> v
+  | Var v ->
+      let i = slot scope v in
+      fun row -> row.(i)
+  | Prop (v, k) ->
+      let i = slot scope v and get = property k in
+      fun row -> get row.(i)
+  | Not e -> (
+      let f = compile_expr ctx scope e in
+      fun row -> match f row with Bool b -> Bool (not b) | _ -> Null)
+  | And (a, b) -> (
+      let fa = compile_expr ctx scope a and fb = compile_expr ctx scope b in
+      fun row ->
+        match fa row with
+        | Bool false -> Bool false
+        | x -> (
+            match (x, fb row) with
+            | _, Bool false -> Bool false
+            | Bool true, Bool true -> Bool true
+            | _ -> Null))
+  | Or (a, b) -> (
+      let fa = compile_expr ctx scope a and fb = compile_expr ctx scope b in
+      fun row ->
+        match fa row with
+        | Bool true -> Bool true
+        | x -> (
+            match (x, fb row) with
+            | _, Bool true -> Bool true
+            | Bool false, Bool false -> Bool false
+            | _ -> Null))
+  | Cmp (op, a, b) -> (
+      let fa = compile_expr ctx scope a and fb = compile_expr ctx scope b in
+      let fa, fb =
+        match (a, b) with
+        | Prop (_, "addressId"), _ -> (fa, fun row -> address_id (fb row))
+        | _, Prop (_, "addressId") -> ((fun row -> address_id (fa row)), fb)
+        | _ -> (fa, fb)
+      in
+      let test =
+        match op with
+        | "=" -> fun c -> c = 0
+        | "<>" -> fun c -> c <> 0
+        | "<" -> fun c -> c < 0
+        | "<=" -> fun c -> c <= 0
+        | ">" -> fun c -> c > 0
+        | _ -> fun c -> c >= 0
+      in
+      fun row ->
+        match (fa row, fb row) with
+        | Null, _ | _, Null -> Null
+        | x, y -> (
+            match compare_values x y with
+            | Some c -> Bool (test c)
+            | None when op = "=" -> Bool false
+            | None when op = "<>" -> Bool true
+            | None -> Null))
+  | Arith (op, a, b) ->
+      let fa = compile_expr ctx scope a and fb = compile_expr ctx scope b in
+      fun row -> arith op (fa row) (fb row)
+  | Neg e -> (
+      let f = compile_expr ctx scope e in
+      fun row ->
+        match f row with Int i -> Int (Int64.neg i) | Float x -> Float (-.x) | _ -> Null)
+  | Is_null e -> (
+      let f = compile_expr ctx scope e in
+      fun row -> match f row with Null -> Bool true | _ -> Bool false)
+  | Agg _ -> error "Aggregates are only allowed as WITH and RETURN items"
+  | Exists pat -> (
+      let run = chain (plan ctx scope pat []) (fun _ -> raise_notrace Found) in
+      fun row -> match run row with () -> Bool false | exception Found -> Bool true)
+
+(** Compile [pat] into a scan or seek of one node and an index join per
+    relationship, with each of [where] filtering as soon as its variables
+    are bound. A pattern that mentions an already bound variable (a
+    pattern predicate) starts from it instead. *)
+and plan ctx scope pat where : step list =
+  let nodes = Array.of_list (pat.first :: List.map snd pat.rest) in
+  let rels = Array.of_list (List.map fst pat.rest) in
+  let n = Array.length nodes in
+  let labels =
+    Array.map
+      (fun np ->
+        match np.label with
+        | Some l -> Some (label_of_name l)
+        | None -> Hashtbl.find_opt scope.labels np.var)
+      nodes
+  in
+  let types = Array.map (fun r -> r.rtype) rels in
+  let ends i = if rels.(i).dir = Right then (i, i + 1) else (i + 1, i) in
+  let changed = ref true in
+  while !changed do
+    changed := false;
+    Array.iteri
+      (fun i _ ->
+        let src, dst = ends i in
+        match types.(i) with
+        | Some t ->
+            let set j l =
+              match labels.(j) with
+              | None ->
+                  labels.(j) <- Some l;
+                  changed := true
+              | Some l' when l' <> l ->
+                  error ":%s does not connect :%s" t (label_name l')
+              | Some _ -> ()
+            in
+            let ls, ld = rel_ends t in
+            set src ls;
+            set dst ld
+        | None -> (
+            match (labels.(src), labels.(dst)) with
+            | Some ls, Some ld ->
+                types.(i) <- Some (rel_between ls ld);
+                changed := true
+            | _ -> ()))
+      rels
+  done;
+  let labels =
+    Array.mapi
+      (fun i l ->
+        match l with
+        | Some l -> l
+        | None when is_anonymous nodes.(i).var -> error "Cannot infer the label of a node"
+        | None -> error "Cannot infer the label of %s" nodes.(i).var)
+      labels
+  in
+  Array.iteri
+    (fun i np -> if not (is_anonymous np.var) then Hashtbl.replace scope.labels np.var labels.(i))
+    nodes;
+  let where =
+    List.concat_map
+      (fun np -> List.map (fun (k, e) -> Cmp ("=", Prop (np.var, k), e)) np.props)
+      (Array.to_list nodes)
+    @ where
+  in
+  (* Key properties of node i fixed by an equality in where *)
+  let seek_keys i =
+    let var = nodes.(i).var in
+    let fixed k =
+      List.find_map
+        (function
+          | Cmp ("=", Prop (v, k'), e) | Cmp ("=", e, Prop (v, k')) ->
+              if v = var && k' = k then Option.map (fun c -> (k, c)) (constant ctx e)
+              else None
+          | _ -> None)
+        where
+    in
+    let keys = List.filter_map fixed (key_props labels.(i)) in
+    if List.length keys = List.length (key_props labels.(i)) then Some keys else None
+  in
+  let outer i = Hashtbl.mem scope.slots nodes.(i).var in
+  let start =
+    let rec find p i = if i >= n then None else if p i then Some i else find p (i + 1) in
+    match find outer 0 with
+    | Some i -> i
+    | None -> Option.value (find (fun i -> Option.is_some (seek_keys i)) 0) ~default:0
+  in
+  let start_bound = outer start in
+  let bound = Hashtbl.create 16 in
+  Hashtbl.iter (fun v _ -> Hashtbl.replace bound v ()) scope.slots;
+  let pending = ref where and steps = ref [] in
+  let add step = steps := step :: !steps in
+  let attach () =
+    let ready, rest =
+      List.partition
+        (fun e -> List.for_all (Hashtbl.mem bound) (free_vars [] e))
+        !pending
+    in
+    pending := rest;
+    List.iter
+      (fun e ->
+        let f = compile_expr ctx scope e in
+        add (fun row k -> if truthy (f row) then k row))
+      ready
+  in
+  attach ();
+  (if not start_bound then begin
+     let i = alloc scope nodes.(start).var and label = labels.(start) in
+     Hashtbl.replace bound nodes.(start).var ();
+     match seek_keys start with
+     | Some keys -> add (fun row k -> seek ctx.store label keys (fun v -> row.(i) <- v; k row))
+     | None -> add (fun row k -> scan ctx.store label (fun v -> row.(i) <- v; k row))
+   end);
+  attach ();
+  let join r from_node to_node ~forward =
+    let from = slot scope nodes.(from_node).var in
+    let rel = Option.get types.(r) in
+    let rslot = Option.map (alloc scope) rels.(r).rvar in
+    let set_rel row = Option.iter (fun j -> row.(j) <- Rel) rslot in
+    let var = nodes.(to_node).var in
+    if Hashtbl.mem bound var then begin
+      let target = slot scope var in
+      add (fun row k ->
+          expand ctx.store rel ~forward row.(from) (fun v ->
+              match (v, row.(target)) with
+              | Node a, Node b when a.node = b.node ->
+                  set_rel row;
+                  k row
+              | _ -> ()))
+    end
+    else begin
+      let target = alloc scope var in
+      add (fun row k ->
+          expand ctx.store rel ~forward row.(from) (fun v ->
+              row.(target) <- v;
+              set_rel row;
+              k row))
+    end;
+    Hashtbl.replace bound var ();
+    Option.iter (fun v -> Hashtbl.replace bound v ()) rels.(r).rvar;
+    attach ()
+  in
+  for i = start to n - 2 do
+    join i i (i + 1) ~forward:(rels.(i).dir = Right)
+  done;
+  for i = start - 1 downto 0 do
+    join i (i + 1) i ~forward:(rels.(i).dir = Left)
+  done;
+  (match !pending with
+  | [] -> ()
+  | e :: _ -> (
+      match List.filter (fun v -> not (Hashtbl.mem bound v)) (free_vars [] e) with
+      | v :: _ -> error "Unknown variable %s" v
+      | [] -> ()));
+  List.rev !steps
+
+(** Running count, sum, min, max or average, over distinct values only if
+    [distinct]. Nulls are skipped. *)
+let accumulator fn distinct =
+  let seen = Hashtbl.create (if distinct then 64 else 1) in
+  let count = ref 0 and acc = ref Null in
+  let add = function
+    | Null -> ()
+    | v ->
+        let fresh =
+          if not distinct then true
+          else begin
+            let k = key_of v in
+            let seen_before = Hashtbl.mem seen k in
+            if not seen_before then Hashtbl.add seen k ();
+            not seen_before
+          end
+        in
+        if fresh then begin
+          incr count;
+          match (fn, !acc, compare_values v !acc) with
+          | _, Null, _ -> acc := v
+          | ("SUM" | "AVG"), a, _ -> acc := arith "+" a v
+          | "MIN", _, Some c when c < 0 -> acc := v
+          | "MAX", _, Some c when c > 0 -> acc := v
+          | _ -> ()
+        end
+  in
+  let result () =
+    match fn with
+    | "COUNT" -> of_int !count
+    | "SUM" -> if !count = 0 then Int 0L else !acc
+    | "AVG" -> if !count = 0 then Null else Float (to_float !acc /. float_of_int !count)
+    | _ -> !acc
+  in
+  (add, result)
+
+(** Compile WITH or RETURN [items] over rows of [scope]: a new scope for
+    the projected rows, and their producer. With aggregates, rows are
+    grouped by the other items. *)
+let project ctx scope items input =
+  let out = new_scope () in
+  List.iter
+    (fun it ->
+      if Hashtbl.mem out.slots it.alias then error "Duplicate column %s" it.alias;
+      ignore (alloc out it.alias);
+      match it.expr with
+      | Var v -> Option.iter (Hashtbl.replace out.labels it.alias) (Hashtbl.find_opt scope.labels v)
+      | _ -> ())
+    items;
+  let columns =
+    Array.of_list
+      (List.map
+         (fun it ->
+           match it.expr with
+           | Agg (fn, distinct, arg) ->
+               `Agg (fn, distinct, Option.map (compile_expr ctx scope) arg)
+           | e -> `Key (compile_expr ctx scope e))
+         items)
+  in
+  let grouped = Array.exists (function `Agg _ -> true | `Key _ -> false) columns in
+  let produce emit =
+    if not grouped then
+      input (fun row ->
+          emit (Array.map (function `Key f -> f row | `Agg _ -> Null) columns))
+    else begin
+      let groups = Hashtbl.create 64 and order = ref [] in
+      let group values =
+        let key = Array.to_list (Array.map key_of values) in
+        match Hashtbl.find_opt groups key with
+        | Some g -> g
+        | None ->
+            let accs =
+              Array.map
+                (function
+                  | `Agg (fn, distinct, _) -> accumulator fn distinct
+                  | `Key _ -> ((fun _ -> ()), fun () -> Null))
+                columns
+            in
+            let g = (values, accs) in
+            Hashtbl.add groups key g;
+            order := g :: !order;
+            g
+      in
+      (* Without grouping keys there is one row, even for no input *)
+      if Array.for_all (function `Agg _ -> true | `Key _ -> false) columns then
+        ignore (group (Array.make (Array.length columns) Null));
+      input (fun row ->
+          let values =
+            Array.map (function `Key f -> f row | `Agg _ -> Null) columns
+          in
+          let _, accs = group values in
+          Array.iteri
+            (fun i c ->
+              match c with
+              | `Agg (_, _, arg) ->
+                  (fst accs.(i)) (match arg with Some f -> f row | None -> Bool true)
+              | `Key _ -> ())
+            columns);
+      List.iter
+        (fun (values, accs) ->
+          emit
+            (Array.mapi
+               (fun i v -> match columns.(i) with `Agg _ -> (snd accs.(i)) () | `Key _ -> v)
+               values))
+        (List.rev !order)
+    end
+  in
+  (out, produce)
+
+(** Rows of [produce] padded with [Null] to [scope.size]. A pattern
+    predicate compiled over projected rows allocates slots for its own
+    variables past the projected items; read when the rows are produced,
+    so after every expression over [scope] has been compiled. *)
+let padded scope produce emit =
+  produce (fun row ->
+      let n = Array.length row in
+      emit (if n >= scope.size then row else Array.append row (Array.make (scope.size - n) Null)))
+
+(** {1 Execution} *)
+
+type result = { columns : string list; rows : value list list }
+
+exception Limit
+
+(** Run a query against [store]'s head. [params] bind [$name] values.
+    Raises {!Error} if the query is outside the supported subset. *)
+let run ?(params = []) store text =
+  let q = parse text in
+  let ctx = { store; params } in
+  let scope = new_scope () in
+  let steps = plan ctx scope q.pattern (Option.fold ~none:[] ~some:conjuncts q.where) in
+  let input emit = chain steps emit (Array.make scope.size Null) in
+  let scope, input =
+    List.fold_left
+      (fun (scope, input) (items, where) ->
+        let out, produce = project ctx scope items input in
+        match where with
+        | None -> (out, produce)
+        | Some e ->
+            let f = compile_expr ctx out e in
+            (out, fun emit -> padded out produce (fun row -> if truthy (f row) then emit row)))
+      (scope, input) q.stages
+  in
+  let out, produce = project ctx scope q.return input in
+  let keys = List.map (fun (e, desc) -> (compile_expr ctx out e, desc)) q.order in
+  let produce = padded out produce in
+  let width = List.length q.return in
+  let rows = ref [] and count = ref 0 in
+  (* Without ORDER BY, LIMIT stops the scan early *)
+  let stop = match keys with [] -> q.limit | _ -> None in
+  (match q.limit with
+  | Some l when l <= 0 -> ()
+  | _ -> (
+      try
+        produce (fun row ->
+            rows := row :: !rows;
+            incr count;
+            match stop with Some l when !count >= l -> raise_notrace Limit | _ -> ())
+      with Limit -> ()));
+  let rows = List.rev !rows in
+  let rows =
+    match keys with
+    | [] -> rows
+    | _ ->
+        let cmp a b =
+          List.fold_left
+            (fun c (f, desc) ->
+              if c <> 0 then c
+              else
+                let c =
+                  match (f a, f b) with
+                  | Null, Null -> 0
+                  | Null, _ -> -1
+                  | _, Null -> 1
+                  | x, y -> Option.value (compare_values x y) ~default:0
+                in
+                if desc then -c else c)
+            0 keys
+        in
+        let sorted = List.stable_sort cmp rows in
+        match q.limit with Some l -> List.filteri (fun i _ -> i < l) sorted | None -> sorted
+  in
+  {
+    columns = List.map (fun it -> it.alias) q.return;
+    rows = List.map (fun row -> Array.to_list (Array.sub row 0 width)) rows;
+  }
@@ -0,0 +1,86 @@
+(** Dictionaries mapping low-cardinality strings to byte codes.
+
+    Script types and address types only take a handful of distinct values
+    ("pubkeyhash", "witness_v0_keyhash", ...). The importer gives each value
+    a code the first time it is seen and persists the mapping under
+    [meta/dict/<name>/<code>], so codes stay stable across incremental
+    imports and group-by queries can count codes instead of comparing
+    strings. *)
+
+type t = {
+  name : string;
+  codes : (string, int) Hashtbl.t;
+  mutable names : string array;
+  mutable size : int;
+  mutable persisted : int;  (** Codes below this are already in the store *)
+}
+
+(** Codes are bytes; {!none} is reserved for a missing value. *)
+let none = 0xFF
+
+let max_codes = none
+
+let create name =
+  { name; codes = Hashtbl.create 16; names = [||]; size = 0; persisted = 0 }
+
+(** Output script types ([out_script_type]). *)
+let script_types = create "script_type"
+
+(** Address types ([addr_type]). *)
+let addr_types = create "addr_type"
+
+let all = [ script_types; addr_types ]
+
+let grow d n =
+  if n > Array.length d.names then begin
+    let names = Array.make (max n (2 * Array.length d.names)) "" in
+    Array.blit d.names 0 names 0 d.size;
+    d.names <- names
+  end
+
+(** Record [value] under [code], as loaded from the store. *)
+let set d code value =
+  grow d (code + 1);
+  d.names.(code) <- value;
+  Hashtbl.replace d.codes value code;
+  d.size <- max d.size (code + 1);
+  d.persisted <- max d.persisted (code + 1)
+
+(** Code of [value], assigning the next free one if it is new. *)
+let code d value =
+  match Hashtbl.find_opt d.codes value with
+  | Some c -> c
+  | None ->
+      if d.size >= max_codes then
+        failwith (Printf.sprintf "Dictionary %s is full (%d values)" d.name max_codes);
+      let c = d.size in
+      grow d (c + 1);
+      d.names.(c) <- value;
+      Hashtbl.replace d.codes value c;
+      d.size <- c + 1;
+      c
+
+(** Code of [value] if it has one. Unlike {!code} this never assigns, so
+    serialising or exporting records can't add codes the store lacks. *)
+let find_code d value = Hashtbl.find_opt d.codes value
+
+(** Code of [value], or {!none} if it has none. *)
+let code_or_none d value = Option.value (find_code d value) ~default:none
+
+(** Value of [code], if assigned. *)
+let name d code = if code >= 0 && code < d.size then Some d.names.(code) else None
+
+(** Codes assigned since the dictionary was last persisted. *)
+let unsaved d =
+  List.init (d.size - d.persisted) (fun i ->
+      let c = d.persisted + i in
+      (c, d.names.(c)))
+
+let mark_saved d = d.persisted <- d.size
+
+(** Treat codes from [n] on as not in the store, after the branch moved
+    back to a commit that only has the first [n]. *)
+let forget_saved d n = d.persisted <- min d.persisted n
+
+(** All values, in code order. *)
+let to_list d = Array.to_list (Array.sub d.names 0 d.size)
@@ -2,26 +2,154 @@
 
 open Graphql_lwt
 
+(** Per-request batched and cached lookups (the DataLoader pattern).
+
+    Nested fields would otherwise read the store once per object: a block's
+    transactions and their outputs is one read per output, repeated for
+    every output seen twice. A loader instead queues the keys its resolvers
+    ask for and returns promises; the queue is fetched as one batch once
+    the resolvers that are ready have run (after an [Lwt.pause]), and every
+    key stays cached until the request ends. *)
+module Loader = struct
+  type ('k, 'v) t = {
+    cache : ('k, 'v option Lwt.t) Hashtbl.t;
+    mutable queue : ('k * 'v option Lwt.u) list;
+    fetch : 'k list -> 'v option list;  (** One result per key, in order *)
+  }
+
+  let create fetch = { cache = Hashtbl.create 64; queue = []; fetch }
+
+  let dispatch t =
+    let pending = List.rev t.queue in
+    t.queue <- [];
+    match t.fetch (List.map fst pending) with
+    | values -> List.iter2 (fun (_, u) v -> Lwt.wakeup_later u v) pending values
+    | exception e -> List.iter (fun (_, u) -> Lwt.wakeup_later_exn u e) pending
+
+  (** Value of [key], fetched with the other keys queued this round. *)
+  let load t key =
+    match Hashtbl.find_opt t.cache key with
+    | Some p -> p
+    | None ->
+        let p, u = Lwt.wait () in
+        Hashtbl.add t.cache key p;
+        if t.queue = [] then
+          Lwt.async (fun () -> Lwt.map (fun () -> dispatch t) (Lwt.pause ()));
+        t.queue <- (key, u) :: t.queue;
+        p
+
+  (** Values of [keys], in order, dropping those that don't exist. *)
+  let load_all t keys =
+    Lwt.map (List.filter_map Fun.id) (Lwt.all (List.map (load t) keys))
+
+  (** Loader of the entities at [path key] in [tree], decoded by
+      [decode]. A batch finds each parent node once (every output of a
+      tx shares [output/<tx>]) and reads its keys' leaves from it. *)
+  let of_paths tree path decode =
+    create (fun keys ->
+        let nodes = Hashtbl.create 16 in
+        let node parent =
+          match Hashtbl.find_opt nodes parent with
+          | Some n -> n
+          | None ->
+              let n = Store.Store.Tree.find_tree tree parent in
+              Hashtbl.add nodes parent n;
+              n
+        in
+        List.map
+          (fun key ->
+            let path = path key in
+            match List.rev path with
+            | [] -> None
+            | leaf :: rev_parent ->
+                Option.bind (node (List.rev rev_parent)) (fun n ->
+                    Option.bind (Store.Store.Tree.find n [ leaf ]) (fun value ->
+                        Option.bind
+                          (Types.value_to_entity ~base:(Store.index_base path) value)
+                          decode)))
+          keys)
+end
+
+(** Context of one GraphQL request: the head it started on and its
+    loaders, which all read that commit's tree. *)
+type context = {
+  snapshot : Store.Store.t;
+  transactions : (int, Types.transaction) Loader.t;
+  outputs : (int * int, Types.output) Loader.t;
+  addresses : (string, Types.address) Loader.t;
+  output_addrs : (int * int, string) Loader.t;  (** [index/output_addr] *)
+  spent_by : (int * int, int) Loader.t;  (** [index/spent_by] *)
+}
+
+let context store =
+  let snapshot, tree =
+    match Store.Store.Head.find store with
+    | Some commit -> (Store.Store.of_commit commit, Store.Store.Commit.tree commit)
+    | None -> (store, Store.Store.Tree.empty ())
+  in
+  let loader path decode = Loader.of_paths tree path decode in
+  {
+    snapshot;
+    transactions =
+      loader Store.tx_path (function Types.Transaction t -> Some t | _ -> None);
+    outputs =
+      loader
+        (fun (tx, vout) -> Store.output_path tx vout)
+        (function Types.Output o -> Some o | _ -> None);
+    addresses =
+      loader Store.address_path (function Types.Address a -> Some a | _ -> None);
+    output_addrs =
+      loader
+        (fun (tx, vout) -> Store.output_addr_path tx vout)
+        (function Types.AddrRef a -> Some a | _ -> None);
+    spent_by =
+      loader
+        (fun (tx, vout) -> Store.spent_by_path tx vout)
+        (function Types.TxRef t -> Some t | _ -> None);
+  }
+
 (** GraphQL schema for blockchain queries. *)
 module Schema = struct
-  (** Block type in GraphQL *)
-  let block =
+  (** Address type in GraphQL *)
+  let address =
     Schema.(
-      obj "Block"
+      obj "Address"
         ~fields:
           [
-            field "height" ~typ:(non_null int) ~args:Arg.[]
-              ~resolve:(fun _ (b : Types.block) -> b.height);
-            field "hash" ~typ:(non_null string) ~args:Arg.[]
-              ~resolve:(fun _ (b : Types.block) -> b.hash);
-            field "timestamp" ~typ:(non_null string) ~args:Arg.[]
-              ~resolve:(fun _ (b : Types.block) -> Int64.to_string b.timestamp);
-            field "nonce" ~typ:(non_null string) ~args:Arg.[]
-              ~resolve:(fun _ (b : Types.block) -> Int64.to_string b.nonce);
-            field "bits" ~typ:(non_null string) ~args:Arg.[]
-              ~resolve:(fun _ (b : Types.block) -> Int64.to_string b.bits);
-            field "version" ~typ:(non_null int) ~args:Arg.[]
-              ~resolve:(fun _ (b : Types.block) -> b.version);
+            field "address" ~typ:(non_null string) ~args:Arg.[]
+              ~resolve:(fun _ (a : Types.address) -> a.addr_str);
+            field "type" ~typ:(non_null string) ~args:Arg.[]
+              ~resolve:(fun _ (a : Types.address) -> a.addr_type);
+          ])
+
+  (** Output type in GraphQL *)
+  let output =
+    Schema.(
+      obj "Output"
+        ~fields:
+          [
+            field "txId" ~typ:(non_null int) ~args:Arg.[]
+              ~resolve:(fun _ (o : Types.output) -> o.out_tx_id);
+            field "vout" ~typ:(non_null int) ~args:Arg.[]
+              ~resolve:(fun _ (o : Types.output) -> o.out_vout);
+            field "value" ~typ:(non_null string) ~args:Arg.[]
+              ~resolve:(fun _ (o : Types.output) -> Int64.to_string o.out_value);
+            field "valueBtc" ~typ:(non_null float) ~args:Arg.[]
+              ~resolve:(fun _ (o : Types.output) ->
+                Query.satoshis_to_btc o.out_value);
+            field "scriptType" ~typ:(non_null string) ~args:Arg.[]
+              ~resolve:(fun _ (o : Types.output) -> o.out_script_type);
+            io_field "address" ~typ:address ~args:Arg.[]
+              ~resolve:(fun info (o : Types.output) ->
+                let ctx : context = info.ctx in
+                Lwt.bind (Loader.load ctx.output_addrs (o.out_tx_id, o.out_vout))
+                  (function
+                    | None -> Lwt.return_ok None
+                    | Some addr -> Lwt.map Result.ok (Loader.load ctx.addresses addr)));
+            io_field "spentBy" ~typ:int ~args:Arg.[]
+              ~resolve:(fun info (o : Types.output) ->
+                let ctx : context = info.ctx in
+                Lwt.map Result.ok (Loader.load ctx.spent_by (o.out_tx_id, o.out_vout)));
           ])
 
   (** Transaction type in GraphQL *)
@@ -48,37 +176,80 @@ module Schema = struct
                 Int64.to_string tx.tx_locktime);
             field "version" ~typ:(non_null int) ~args:Arg.[]
               ~resolve:(fun _ (tx : Types.transaction) -> tx.tx_version);
+            io_field "outputs" ~typ:(non_null (list (non_null output))) ~args:Arg.[]
+              ~resolve:(fun info (tx : Types.transaction) ->
+                let ctx : context = info.ctx in
+                let refs = Query.tx_output_refs ctx.snapshot tx.tx_id in
+                Lwt.map
+                  (fun outputs -> Ok (List.filter_map Fun.id outputs))
+                  (Lwt.all
+                     (List.map
+                        (fun (r : Types.output_ref) ->
+                          match Query.embedded_output r with
+                          | Some _ as output -> Lwt.return output
+                          | None -> Loader.load ctx.outputs (r.ref_tx_id, r.ref_vout))
+                        refs)));
+            io_field "inputs" ~doc:"Outputs spent by this transaction"
+              ~typ:(non_null (list (non_null output))) ~args:Arg.[]
+              ~resolve:(fun info (tx : Types.transaction) ->
+                let ctx : context = info.ctx in
+                Query.tx_inputs ctx.snapshot tx.tx_id
+                |> List.map (fun (i : Types.input) -> (i.in_spent_tx_id, i.in_spent_vout))
+                |> Loader.load_all ctx.outputs
+                |> Lwt.map Result.ok);
           ])
 
-  (** Output type in GraphQL *)
-  let output =
+  (** Block type in GraphQL *)
+  let block =
     Schema.(
-      obj "Output"
+      obj "Block"
         ~fields:
           [
-            field "txId" ~typ:(non_null int) ~args:Arg.[]
-              ~resolve:(fun _ (o : Types.output) -> o.out_tx_id);
-            field "vout" ~typ:(non_null int) ~args:Arg.[]
-              ~resolve:(fun _ (o : Types.output) -> o.out_vout);
-            field "value" ~typ:(non_null string) ~args:Arg.[]
-              ~resolve:(fun _ (o : Types.output) -> Int64.to_string o.out_value);
-            field "valueBtc" ~typ:(non_null float) ~args:Arg.[]
-              ~resolve:(fun _ (o : Types.output) ->
-                Query.satoshis_to_btc o.out_value);
-            field "scriptType" ~typ:(non_null string) ~args:Arg.[]
-              ~resolve:(fun _ (o : Types.output) -> o.out_script_type);
+            field "height" ~typ:(non_null int) ~args:Arg.[]
+              ~resolve:(fun _ (b : Types.block) -> b.height);
+            field "hash" ~typ:(non_null string) ~args:Arg.[]
+              ~resolve:(fun _ (b : Types.block) -> b.hash);
+            field "timestamp" ~typ:(non_null string) ~args:Arg.[]
+              ~resolve:(fun _ (b : Types.block) -> Int64.to_string b.timestamp);
+            field "nonce" ~typ:(non_null string) ~args:Arg.[]
+              ~resolve:(fun _ (b : Types.block) -> Int64.to_string b.nonce);
+            field "bits" ~typ:(non_null string) ~args:Arg.[]
+              ~resolve:(fun _ (b : Types.block) -> Int64.to_string b.bits);
+            field "version" ~typ:(non_null int) ~args:Arg.[]
+              ~resolve:(fun _ (b : Types.block) -> b.version);
+            io_field "transactions" ~typ:(non_null (list (non_null transaction)))
+              ~args:Arg.[]
+              ~resolve:(fun info (b : Types.block) ->
+                let ctx : context = info.ctx in
+                Lwt.map Result.ok
+                  (Loader.load_all ctx.transactions
+                     (Query.block_tx_ids ctx.snapshot b.height)));
           ])
 
-  (** Address type in GraphQL *)
-  let address =
+  (** Address search match in GraphQL: an address string and its ID *)
+  let address_match =
     Schema.(
-      obj "Address"
+      obj "AddressMatch"
         ~fields:
           [
             field "address" ~typ:(non_null string) ~args:Arg.[]
-              ~resolve:(fun _ (a : Types.address) -> a.addr_str);
-            field "type" ~typ:(non_null string) ~args:Arg.[]
-              ~resolve:(fun _ (a : Types.address) -> a.addr_type);
+              ~resolve:(fun _ (addr, _) -> addr);
+            field "addressId" ~typ:(non_null string) ~args:Arg.[]
+              ~resolve:(fun _ (_, id) -> id);
+          ])
+
+  (** Rich list entry in GraphQL: an address ID and its balance *)
+  let address_balance =
+    Schema.(
+      obj "AddressBalance"
+        ~fields:
+          [
+            field "addressId" ~typ:(non_null string) ~args:Arg.[]
+              ~resolve:(fun _ (id, _) -> id);
+            field "balance" ~typ:(non_null string) ~args:Arg.[]
+              ~resolve:(fun _ (_, b) -> Int64.to_string b);
+            field "balanceBtc" ~typ:(non_null float) ~args:Arg.[]
+              ~resolve:(fun _ (_, b) -> Query.satoshis_to_btc b);
           ])
 
   (** Store info type in GraphQL *)
@@ -91,35 +262,98 @@ module Schema = struct
               ~resolve:(fun _ height -> height);
           ])
 
-  (** Create the query schema with a store reference *)
-  let make_schema store =
+  (** Create the query schema. [indexes] serve lookups by hash (see
+      {!Hash_index}) and [snapshot] the rich list. Every other field reads
+      the request's {!context}, so one response reflects one commit; index
+      hits are checked against it, as the index may be built from another. *)
+  let make_schema ?(indexes = Hash_index.no_indexes) ?snapshot () =
     Schema.(
       schema
         [
           field "block" ~typ:block
             ~args:Arg.[ arg "height" ~typ:(non_null int) ]
-            ~resolve:(fun _ () height -> Query.get_block store height);
-          field "transaction" ~typ:transaction
+            ~resolve:(fun info () height ->
+              let ctx : context = info.ctx in
+              Query.get_block ctx.snapshot height);
+          field "blockByHash" ~typ:block
+            ~args:Arg.[ arg "hash" ~typ:(non_null string) ]
+            ~resolve:(fun info () hash ->
+              let ctx : context = info.ctx in
+              Option.bind indexes.Hash_index.block_index (fun idx ->
+                  Hash_index.find_block idx ctx.snapshot hash));
+          io_field "transaction" ~typ:transaction
             ~args:Arg.[ arg "txId" ~typ:(non_null int) ]
-            ~resolve:(fun _ () tx_id -> Query.get_transaction store tx_id);
-          field "output" ~typ:output
+            ~resolve:(fun info () tx_id ->
+              let ctx : context = info.ctx in
+              Lwt.map Result.ok (Loader.load ctx.transactions tx_id));
+          field "transactionByHash" ~typ:transaction
+            ~args:Arg.[ arg "hash" ~typ:(non_null string) ]
+            ~resolve:(fun info () hash ->
+              let ctx : context = info.ctx in
+              Option.bind indexes.Hash_index.tx_index (fun idx ->
+                  Hash_index.find_tx idx ctx.snapshot hash));
+          io_field "output" ~typ:output
             ~args:
               Arg.[ arg "txId" ~typ:(non_null int); arg "vout" ~typ:(non_null int) ]
-            ~resolve:(fun _ () tx_id vout -> Query.get_output store tx_id vout);
-          field "address" ~typ:address
+            ~resolve:(fun info () tx_id vout ->
+              let ctx : context = info.ctx in
+              Lwt.map Result.ok (Loader.load ctx.outputs (tx_id, vout)));
+          io_field "address" ~typ:address
             ~args:Arg.[ arg "addressId" ~typ:(non_null string) ]
-            ~resolve:(fun _ () addr_id -> Query.get_address store addr_id);
-          field "blockTransactions"
+            ~resolve:(fun info () addr_id ->
+              let ctx : context = info.ctx in
+              Lwt.map Result.ok (Loader.load ctx.addresses addr_id));
+          io_field "addressId" ~typ:string
+            ~args:Arg.[ arg "address" ~typ:(non_null string) ]
+            ~resolve:(fun info () addr ->
+              let ctx : context = info.ctx in
+              match
+                Option.bind indexes.Hash_index.address_index (fun idx ->
+                    Hash_index.Address.find idx addr)
+              with
+              | None -> Lwt.return_ok None
+              | Some id ->
+                  Lwt.map
+                    (fun found -> Ok (Option.map (fun _ -> id) found))
+                    (Loader.load ctx.addresses id));
+          io_field "addressSearch" ~typ:(non_null (list (non_null address_match)))
+            ~args:
+              Arg.
+                [
+                  arg "prefix" ~typ:(non_null string);
+                  arg "limit" ~typ:int;
+                ]
+            ~resolve:(fun info () prefix limit ->
+              let ctx : context = info.ctx in
+              let matches =
+                match indexes.Hash_index.address_index with
+                | Some idx -> Hash_index.Address.search ?limit idx prefix
+                | None -> []
+              in
+              Lwt.map
+                (fun found -> Ok (List.filter_map Fun.id found))
+                (Lwt.all
+                   (List.map
+                      (fun ((_, id) as m) ->
+                        Lwt.map (Option.map (fun _ -> m)) (Loader.load ctx.addresses id))
+                      matches)));
+          io_field "blockTransactions"
             ~typ:(non_null (list (non_null transaction)))
             ~args:Arg.[ arg "height" ~typ:(non_null int) ]
-            ~resolve:(fun _ () height -> Query.block_transactions store height);
+            ~resolve:(fun info () height ->
+              let ctx : context = info.ctx in
+              Lwt.map Result.ok
+                (Loader.load_all ctx.transactions (Query.block_tx_ids ctx.snapshot height)));
           field "addressBalance" ~typ:(non_null string)
             ~args:Arg.[ arg "addressId" ~typ:(non_null string) ]
-            ~resolve:(fun _ () addr_id ->
-              Int64.to_string (Query.address_balance store addr_id));
+            ~resolve:(fun info () addr_id ->
+              let ctx : context = info.ctx in
+              Int64.to_string (Query.address_balance ctx.snapshot addr_id));
           field "addressOutputs" ~typ:(non_null (list (non_null output)))
             ~args:Arg.[ arg "addressId" ~typ:(non_null string) ]
-            ~resolve:(fun _ () addr_id -> Query.address_outputs store addr_id);
+            ~resolve:(fun info () addr_id ->
+              let ctx : context = info.ctx in
+              Query.address_outputs ctx.snapshot addr_id);
           field "blockChain" ~typ:(non_null (list (non_null block)))
             ~args:
               Arg.
@@ -127,9 +361,21 @@ module Schema = struct
                   arg "startHeight" ~typ:(non_null int);
                   arg "count" ~typ:(non_null int);
                 ]
-            ~resolve:(fun _ () start count -> Query.block_chain store start count);
+            ~resolve:(fun info () start count ->
+              let ctx : context = info.ctx in
+              Query.block_chain ctx.snapshot start count);
+          field "richList" ~typ:(non_null (list (non_null address_balance)))
+            ~args:Arg.[ arg "limit" ~typ:int ]
+            ~resolve:(fun _ () limit ->
+              match snapshot with
+              | Some snap ->
+                  Snapshot.Reader.top_balances snap
+                    (max 0 (Option.value limit ~default:100))
+              | None -> []);
           field "storeInfo" ~typ:(non_null store_info) ~args:Arg.[]
-            ~resolve:(fun _ () -> Query.last_block_height store);
+            ~resolve:(fun info () ->
+              let ctx : context = info.ctx in
+              Query.last_block_height ctx.snapshot);
         ])
 end
 
@@ -167,9 +413,20 @@ let graphiql_html =
 </body>
 </html>|}
 
-(** Start the GraphQL server *)
-let start_server ~port store =
-  let schema = Schema.make_schema store in
+(** Start the GraphQL server. With [cache] (a {!Result_cache} directory),
+    responses are cached per head commit, query and variables, and the
+    commits the hash indexes and the snapshot were built from: lookups by
+    hash or address and [richList] answer from those, which are rebuilt
+    apart from the head. *)
+let start_server ?indexes ?snapshot ?cache ~port store =
+  let schema = Schema.make_schema ?indexes ?snapshot () in
+  let sidecar_params =
+    [
+      ( "index",
+        Option.bind indexes (fun i -> i.Hash_index.built_from) |> Option.value ~default:"" );
+      ("snapshot", Option.fold ~none:"" ~some:(fun s -> s.Snapshot.Reader.commit) snapshot);
+    ]
+  in
   let callback _conn req body =
     let open Lwt.Syntax in
     let uri = Cohttp.Request.uri req in
@@ -184,6 +441,17 @@ let start_server ~port store =
             let variables =
               Yojson.Basic.Util.(json |> member "variables" |> to_option Fun.id)
             in
+            let cache_params =
+              [
+                ( "operationName",
+                  Yojson.Basic.Util.(
+                    json |> member "operationName" |> to_string_option)
+                  |> Option.value ~default:"" );
+                ( "variables",
+                  Option.fold ~none:"" ~some:Yojson.Basic.to_string variables );
+              ]
+              @ sidecar_params
+            in
             match query with
             | None ->
                 Cohttp_lwt_unix.Server.respond_string ~status:`Bad_request
@@ -201,15 +469,32 @@ let start_server ~port store =
                     Cohttp_lwt_unix.Server.respond_string ~status:`Bad_request
                       ~body:("Parse error: " ^ err) ()
                 | Ok doc ->
-                    let* result =
-                      Graphql_lwt.Schema.execute schema () ?variables doc
+                    let ctx = context store in
+                    let cache =
+                      Option.bind cache (fun dir -> Result_cache.at_head dir ctx.snapshot)
                     in
-                    let body =
-                      match result with
-                      | Ok (`Response data) -> Yojson.Basic.to_string data
-                      | Ok (`Stream _) ->
-                          {|{"errors":[{"message":"Streaming not supported"}]}|}
-                      | Error err -> Yojson.Basic.to_string err
+                    let cache_query = "graphql " ^ query in
+                    let* body =
+                      match
+                        Option.bind cache (fun c ->
+                            Result_cache.find c ~query:cache_query ~params:cache_params)
+                      with
+                      | Some body -> Lwt.return body
+                      | None ->
+                          let+ result =
+                            Graphql_lwt.Schema.execute schema ctx ?variables doc
+                          in
+                          (match (result, cache) with
+                          | Ok (`Response data), Some c
+                            when Yojson.Basic.Util.member "errors" data = `Null ->
+                              Result_cache.add c ~query:cache_query ~params:cache_params
+                                (Yojson.Basic.to_string data)
+                          | _ -> ());
+                          match result with
+                          | Ok (`Response data) -> Yojson.Basic.to_string data
+                          | Ok (`Stream _) ->
+                              {|{"errors":[{"message":"Streaming not supported"}]}|}
+                          | Error err -> Yojson.Basic.to_string err
                     in
                     Cohttp_lwt_unix.Server.respond_string ~status:`OK
                       ~headers:
@@ -0,0 +1,509 @@
+(** Sorted, mmappable lookup indexes kept next to the store.
+
+    The store keys transactions by BlockSci [tx_id] and blocks by height,
+    so resolving a hash would otherwise mean scanning every [tx/] or
+    [block/] record. An index file holds
+    the first 8 bytes of each hash, read as a big-endian u64 so that the
+    order matches the hex order, and the matching ID, sorted by prefix:
+
+    {v
+    magic    "BSHIDX01"
+    count    u64
+    prefix   u64 [count]   sorted, unsigned
+    id       u32 [count]
+    v}
+
+    Hashes are uniformly distributed, so lookups interpolate on the prefix
+    and touch a couple of pages of the mapped file. Prefixes may collide;
+    each candidate is checked against the full hash in the store.
+
+    Address strings are not uniform and need prefix search, so they get a
+    front-coded index instead (see {!Address}). *)
+
+open Bigarray
+
+let magic = "BSHIDX01"
+let header_size = 16
+
+(** Default index directory for a store path. *)
+let dir_of_store store_path = store_path ^ ".index"
+
+let tx_hash_file = "tx_hash.idx"
+let block_hash_file = "block_hash.idx"
+
+type t = {
+  prefixes : (int64, int64_elt, c_layout) Array1.t;
+  ids : (int32, int32_elt, c_layout) Array1.t;
+}
+
+(** Prefix of a hex hash, or [None] if it is shorter than 16 digits. *)
+let prefix_of_hash hash =
+  if String.length hash < 16 then None
+  else Int64.of_string_opt ("0x" ^ String.sub hash 0 16)
+
+(** {1 Building} *)
+
+(** Write [(prefix, id)] entries to [file], sorting them first. The file
+    is written beside its final name and renamed, so readers never see a
+    partial index. *)
+let write file (entries : (int64 * int) array) =
+  Array.stable_sort (fun (a, _) (b, _) -> Int64.unsigned_compare a b) entries;
+  let tmp = file ^ ".tmp" in
+  let oc = open_out_bin tmp in
+  let buf = Bytes.create 8 in
+  let u64 v =
+    Bytes.set_int64_le buf 0 v;
+    output oc buf 0 8
+  in
+  output_string oc magic;
+  u64 (Int64.of_int (Array.length entries));
+  Array.iter (fun (p, _) -> u64 p) entries;
+  Array.iter
+    (fun (_, id) ->
+      Bytes.set_int32_le buf 0 (Int32.of_int id);
+      output oc buf 0 4)
+    entries;
+  close_out oc;
+  Sys.rename tmp file
+
+let rec mkdir_p dir =
+  if not (Sys.file_exists dir) then begin
+    mkdir_p (Filename.dirname dir);
+    Sys.mkdir dir 0o755
+  end
+
+(** Index the hash of every transaction under [store]'s head into [dir]. *)
+let build_tx store dir =
+  mkdir_p dir;
+  let entries =
+    Store.list store [ "tx" ]
+    |> List.filter_map int_of_string_opt
+    |> List.filter_map (fun tx_id ->
+           match Query.get_transaction store tx_id with
+           | Some (tx : Types.transaction) ->
+               Option.map (fun p -> (p, tx_id)) (prefix_of_hash tx.tx_hash)
+           | None -> None)
+    |> Array.of_list
+  in
+  write (Filename.concat dir tx_hash_file) entries;
+  Printf.printf "Indexed %d transaction hashes\n%!" (Array.length entries)
+
+(** Index the hash of every block under [store]'s head into [dir]. *)
+let build_block store dir =
+  mkdir_p dir;
+  let entries =
+    List.init (Query.last_block_height store + 1) Fun.id
+    |> List.filter_map (fun height ->
+           match Query.get_block store height with
+           | Some (b : Types.block) ->
+               Option.map (fun p -> (p, height)) (prefix_of_hash b.hash)
+           | None -> None)
+    |> Array.of_list
+  in
+  write (Filename.concat dir block_hash_file) entries;
+  Printf.printf "Indexed %d block hashes\n%!" (Array.length entries)
+
+(** {1 Lookup} *)
+
+(* [n] elements of [kind] at byte [pos] of [fd]; empty arrays are not
+   mapped, since a zero-length mapping fails. *)
+let map_array fd kind pos n =
+  if n = 0 then Array1.create kind c_layout 0
+  else
+    array1_of_genarray
+      (Unix.map_file fd ~pos:(Int64.of_int pos) kind c_layout false [| n |])
+
+(* Open [file], check its [magic] and pass the fd, its size and the header
+   (of [header_size] bytes) to [f]. *)
+let with_index_file file ~magic ~header_size f =
+  if not (Sys.file_exists file) then None
+  else
+    let fd = Unix.openfile file [ Unix.O_RDONLY ] 0 in
+    Fun.protect
+      ~finally:(fun () -> Unix.close fd)
+      (fun () ->
+        let header = Bytes.create header_size in
+        if
+          Unix.read fd header 0 header_size <> header_size
+          || Bytes.sub_string header 0 8 <> magic
+        then None
+        else f fd (Unix.fstat fd).st_size header)
+
+(** Map an index file, or [None] if it is missing or malformed. *)
+let open_file file =
+  with_index_file file ~magic ~header_size (fun fd size header ->
+      let n = Int64.to_int (Bytes.get_int64_le header 8) in
+      if size <> header_size + (12 * n) then None
+      else
+        Some
+          {
+            prefixes = map_array fd int64 header_size n;
+            ids = map_array fd int32 (header_size + (8 * n)) n;
+          })
+
+(** Open the transaction hash index in [dir]. *)
+let open_tx dir = open_file (Filename.concat dir tx_hash_file)
+
+(** Open the block hash index in [dir]. *)
+let open_block dir = open_file (Filename.concat dir block_hash_file)
+
+let length t = Array1.dim t.prefixes
+
+let unsigned_to_float x =
+  let f = Int64.to_float x in
+  if f < 0. then f +. 18446744073709551616. else f
+
+(** First entry whose prefix is not below [prefix]. Interpolation steps
+    alternate with bisection, so skewed prefixes still cost O(log n). *)
+let lower_bound t prefix =
+  let below i = Int64.unsigned_compare t.prefixes.{i} prefix < 0 in
+  let rec go lo hi interpolate =
+    if hi - lo <= 8 then
+      let rec scan i = if i < hi && below i then scan (i + 1) else i in
+      scan lo
+    else
+      let mid =
+        if interpolate then
+          let a = unsigned_to_float t.prefixes.{lo}
+          and b = unsigned_to_float t.prefixes.{hi - 1}
+          and p = unsigned_to_float prefix in
+          if b <= a then lo + ((hi - lo) / 2)
+          else
+            let span = float_of_int (hi - 1 - lo) in
+            let off = (p -. a) /. (b -. a) *. span in
+            lo + int_of_float (Float.min span (Float.max 0. off))
+        else lo + ((hi - lo) / 2)
+      in
+      if below mid then go (mid + 1) hi (not interpolate)
+      else go lo mid (not interpolate)
+  in
+  go 0 (length t) true
+
+(** IDs whose hash shares the prefix of [hash]. *)
+let candidates t hash =
+  match prefix_of_hash hash with
+  | None -> []
+  | Some prefix ->
+      let n = length t in
+      let rec collect i acc =
+        if i < n && Int64.equal t.prefixes.{i} prefix then
+          collect (i + 1) ((Int32.to_int t.ids.{i} land 0xFFFF_FFFF) :: acc)
+        else List.rev acc
+      in
+      collect (lower_bound t prefix) []
+
+let same_hash a b = String.lowercase_ascii a = String.lowercase_ascii b
+
+(** Record with hash [hash], fetching candidates with [get]. *)
+let find t ~get ~hash_of hash =
+  List.find_map
+    (fun id ->
+      match get id with
+      | Some r when same_hash (hash_of r) hash -> Some r
+      | _ -> None)
+    (candidates t hash)
+
+(** Transaction with hash [hash]. *)
+let find_tx t store hash =
+  find t ~get:(Query.get_transaction store)
+    ~hash_of:(fun (tx : Types.transaction) -> tx.tx_hash)
+    hash
+
+(** Block with hash [hash]. *)
+let find_block t store hash =
+  find t ~get:(Query.get_block store)
+    ~hash_of:(fun (b : Types.block) -> b.hash)
+    hash
+
+(** {1 Address index} *)
+
+(** Address string to address ID, as sorted front-coded blocks:
+
+    {v
+    magic      "BSADDR01"
+    count      u64
+    blocks     u64
+    block_off  u64 [blocks + 1]   offset of each block in data
+    data       blocks of up to 16 entries
+    v}
+
+    The first entry of a block is [len key len id]; the others keep only
+    what differs from the previous key: [shared len suffix len id].
+    Lengths are LEB128 varints. Sorted addresses share long prefixes, so
+    the file is a fraction of the raw strings. A binary search over the
+    block heads and a scan of one or two blocks answers both exact and
+    prefix queries. *)
+module Address = struct
+  let magic = "BSADDR01"
+  let file = "addresses.idx"
+  let header_size = 24
+  let block_size = 16
+
+  type t = {
+    offsets : (int64, int64_elt, c_layout) Array1.t;
+    data : (char, int8_unsigned_elt, c_layout) Array1.t;
+  }
+
+  let shared_prefix a b =
+    let n = min (String.length a) (String.length b) in
+    let rec go i = if i < n && a.[i] = b.[i] then go (i + 1) else i in
+    go 0
+
+  (** Write [(address, id)] entries to [path], sorting them first. *)
+  let write path (entries : (string * string) array) =
+    Array.stable_sort (fun (a, _) (b, _) -> String.compare a b) entries;
+    let data = Buffer.create (1 lsl 16) in
+    let offsets = ref [] in
+    Array.iteri
+      (fun i (key, id) ->
+        if i mod block_size = 0 then begin
+          offsets := Buffer.length data :: !offsets;
+          Types.add_varint data (String.length key);
+          Buffer.add_string data key
+        end
+        else begin
+          let shared = shared_prefix (fst entries.(i - 1)) key in
+          Types.add_varint data shared;
+          Types.add_varint data (String.length key - shared);
+          Buffer.add_substring data key shared (String.length key - shared)
+        end;
+        Types.add_varint data (String.length id);
+        Buffer.add_string data id)
+      entries;
+    let offsets = List.rev (Buffer.length data :: !offsets) in
+    let tmp = path ^ ".tmp" in
+    let oc = open_out_bin tmp in
+    let buf = Bytes.create 8 in
+    let u64 v =
+      Bytes.set_int64_le buf 0 (Int64.of_int v);
+      output oc buf 0 8
+    in
+    output_string oc magic;
+    u64 (Array.length entries);
+    u64 (List.length offsets - 1);
+    List.iter u64 offsets;
+    Buffer.output_buffer oc data;
+    close_out oc;
+    Sys.rename tmp path
+
+  (** Map the address index in [dir], or [None]. *)
+  let open_ dir =
+    with_index_file (Filename.concat dir file) ~magic ~header_size
+      (fun fd size header ->
+        let blocks = Int64.to_int (Bytes.get_int64_le header 16) in
+        let data_pos = header_size + (8 * (blocks + 1)) in
+        if blocks < 0 || blocks > size / 8 || size < data_pos then None
+        else
+          let offsets = map_array fd int64 header_size (blocks + 1) in
+          let data_len = size - data_pos in
+          (* Block offsets must rise and end at the data length *)
+          let rec valid b =
+            b >= blocks
+            || (Int64.compare offsets.{b} 0L >= 0
+               && Int64.compare offsets.{b} offsets.{b + 1} <= 0
+               && valid (b + 1))
+          in
+          if Int64.to_int offsets.{blocks} <> data_len || not (valid 0) then None
+          else Some { offsets; data = map_array fd char data_pos data_len })
+
+  let blocks t = Array1.dim t.offsets - 1
+  let block_start t b = Int64.to_int t.offsets.{b}
+
+  let read_varint data pos =
+    let rec go pos shift acc =
+      let b = Char.code data.{pos} in
+      let acc = acc lor ((b land 0x7F) lsl shift) in
+      if b < 0x80 then (acc, pos + 1) else go (pos + 1) (shift + 7) acc
+    in
+    go pos 0 0
+
+  let read_string data pos len = String.init len (fun i -> data.{pos + i})
+
+  (* First key of block [b] *)
+  let head t b =
+    let len, pos = read_varint t.data (block_start t b) in
+    read_string t.data pos len
+
+  (* Entries from the start of block [b] to the end of the index *)
+  let entries_from t b =
+    let rec block b () =
+      if b >= blocks t then Seq.Nil else entry b (block_start t b) true "" ()
+    and entry b pos first prev () =
+      if pos >= block_start t (b + 1) then block (b + 1) ()
+      else
+        let shared, pos = if first then (0, pos) else read_varint t.data pos in
+        let len, pos = read_varint t.data pos in
+        let key = String.sub prev 0 shared ^ read_string t.data pos len in
+        let id_len, pos = read_varint t.data (pos + len) in
+        let id = read_string t.data pos id_len in
+        Seq.Cons ((key, id), entry b (pos + id_len) false key)
+    in
+    block b
+
+  (* Entries whose address is not below [key], in order *)
+  let seek t key =
+    let rec first_not_below lo hi =
+      if lo >= hi then lo
+      else
+        let mid = (lo + hi) / 2 in
+        if String.compare (head t mid) key < 0 then first_not_below (mid + 1) hi
+        else first_not_below lo mid
+    in
+    let b = first_not_below 0 (blocks t) in
+    entries_from t (max 0 (b - 1))
+    |> Seq.drop_while (fun (k, _) -> String.compare k key < 0)
+
+  (** Address ID of the address string [addr]. *)
+  let find t addr =
+    match seek t addr () with
+    | Seq.Cons ((k, id), _) when k = addr -> Some id
+    | _ -> None
+
+  (** Up to [limit] [(address, id)] pairs whose address starts with
+      [prefix], in address order. *)
+  let search ?(limit = 20) t prefix =
+    seek t prefix
+    |> Seq.take_while (fun (k, _) -> String.starts_with ~prefix k)
+    |> Seq.take (max 0 limit)
+    |> List.of_seq
+end
+
+(** Index every address string under [store]'s head into [dir]. *)
+let build_address store dir =
+  mkdir_p dir;
+  let entries =
+    Store.list store [ "address" ]
+    |> List.filter_map (fun id ->
+           match Query.get_address store id with
+           | Some (a : Types.address) -> Some (a.addr_str, id)
+           | None -> None)
+    |> Array.of_list
+  in
+  Address.write (Filename.concat dir Address.file) entries;
+  Printf.printf "Indexed %d addresses\n%!" (Array.length entries)
+
+(** {1 Building and updating} *)
+
+(* The commit the indexes in a directory were last built or updated from *)
+let commit_file = "commit"
+
+let indexed_commit dir =
+  match open_in (Filename.concat dir commit_file) with
+  | exception Sys_error _ -> None
+  | ic ->
+      let hash = try Some (String.trim (input_line ic)) with End_of_file -> None in
+      close_in ic;
+      hash
+
+let save_commit store dir =
+  Option.iter
+    (fun hash ->
+      let oc = open_out (Filename.concat dir commit_file) in
+      output_string oc (hash ^ "\n");
+      close_out oc)
+    (Store.head_hash store)
+
+(** Rebuild every index of [store] in [dir]. Reads every transaction,
+    block and address record. *)
+let build store dir =
+  build_tx store dir;
+  build_block store dir;
+  build_address store dir;
+  save_commit store dir
+
+(* Keys directly under [top] whose leaf differs in [diff] *)
+let changed diff top =
+  let keys = Hashtbl.create 64 in
+  List.iter
+    (fun (path, _) ->
+      match path with
+      | [ t; key ] when t = top -> Hashtbl.replace keys key ()
+      | _ -> ())
+    diff;
+  keys
+
+(* Entries of [t], without those whose ID changed, and the [fresh] ones *)
+let merge t keys fresh =
+  let kept =
+    List.init (length t) (fun i -> (t.prefixes.{i}, Int32.to_int t.ids.{i} land 0xFFFF_FFFF))
+    |> List.filter (fun (_, id) -> not (Hashtbl.mem keys (string_of_int id)))
+  in
+  Array.of_list (fresh @ kept)
+
+(* [(entry)] for each changed key whose record is still there *)
+let fresh keys entry =
+  Hashtbl.fold
+    (fun key () acc -> match entry key with Some e -> e :: acc | None -> acc)
+    keys []
+
+(** Bring the indexes in [dir] to [store]'s head. The tree of the commit
+    they were last built from is diffed against the head's, which only
+    visits subtrees that differ. Each index then keeps its entries for
+    unchanged IDs and gains those of the records added or changed since,
+    so an import or reorg reads only the records it touched. Falls back to
+    {!build} without a previous build to start from. *)
+let update store dir =
+  let previous = Option.bind (indexed_commit dir) (History.commit_of_hash store) in
+  match
+    (previous, Store.Store.Head.find store, open_tx dir, open_block dir, Address.open_ dir)
+  with
+  | Some old, Some head, Some tx_index, Some block_index, Some address_index ->
+      let diff =
+        Store.Store.Tree.diff (Store.Store.Commit.tree old) (Store.Store.Commit.tree head)
+      in
+      let txs = changed diff "tx"
+      and blocks = changed diff "block"
+      and addresses = changed diff "address" in
+      let hash_entry get hash_of key =
+        Option.bind (int_of_string_opt key) (fun id ->
+            Option.bind (get id) (fun r ->
+                Option.map (fun p -> (p, id)) (prefix_of_hash (hash_of r))))
+      in
+      write (Filename.concat dir tx_hash_file)
+        (merge tx_index txs
+           (fresh txs
+              (hash_entry (Query.get_transaction store) (fun (t : Types.transaction) ->
+                   t.tx_hash))));
+      write (Filename.concat dir block_hash_file)
+        (merge block_index blocks
+           (fresh blocks
+              (hash_entry (Query.get_block store) (fun (b : Types.block) -> b.hash))));
+      let kept =
+        Address.entries_from address_index 0
+        |> Seq.filter (fun (_, id) -> not (Hashtbl.mem addresses id))
+        |> List.of_seq
+      in
+      let added =
+        fresh addresses (fun id ->
+            Option.map
+              (fun (a : Types.address) -> (a.addr_str, id))
+              (Query.get_address store id))
+      in
+      Address.write (Filename.concat dir Address.file) (Array.of_list (added @ kept));
+      save_commit store dir;
+      Printf.printf "Updated hash indexes: %d txs, %d blocks, %d addresses changed\n%!"
+        (Hashtbl.length txs) (Hashtbl.length blocks) (Hashtbl.length addresses)
+  | _ -> build store dir
+
+(** {1 Index sets} *)
+
+(** The indexes of a store, each [None] until it has been built, and the
+    commit they were built from. *)
+type indexes = {
+  tx_index : t option;
+  block_index : t option;
+  address_index : Address.t option;
+  built_from : string option;
+}
+
+let no_indexes =
+  { tx_index = None; block_index = None; address_index = None; built_from = None }
+
+(** Open every index in [dir]. *)
+let open_dir dir =
+  {
+    tx_index = open_tx dir;
+    block_index = open_block dir;
+    address_index = Address.open_ dir;
+    built_from = indexed_commit dir;
+  }
@@ -0,0 +1,92 @@
+(** Height → commit index for point-in-time queries.
+
+    [import --commit-per-block] commits once per new block, so the commit
+    it made for height [h] is the chain as of [h]: every record and index
+    entry of blocks up to [h] and nothing later. The hashes of those
+    commits are appended to [<store>.heights], one line per block:
+
+    {v
+    <height>\t<commit hash>
+    v}
+
+    A later line for the same height wins, so re-importing a height after
+    a reorg repoints it. Queries "as of block H" check that commit out as a
+    read-only store ({!at}) and run unchanged. The C benchmark reads the
+    same file for [--at H]. *)
+
+(** Default index file for a store path. *)
+let file_of_store store_path = store_path ^ ".heights"
+
+let commit_hash c =
+  Irmin.Type.to_string Store.Store.Hash.t (Store.Store.Commit.hash c)
+
+(** Append [(height, commit hash)] entries to [file]. *)
+let record file entries =
+  let oc = open_out_gen [ Open_append; Open_creat; Open_text ] 0o644 file in
+  List.iter (fun (height, hash) -> Printf.fprintf oc "%d\t%s\n" height hash) entries;
+  close_out oc
+
+(** Drop the entries for heights [from] and above, whose commits a reorg
+    took off the branch. *)
+let truncate file ~from =
+  match open_in file with
+  | exception Sys_error _ -> ()
+  | ic ->
+      let dropped line =
+        match String.split_on_char '\t' line with
+        | height :: _ -> (
+            match int_of_string_opt height with Some h -> h >= from | None -> false)
+        | [] -> false
+      in
+      let kept = ref [] in
+      (try
+         while true do
+           let line = input_line ic in
+           if not (dropped line) then kept := line :: !kept
+         done
+       with End_of_file -> ());
+      close_in ic;
+      let tmp = file ^ ".tmp" in
+      let oc = open_out tmp in
+      List.iter (fun line -> output_string oc (line ^ "\n")) (List.rev !kept);
+      close_out oc;
+      Sys.rename tmp file
+
+(** Height → commit hash table of [file], empty if it doesn't exist. *)
+let load file =
+  let heights = Hashtbl.create 1024 in
+  (match open_in file with
+  | exception Sys_error _ -> ()
+  | ic ->
+      (try
+         while true do
+           match String.split_on_char '\t' (input_line ic) with
+           | [ height; hash ] ->
+               Option.iter
+                 (fun h -> Hashtbl.replace heights h hash)
+                 (int_of_string_opt height)
+           | _ -> ()
+         done
+       with End_of_file -> ());
+      close_in ic);
+  heights
+
+(** Hash of the commit for [height], if it was recorded. *)
+let find file height = Hashtbl.find_opt (load file) height
+
+(** Commit with the hash [hash] in [store]'s repository. *)
+let commit_of_hash store hash =
+  match Irmin.Type.of_string Store.Store.Hash.t hash with
+  | Error _ -> None
+  | Ok h -> Store.Store.Commit.of_hash (Store.Store.repo store) h
+
+(** [store] as of block [height]: a temporary store whose head is the
+    commit recorded for [height]. It shares the repository, so reads cost
+    what they cost on the main branch. [None] if [height] has no commit. *)
+let at store file height =
+  Option.bind (find file height) (fun hash ->
+      Option.map Store.Store.of_commit (commit_of_hash store hash))
+
+(** Balance of [addr] as of block [height] (see {!Query.address_balance}). *)
+let address_balance_at store file height addr =
+  Option.map (fun s -> Query.address_balance s addr) (at store file height)
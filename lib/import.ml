@@ -24,7 +24,18 @@ let with_csv_stream path f =
       let _ = Csv.next csv in
       f csv)
 
-let import_blocks batch dir =
+(* Rows of the export to import: all of them, or for a reorg only the
+   blocks from [height] up and their transactions, whose IDs
+   import_transactions collects *)
+type scope = All | From of { height : int; txs : (int, unit) Hashtbl.t }
+
+let keeps_block scope height =
+  match scope with All -> true | From s -> height >= s.height
+
+let keeps_tx scope tx_id =
+  match scope with All -> true | From s -> Hashtbl.mem s.txs tx_id
+
+let import_blocks ~scope batch dir =
   let path = Eio.Path.(dir / "nodes" / "blocks.csv") in
   let total = ref 0 in
   let new_count = ref 0 in
@@ -36,7 +47,8 @@ let import_blocks batch dir =
         match row with
         | [ _block_id; height; hash; timestamp; nonce; bits; version; _label ] ->
             let height = int_of_string height in
-            if not (Store.Batch.mem batch (Store.block_path height)) then begin
+            if keeps_block scope height && not (Store.Batch.mem batch (Store.block_path height))
+            then begin
               let block : block =
                 {
                   height;
@@ -56,7 +68,7 @@ let import_blocks batch dir =
   Printf.printf "\r";
   report_progress "blocks" !total !new_count
 
-let import_transactions batch dir =
+let import_transactions ~scope batch dir =
   let path = Eio.Path.(dir / "nodes" / "transactions.csv") in
   let total = ref 0 in
   let new_count = ref 0 in
@@ -68,7 +80,12 @@ let import_transactions batch dir =
         match row with
         | [ tx_id; hash; locktime; version; fee; size; weight; block_height; _label ] ->
             let tx_id = int_of_string tx_id in
-            if not (Store.Batch.mem batch (Store.tx_path tx_id)) then begin
+            let block_height = int_of_string block_height in
+            (match scope with
+            | From s when block_height >= s.height -> Hashtbl.replace s.txs tx_id ()
+            | _ -> ());
+            if keeps_block scope block_height && not (Store.Batch.mem batch (Store.tx_path tx_id))
+            then begin
               let tx : transaction =
                 {
                   tx_id;
@@ -78,7 +95,7 @@ let import_transactions batch dir =
                   tx_fee = Int64.of_string fee;
                   tx_size = int_of_string size;
                   tx_weight = int_of_string weight;
-                  tx_block_height = int_of_string block_height;
+                  tx_block_height = block_height;
                 }
               in
               Store.Batch.set batch (Store.tx_path tx.tx_id) (Transaction tx);
@@ -90,7 +107,7 @@ let import_transactions batch dir =
   Printf.printf "\r";
   report_progress "transactions" !total !new_count
 
-let import_outputs batch dir =
+let import_outputs ~scope batch dir =
   let path = Eio.Path.(dir / "nodes" / "outputs.csv") in
   let total = ref 0 in
   let new_count = ref 0 in
@@ -102,7 +119,9 @@ let import_outputs batch dir =
         match row with
         | [ output_id; value; script_type; _label ] ->
             let tx_id, vout = parse_output_id output_id in
-            if not (Store.Batch.mem batch (Store.output_path tx_id vout)) then begin
+            if keeps_tx scope tx_id && not (Store.Batch.mem batch (Store.output_path tx_id vout))
+            then begin
+              ignore (Dict.code Dict.script_types script_type);
               let output : output =
                 {
                   out_value = Int64.of_string value;
@@ -116,6 +135,7 @@ let import_outputs batch dir =
             end
         | _ -> failwith "Invalid outputs.csv row")
       csv);
+  Store.Batch.save_dict batch Dict.script_types;
   Store.Batch.flush batch;
   Printf.printf "\r";
   report_progress "outputs" !total !new_count
@@ -131,6 +151,7 @@ let import_addresses batch dir =
         report_progress_inline !total 100000 "addresses";
         match row with
         | [ address_id; address; addr_type; _label ] ->
+            ignore (Dict.code Dict.addr_types addr_type);
             if not (Store.Batch.mem batch (Store.address_path address_id)) then begin
               let addr : address = { addr_str = address; addr_type } in
               Store.Batch.set batch (Store.address_path address_id) (Address addr);
@@ -138,11 +159,12 @@ let import_addresses batch dir =
             end
         | _ -> failwith "Invalid addresses.csv row")
       csv);
+  Store.Batch.save_dict batch Dict.addr_types;
   Store.Batch.flush batch;
   Printf.printf "\r";
   report_progress "addresses" !total !new_count
 
-let import_contains batch dir =
+let import_contains ~scope batch dir =
   let path = Eio.Path.(dir / "relationships" / "contains.csv") in
   (* Track tx counts per block *)
   let block_txs = Hashtbl.create 1000 in
@@ -157,22 +179,24 @@ let import_contains batch dir =
         | [ block_id; tx_id; _rel_type ] ->
             let block_id = int_of_string block_id in
             let tx_id = int_of_string tx_id in
-            let current_count =
-              match Hashtbl.find_opt block_txs block_id with
-              | Some n -> n
-              | None -> 0
-            in
-            let idx = current_count in
-            Hashtbl.replace block_txs block_id (current_count + 1);
-            Store.Batch.set batch (Store.block_tx_path block_id idx) (TxRef tx_id);
-            incr new_count
+            if keeps_block scope block_id then begin
+              let current_count =
+                match Hashtbl.find_opt block_txs block_id with
+                | Some n -> n
+                | None -> 0
+              in
+              let idx = current_count in
+              Hashtbl.replace block_txs block_id (current_count + 1);
+              Store.Batch.set batch (Store.block_tx_path block_id idx) (TxRef tx_id);
+              incr new_count
+            end
         | _ -> failwith "Invalid contains.csv row")
       csv);
   Store.Batch.flush batch;
   Printf.printf "\r";
   report_progress "block->tx relationships" !total !new_count
 
-let import_to_address batch dir =
+let import_to_address ~scope batch dir =
   let path = Eio.Path.(dir / "relationships" / "to_address.csv") in
   let total = ref 0 in
   let new_count = ref 0 in
@@ -184,29 +208,87 @@ let import_to_address batch dir =
         match row with
         | [ output_id; address_id; _rel_type ] ->
             let tx_id, vout = parse_output_id output_id in
-            let oref : output_ref = { ref_tx_id = tx_id; ref_vout = vout } in
-            Store.Batch.set batch
-              (Store.addr_output_path address_id tx_id vout)
-              (OutputRef oref);
-            Store.Batch.set batch (Store.output_addr_path tx_id vout) (AddrRef address_id);
-            incr new_count
+            if keeps_tx scope tx_id then begin
+              let oref : output_ref =
+                { ref_tx_id = tx_id; ref_vout = vout; ref_value = None; ref_script = None }
+              in
+              Store.Batch.set batch
+                (Store.addr_output_path address_id tx_id vout)
+                (OutputRef oref);
+              Store.Batch.set batch (Store.output_addr_path tx_id vout) (AddrRef address_id);
+              incr new_count
+            end
         | _ -> failwith "Invalid to_address.csv row")
       csv);
   Store.Batch.flush batch;
   Printf.printf "\r";
   report_progress "output->address relationships" !total !new_count
 
-let import_tx_input batch dir =
+(* Packed index layout: consecutive rows of the same tx are collected and
+   handed to [write] as one group. Returns the row callback and the final
+   flush. *)
+let group_by_tx write =
+  let current = ref None in
+  let flush () =
+    Option.iter (fun (tx_id, items) -> write tx_id (List.rev items)) !current;
+    current := None
+  in
+  let add tx_id item =
+    match !current with
+    | Some (t, items) when t = tx_id -> current := Some (t, item :: items)
+    | _ ->
+        flush ();
+        current := Some (tx_id, [ item ])
+  in
+  (add, flush)
+
+(* Write [items] as the packed value at [path], merged with what the tx
+   already has there (packed or, in an older store, one leaf each) *)
+let write_packed batch path ~existing ~key ~pack items =
+  let current =
+    match Store.Batch.get batch path with
+    | Some e -> existing e
+    | None -> List.concat_map existing (Store.Batch.children batch path)
+  in
+  (* Not List.sort_uniq, which keeps either of two entries with the same
+     key: the stable sort keeps [items] ahead of [current], so the newly
+     imported entry wins, e.g. a ref with its value over the same ref
+     imported without ~values *)
+  let rec dedup = function
+    | a :: b :: rest when key a = key b -> dedup (a :: rest)
+    | a :: rest -> a :: dedup rest
+    | [] -> []
+  in
+  let merged =
+    dedup (List.stable_sort (fun a b -> compare (key a) (key b)) (items @ current))
+  in
+  Store.Batch.set batch path (pack merged)
+
+let write_packed_inputs batch tx_id inputs =
+  write_packed batch (Store.tx_inputs_path tx_id) inputs
+    ~existing:(function Inputs is -> is | Input i -> [ i ] | _ -> [])
+    ~key:(fun i -> i.in_index)
+    ~pack:(fun is -> Inputs is)
+
+let write_packed_outputs batch tx_id orefs =
+  write_packed batch (Store.tx_outputs_path tx_id) orefs
+    ~existing:(function OutputRefs rs -> rs | OutputRef r -> [ r ] | _ -> [])
+    ~key:(fun r -> r.ref_vout)
+    ~pack:(fun rs -> OutputRefs rs)
+
+let import_tx_input ~scope ~packed batch dir =
   let path = Eio.Path.(dir / "relationships" / "tx_input.csv") in
   let total = ref 0 in
   let new_count = ref 0 in
+  let add_packed, flush_packed = group_by_tx (write_packed_inputs batch) in
   with_csv_stream path (fun csv ->
     Csv.iter
       ~f:(fun row ->
         incr total;
         report_progress_inline !total 100000 "tx_input";
         match row with
-        | [ tx_id; output_id; index; sequence; _rel_type ] ->
+        | [ tx_id; output_id; index; sequence; _rel_type ]
+          when keeps_tx scope (int_of_string tx_id) ->
             let tx_id = int_of_string tx_id in
             let spent_tx_id, spent_vout = parse_output_id output_id in
             let index = int_of_string index in
@@ -218,49 +300,268 @@ let import_tx_input batch dir =
                 in_sequence = Int64.of_string sequence;
               }
             in
-            Store.Batch.set batch (Store.tx_input_path tx_id index) (Input input);
+            if packed then add_packed tx_id input
+            else Store.Batch.set batch (Store.tx_input_path tx_id index) (Input input);
             Store.Batch.set batch
               (Store.spent_by_path spent_tx_id spent_vout)
               (TxRef tx_id);
             incr new_count
+        | [ _; _; _; _; _ ] -> ()
         | _ -> failwith "Invalid tx_input.csv row")
       csv);
+  flush_packed ();
   Store.Batch.flush batch;
   Printf.printf "\r";
   report_progress "tx_input relationships" !total !new_count
 
-let import_tx_output batch dir =
+(* [r] with the value and script code of its output, which import_outputs
+   has already written *)
+let with_value batch r =
+  match Store.Batch.get batch (Store.output_path r.ref_tx_id r.ref_vout) with
+  | Some (Output o) ->
+      {
+        r with
+        ref_value = Some o.out_value;
+        ref_script = Some (Dict.code Dict.script_types o.out_script_type);
+      }
+  | _ -> r
+
+let import_tx_output ~scope ~packed ~values batch dir =
   let path = Eio.Path.(dir / "relationships" / "tx_output.csv") in
   let total = ref 0 in
   let new_count = ref 0 in
+  let add_packed, flush_packed = group_by_tx (write_packed_outputs batch) in
   with_csv_stream path (fun csv ->
     Csv.iter
       ~f:(fun row ->
         incr total;
         report_progress_inline !total 100000 "tx_output";
         match row with
-        | [ tx_id; output_id; index; _rel_type ] ->
+        | [ tx_id; output_id; index; _rel_type ]
+          when keeps_tx scope (int_of_string tx_id) ->
             let tx_id = int_of_string tx_id in
             let out_tx_id, vout = parse_output_id output_id in
             let _ = int_of_string index in
-            let oref : output_ref = { ref_tx_id = out_tx_id; ref_vout = vout } in
-            Store.Batch.set batch (Store.tx_output_path tx_id vout) (OutputRef oref);
+            let oref : output_ref =
+              { ref_tx_id = out_tx_id; ref_vout = vout; ref_value = None; ref_script = None }
+            in
+            let oref = if values then with_value batch oref else oref in
+            if packed then add_packed tx_id oref
+            else Store.Batch.set batch (Store.tx_output_path tx_id vout) (OutputRef oref);
             incr new_count
+        | [ _; _; _; _ ] -> ()
         | _ -> failwith "Invalid tx_output.csv row")
       csv);
+  flush_packed ();
   Store.Batch.flush batch;
   Printf.printf "\r";
   report_progress "tx_output relationships" !total !new_count
 
-let import_all store dir =
+(* Summary of [tx_id] from what the batch holds so far *)
+let summarise batch tx_id =
+  let children path =
+    match Store.Batch.get batch path with
+    | Some e -> [ e ]
+    | None -> Store.Batch.children batch path
+  in
+  let inputs =
+    List.fold_left
+      (fun n -> function Inputs is -> n + List.length is | Input _ -> n + 1 | _ -> n)
+      0
+      (children (Store.tx_inputs_path tx_id))
+  in
+  let orefs =
+    List.concat_map
+      (function OutputRefs rs -> rs | OutputRef r -> [ r ] | _ -> [])
+      (children (Store.tx_outputs_path tx_id))
+  in
+  let values =
+    List.filter_map
+      (fun r ->
+        match r.ref_value with
+        | Some _ as value -> value
+        | None -> (
+            match Store.Batch.get batch (Store.output_path r.ref_tx_id r.ref_vout) with
+            | Some (Output o) -> Some o.out_value
+            | _ -> None))
+      orefs
+  in
+  let fee, locktime, version =
+    match Store.Batch.get batch (Store.tx_path tx_id) with
+    | Some (Transaction t) -> (t.tx_fee, t.tx_locktime, t.tx_version)
+    | _ -> (0L, 0L, 0)
+  in
+  {
+    sum_tx_id = tx_id;
+    sum_fee = fee;
+    sum_locktime = locktime;
+    sum_version = version;
+    sum_inputs = inputs;
+    sum_outputs = List.length orefs;
+    sum_output_value = List.fold_left Int64.add 0L values;
+    sum_max_output_value = List.fold_left max 0L values;
+  }
+
+(* Replace the TxRef leaves of index/block_txs with TxSummary. Runs after
+   the relationships are imported, since it needs every tx's inputs and
+   outputs. *)
+let write_tx_summaries ~scope batch =
+  let count = ref 0 in
+  List.iter
+    (fun height ->
+      match int_of_string_opt height with
+      | Some height when keeps_block scope height ->
+          List.iter
+            (fun idx ->
+              let path = Store.block_txs_path height @ [ idx ] in
+              match Store.Batch.get batch path with
+              | Some (TxRef tx_id) ->
+                  Store.Batch.set batch path (TxSummary (summarise batch tx_id));
+                  incr count;
+                  report_progress_inline !count 100000 "tx summaries"
+              | _ -> ())
+            (Store.Batch.list batch (Store.block_txs_path height))
+      | _ -> ())
+    (Store.Batch.list batch [ "index"; "block_txs" ]);
+  Store.Batch.flush batch;
+  Printf.printf "\rWrote %d tx summaries\n%!" !count
+
+(* Copy the node or leaf at [path] of [src] into [dst], if there is one *)
+let copy src dst path =
+  match Store.Store.Tree.find_tree src path with
+  | Some t -> Store.Store.Tree.add_tree dst path t
+  | None -> dst
+
+(* Paths of [tree] written for block [height]: its record and tx list,
+   the records and indexes of its txs (all keyed by the tx), the spent_by
+   entries of their inputs, and the addresses their outputs pay to *)
+let block_paths tree height =
+  let get path =
+    Option.bind (Store.Store.Tree.find tree path)
+      (value_to_entity ~base:(Store.index_base path))
+  in
+  let keys path = List.map fst (Store.Store.Tree.list tree path) in
+  let children path = List.filter_map (fun k -> get (path @ [ k ])) (keys path) in
+  let tx_paths tx_id =
+    let inputs =
+      match get (Store.tx_inputs_path tx_id) with
+      | Some (Inputs is) -> is
+      | _ ->
+          List.filter_map
+            (function Input i -> Some i | _ -> None)
+            (children (Store.tx_inputs_path tx_id))
+    in
+    let vouts = List.filter_map int_of_string_opt (keys [ "output"; string_of_int tx_id ]) in
+    [
+      Store.tx_path tx_id;
+      Store.tx_inputs_path tx_id;
+      Store.tx_outputs_path tx_id;
+      [ "output"; string_of_int tx_id ];
+      [ "index"; "output_addr"; string_of_int tx_id ];
+    ]
+    @ List.map (fun i -> Store.spent_by_path i.in_spent_tx_id i.in_spent_vout) inputs
+    @ List.concat_map
+        (fun vout ->
+          match get (Store.output_addr_path tx_id vout) with
+          | Some (AddrRef a) -> [ Store.address_path a; Store.addr_output_path a tx_id vout ]
+          | _ -> [])
+        vouts
+  in
+  let tx_ids =
+    List.filter_map
+      (function TxRef id -> Some id | TxSummary t -> Some t.sum_tx_id | _ -> None)
+      (children (Store.block_txs_path height))
+  in
+  Store.block_path height :: Store.block_txs_path height
+  :: List.concat_map tx_paths tx_ids
+
+(* Commit a deferred batch one new block at a time, lowest height first,
+   so each commit is the chain as of its block. Metadata goes in with the
+   first commit and anything no block refers to with a final one. Returns
+   the (height, commit hash) of each block's commit. *)
+let commit_blocks (batch : Store.Batch.t) =
+  let store = batch.store and final = batch.tree in
+  let base =
+    match Store.Store.Head.find store with
+    | Some c -> Store.Store.Commit.tree c
+    | None -> Store.Store.Tree.empty ()
+  in
+  let heights =
+    Store.Store.Tree.list final [ "block" ]
+    |> List.filter_map (fun (k, _) -> int_of_string_opt k)
+    |> List.filter (fun h -> not (Store.Store.Tree.mem base (Store.block_path h)))
+    |> List.sort compare
+  in
+  let tree = ref (copy final base [ "meta" ]) in
+  let commits =
+    List.mapi
+      (fun i height ->
+        tree := List.fold_left (copy final) !tree (block_paths final height);
+        Store.Store.set_tree_exn
+          ~info:(fun () -> Store.info (Printf.sprintf "block %d" height))
+          store [] !tree;
+        report_progress_inline (i + 1) 1000 "block commits";
+        (height, History.commit_hash (Store.Store.Head.get store)))
+      heights
+  in
+  Store.Store.set_tree_exn ~info:(fun () -> Store.info "batch import") store [] final;
+  batch.count <- 0;
+  Printf.printf "\rCommitted %d blocks\n%!" (List.length commits);
+  commits
+
+(** Import a BlockSci CSV export into [store].
+
+    With [~packed], or if [store] already uses it, each transaction's inputs
+    and outputs are stored as one packed value under [index/tx_inputs/<tx>]
+    and [index/tx_outputs/<tx>] instead of one leaf per entry.
+
+    With [~summaries], or if [store] already has them, each
+    [index/block_txs] leaf is a {!Types.tx_summary} rather than a bare
+    TxRef.
+
+    With [~values], or if [store] already has them, the OutputRefs under
+    [index/tx_outputs] carry their output's value and script type code.
+
+    With [~binary], or if [store] already uses them, block and transaction
+    records are binary, with raw 32-byte hashes (see {!Types}).
+
+    With [~heights], nothing is committed until every file is read; then
+    each new block gets its own commit, lowest height first, and the
+    height → commit pairs are appended to the file [heights] (see
+    {!History}). The whole import is held in memory meanwhile, so this
+    suits incremental imports of recent blocks.
+
+    With [~from_height], only the blocks from that height up are imported,
+    with their transactions and the inputs, outputs and relationships of
+    those (address rows are still read, and only the new ones written).
+    A reorg uses it to import just the blocks past its fork. *)
+let import_all ?(packed = false) ?(summaries = false) ?(values = false)
+    ?(binary = false) ?heights ?from_height store dir =
   Printf.printf "Importing from %s...\n%!" (Eio.Path.native_exn dir);
-  let batch = Store.Batch.create ~batch_size:50000 store in
-  import_blocks batch dir;
-  import_transactions batch dir;
-  import_outputs batch dir;
+  Store.load_dicts store;
+  let packed = packed || Store.get store Store.layout_path = Some (Meta "packed") in
+  let summaries = summaries || Store.get store Store.summaries_path = Some (Meta "on") in
+  let values = values || Store.get store Store.output_values_path = Some (Meta "on") in
+  let binary = binary || Store.get store Store.records_path = Some (Meta "binary") in
+  let deferred = Option.is_some heights in
+  let batch = Store.Batch.create ~batch_size:50000 ~binary ~deferred store in
+  if packed then Store.Batch.set batch Store.layout_path (Meta "packed");
+  if summaries then Store.Batch.set batch Store.summaries_path (Meta "on");
+  if values then Store.Batch.set batch Store.output_values_path (Meta "on");
+  if binary then Store.Batch.set batch Store.records_path (Meta "binary");
+  let scope =
+    match from_height with
+    | None -> All
+    | Some height -> From { height; txs = Hashtbl.create 1024 }
+  in
+  import_blocks ~scope batch dir;
+  import_transactions ~scope batch dir;
+  import_outputs ~scope batch dir;
   import_addresses batch dir;
-  import_contains batch dir;
-  import_to_address batch dir;
-  import_tx_input batch dir;
-  import_tx_output batch dir;
+  import_contains ~scope batch dir;
+  import_to_address ~scope batch dir;
+  import_tx_input ~scope ~packed batch dir;
+  import_tx_output ~scope ~packed ~values batch dir;
+  if summaries then write_tx_summaries ~scope batch;
+  Option.iter (fun file -> History.record file (commit_blocks batch)) heights;
   Printf.printf "Import complete!\n%!"
@@ -0,0 +1,435 @@
+(** Benchmark aggregates maintained from commit diffs.
+
+    Each aggregate is a sum or a max of a per-entity contribution: a block,
+    a transaction (with its inputs), an output, an address or the
+    [index/spent_by] entries of a transaction. The state computed for a
+    commit is saved in [<store>.aggregates/<commit hash>]. To bring it to a
+    new head, the tree of the nearest ancestor with a saved state is diffed
+    against the head tree; Irmin skips subtrees whose hashes match, so only
+    the paths written since are visited. Every entity under a changed path
+    is read in both trees and its contribution is replaced: sums move by
+    the difference, maxes take the new value if it is larger. A max whose
+    holder shrank or went away can't be updated that way, so the state is
+    then recomputed over the whole head tree, as it is when no ancestor has
+    a saved state.
+
+    The aggregates over spent outputs (spent count, zero-conf outputs,
+    locktime change, max input value) are contributions of the creating
+    transaction's [index/spent_by] entries: each one reads the spent
+    output and the spender's record. A change to a spender's record or
+    inputs touches the transactions it spends from, so those are read
+    again too.
+
+    "Satoshi Dice address" is not maintained: it sums outputs to the
+    addresses given on the benchmark's command line, so there is no one
+    value to save per commit. *)
+
+type kind = Sum | Max
+
+(** Entities contributions are computed for. *)
+type entity =
+  | Block of int
+  | Tx of int
+  | Output of int * int
+  | Address of string
+  | Spent of int  (** [index/spent_by/<tx>] *)
+
+(** What the aggregates need to know about an entity in one tree. *)
+type facts =
+  | Block_facts of { exists : bool; txs : int }
+  | Tx_facts of { tx : Types.transaction option; inputs : int }
+  | Output_facts of Types.output option
+  | Address_facts of bool
+  | Spent_facts of {
+      spent : int;  (** Outputs with a spender *)
+      max_value : int64;  (** Largest value among them *)
+      zero_conf : int;  (** Spent in the block that created them *)
+      locktime_matches : int;  (** Spent by a tx as locked as the creator *)
+    }
+
+type aggregate = { name : string; kind : kind; contribution : facts -> int64 }
+
+let count b = if b then 1L else 0L
+
+(** Named as the benchmark rows they match. *)
+let aggregates =
+  [|
+    {
+      name = "Block count";
+      kind = Sum;
+      contribution = (function Block_facts b -> count b.exists | _ -> 0L);
+    };
+    {
+      name = "Tx count";
+      kind = Sum;
+      contribution = (function Tx_facts { tx = Some _; _ } -> 1L | _ -> 0L);
+    };
+    {
+      name = "Input count";
+      kind = Sum;
+      contribution =
+        (function Tx_facts { inputs; _ } -> Int64.of_int inputs | _ -> 0L);
+    };
+    {
+      name = "Output count";
+      kind = Sum;
+      contribution = (function Output_facts (Some _) -> 1L | _ -> 0L);
+    };
+    {
+      name = "Address count";
+      kind = Sum;
+      contribution = (function Address_facts b -> count b | _ -> 0L);
+    };
+    {
+      name = "Tx locktime > 0";
+      kind = Sum;
+      contribution =
+        (function
+        | Tx_facts { tx = Some t; _ } -> count (t.Types.tx_locktime > 0L) | _ -> 0L);
+    };
+    {
+      name = "Max output value";
+      kind = Max;
+      contribution = (function Output_facts (Some o) -> o.Types.out_value | _ -> 0L);
+    };
+    {
+      name = "Calculate fee";
+      kind = Max;
+      contribution = (function Tx_facts { tx = Some t; _ } -> t.Types.tx_fee | _ -> 0L);
+    };
+    {
+      name = "Total output value";
+      kind = Sum;
+      contribution = (function Output_facts (Some o) -> o.Types.out_value | _ -> 0L);
+    };
+    {
+      name = "Total fees";
+      kind = Sum;
+      contribution = (function Tx_facts { tx = Some t; _ } -> t.Types.tx_fee | _ -> 0L);
+    };
+    {
+      name = "Tx version > 1";
+      kind = Sum;
+      contribution =
+        (function Tx_facts { tx = Some t; _ } -> count (t.Types.tx_version > 1) | _ -> 0L);
+    };
+    {
+      name = "Max tx per block";
+      kind = Max;
+      contribution = (function Block_facts b -> Int64.of_int b.txs | _ -> 0L);
+    };
+    {
+      name = "Spent outputs";
+      kind = Sum;
+      contribution = (function Spent_facts s -> Int64.of_int s.spent | _ -> 0L);
+    };
+    {
+      name = "Zero-conf outputs";
+      kind = Sum;
+      contribution = (function Spent_facts s -> Int64.of_int s.zero_conf | _ -> 0L);
+    };
+    {
+      name = "Locktime change";
+      kind = Sum;
+      contribution = (function Spent_facts s -> count (s.locktime_matches = 1) | _ -> 0L);
+    };
+    {
+      name = "Max input value";
+      kind = Max;
+      contribution = (function Spent_facts s -> s.max_value | _ -> 0L);
+    };
+    {
+      name = "High value tx";
+      kind = Sum;
+      contribution =
+        (function
+        | Tx_facts { tx = Some t; _ } -> count (t.Types.tx_fee > 1_000_000_000L) | _ -> 0L);
+    };
+    {
+      name = "Multi-input tx";
+      kind = Sum;
+      contribution =
+        (function
+        | Tx_facts { tx = Some _; inputs } -> count (inputs > 10) | _ -> 0L);
+    };
+  |]
+
+(** Aggregate values of a commit, in the order of {!aggregates}. *)
+type state = { commit : string; values : int64 array }
+
+(** {1 Contributions} *)
+
+let find tree path =
+  Option.bind (Store.Store.Tree.find tree path)
+    (Types.value_to_entity ~base:(Store.index_base path))
+
+let children tree path = List.length (Store.Store.Tree.list tree path)
+
+let transaction tree id =
+  match find tree (Store.tx_path id) with Some (Types.Transaction t) -> Some t | _ -> None
+
+let inputs tree id =
+  match find tree (Store.tx_inputs_path id) with
+  | Some (Types.Inputs is) -> is
+  | _ ->
+      List.filter_map
+        (fun (k, _) ->
+          match find tree (Store.tx_inputs_path id @ [ k ]) with
+          | Some (Types.Input i) -> Some i
+          | _ -> None)
+        (Store.Store.Tree.list tree (Store.tx_inputs_path id))
+
+(* The spent outputs of [tx], read as the benchmark queries read them: a
+   spender without a record counts as spent but matches nothing *)
+let spent_facts tree tx =
+  let creator = transaction tree tx in
+  let spent = ref 0 and max_value = ref 0L and zero_conf = ref 0 and matches = ref 0 in
+  List.iter
+    (fun (k, _) ->
+      match int_of_string_opt k with
+      | None -> ()
+      | Some vout -> (
+          incr spent;
+          (match find tree (Store.output_path tx vout) with
+          | Some (Types.Output o) -> max_value := max !max_value o.Types.out_value
+          | _ -> ());
+          let spender =
+            match find tree (Store.spent_by_path tx vout) with
+            | Some (Types.TxRef id) -> transaction tree id
+            | _ -> None
+          in
+          match (creator, spender) with
+          | Some c, Some s ->
+              if c.Types.tx_block_height = s.Types.tx_block_height then incr zero_conf;
+              if (c.Types.tx_locktime > 0L) = (s.Types.tx_locktime > 0L) then incr matches
+          | _ -> ()))
+    (Store.Store.Tree.list tree (Store.spent_by_tx_path tx));
+  Spent_facts
+    {
+      spent = !spent;
+      max_value = !max_value;
+      zero_conf = !zero_conf;
+      locktime_matches = !matches;
+    }
+
+let facts tree = function
+  | Block h ->
+      Block_facts
+        {
+          exists = Store.Store.Tree.mem tree (Store.block_path h);
+          txs = children tree (Store.block_txs_path h);
+        }
+  | Tx id ->
+      let inputs =
+        match find tree (Store.tx_inputs_path id) with
+        | Some (Types.Inputs is) -> List.length is
+        | _ -> children tree (Store.tx_inputs_path id)
+      in
+      Tx_facts { tx = transaction tree id; inputs }
+  | Output (tx, vout) -> (
+      match find tree (Store.output_path tx vout) with
+      | Some (Types.Output o) -> Output_facts (Some o)
+      | _ -> Output_facts None)
+  | Address a -> Address_facts (Store.Store.Tree.mem tree (Store.address_path a))
+  | Spent tx -> spent_facts tree tx
+
+(** Entities whose contribution a change at [path] can affect. A tx
+    record or output also counts in the creator's spent outputs. *)
+let entities_of_path path =
+  let int = int_of_string_opt in
+  match path with
+  | [ "block"; h ] | "index" :: "block_txs" :: h :: _ ->
+      Option.fold ~none:[] ~some:(fun h -> [ Block h ]) (int h)
+  | [ "tx"; id ] | "index" :: "tx_inputs" :: id :: _ ->
+      Option.fold ~none:[] ~some:(fun id -> [ Tx id; Spent id ]) (int id)
+  | [ "output"; tx; vout ] -> (
+      match (int tx, int vout) with
+      | Some tx, Some vout -> [ Output (tx, vout); Spent tx ]
+      | _ -> [])
+  | [ "address"; a ] -> [ Address a ]
+  | "index" :: "spent_by" :: tx :: _ ->
+      Option.fold ~none:[] ~some:(fun tx -> [ Spent tx ]) (int tx)
+  | _ -> []
+
+(** Replace the contribution of an entity, [before] (if it was counted)
+    by [after]. Returns false if a max can no longer be maintained. *)
+let replace values ~before after =
+  let ok = ref true in
+  Array.iteri
+    (fun i agg ->
+      let b = Option.fold ~none:0L ~some:agg.contribution before in
+      let a = agg.contribution after in
+      match agg.kind with
+      | Sum -> values.(i) <- Int64.add values.(i) (Int64.sub a b)
+      | Max ->
+          if a > values.(i) then values.(i) <- a
+          else if a < b && b >= values.(i) then ok := false)
+    aggregates;
+  !ok
+
+(** {1 Computing} *)
+
+(** Every aggregate over [tree], reading each entity once. *)
+let full tree =
+  let values = Array.make (Array.length aggregates) 0L in
+  let add e = ignore (replace values ~before:None (facts tree e)) in
+  let keys path = List.map fst (Store.Store.Tree.list tree path) in
+  let ints path = List.filter_map int_of_string_opt (keys path) in
+  List.iter (fun h -> add (Block h)) (ints [ "block" ]);
+  List.iter (fun id -> add (Tx id)) (ints [ "tx" ]);
+  List.iter
+    (fun tx ->
+      List.iter (fun vout -> add (Output (tx, vout))) (ints [ "output"; string_of_int tx ]))
+    (ints [ "output" ]);
+  List.iter (fun a -> add (Address a)) (keys [ "address" ]);
+  List.iter (fun tx -> add (Spent tx)) (ints [ "index"; "spent_by" ]);
+  values
+
+(** [values] (over [old_tree]) moved to [tree] by their diff, or [None]
+    if a max has to be recomputed. *)
+let apply_diff values old_tree tree =
+  let values = Array.copy values in
+  let touched = Hashtbl.create 1024 in
+  List.iter
+    (fun (path, _) ->
+      List.iter (fun e -> Hashtbl.replace touched e ()) (entities_of_path path))
+    (Store.Store.Tree.diff old_tree tree);
+  (* A spender's record and inputs count in the txs it spends from *)
+  let spenders =
+    Hashtbl.fold (fun e () acc -> match e with Tx id -> id :: acc | _ -> acc) touched []
+  in
+  List.iter
+    (fun id ->
+      List.iter
+        (fun (i : Types.input) -> Hashtbl.replace touched (Spent i.in_spent_tx_id) ())
+        (inputs old_tree id @ inputs tree id))
+    spenders;
+  let ok =
+    Hashtbl.fold
+      (fun e () ok ->
+        replace values ~before:(Some (facts old_tree e)) (facts tree e) && ok)
+      touched true
+  in
+  if ok then Some values else None
+
+(** {1 Persistence} *)
+
+(** Default state directory for a store path. *)
+let dir_of_store store_path = store_path ^ ".aggregates"
+
+let commit_hash c = Irmin.Type.to_string Store.Store.Hash.t (Store.Store.Commit.hash c)
+
+(** Saved state of [commit], if it has all the current aggregates. *)
+let load dir commit =
+  match open_in (Filename.concat dir commit) with
+  | exception Sys_error _ -> None
+  | ic ->
+      let saved = Hashtbl.create 16 in
+      (try
+         while true do
+           match String.split_on_char '\t' (input_line ic) with
+           | [ name; v ] ->
+               Option.iter (Hashtbl.replace saved name) (Int64.of_string_opt v)
+           | _ -> ()
+         done
+       with End_of_file -> ());
+      close_in ic;
+      if Array.for_all (fun agg -> Hashtbl.mem saved agg.name) aggregates then
+        Some
+          {
+            commit;
+            values = Array.map (fun agg -> Hashtbl.find saved agg.name) aggregates;
+          }
+      else None
+
+let save dir state =
+  if not (Sys.file_exists dir) then Sys.mkdir dir 0o755;
+  let file = Filename.concat dir state.commit in
+  let tmp = file ^ ".tmp" in
+  let oc = open_out tmp in
+  Array.iteri
+    (fun i agg -> Printf.fprintf oc "%s\t%Ld\n" agg.name state.values.(i))
+    aggregates;
+  close_out oc;
+  Sys.rename tmp file
+
+(** Nearest ancestor of [head] (itself included) with a saved state,
+    looking at most [max_depth] commits back. *)
+let saved_ancestor ?(max_depth = 10_000) dir repo head =
+  let visited = Hashtbl.create 64 in
+  let queue = Queue.create () in
+  Queue.push (head, 0) queue;
+  let rec search () =
+    match Queue.take_opt queue with
+    | None -> None
+    | Some (c, depth) -> (
+        let hash = commit_hash c in
+        if Hashtbl.mem visited hash then search ()
+        else begin
+          Hashtbl.add visited hash ();
+          match load dir hash with
+          | Some state -> Some (c, state)
+          | None ->
+              if depth < max_depth then
+                List.iter
+                  (fun key ->
+                    Option.iter
+                      (fun p -> Queue.push (p, depth + 1) queue)
+                      (Store.Store.Commit.of_key repo key))
+                  (Store.Store.Commit.parents c);
+              search ()
+        end)
+  in
+  search ()
+
+(** Aggregates of [store]'s head, updated from the nearest saved ancestor
+    state and saved in [dir]. [None] if the store has no commit.
+
+    If [from] has a saved state it is the base instead: after a reorg the
+    old tip is no ancestor of the new one, and the diff between them takes
+    the orphaned blocks' contributions back out. *)
+let update ?from store dir =
+  match Store.Store.Head.find store with
+  | None -> None
+  | Some head ->
+      let hash = commit_hash head in
+      let tree = Store.Store.Commit.tree head in
+      let from_state =
+        Option.bind from (fun c ->
+            Option.map (fun state -> (c, state)) (load dir (commit_hash c)))
+      in
+      let base =
+        match from_state with
+        | Some _ -> from_state
+        | None -> saved_ancestor dir (Store.Store.repo store) head
+      in
+      let values =
+        match base with
+        | Some (_, state) when state.commit = hash -> state.values
+        | Some (base, state) -> (
+            match apply_diff state.values (Store.Store.Commit.tree base) tree with
+            | Some values -> values
+            | None -> full tree)
+        | None -> full tree
+      in
+      let state = { commit = hash; values } in
+      if not (Sys.file_exists (Filename.concat dir hash)) then save dir state;
+      Some state
+
+(** Rows of [state], with the aggregates derived from them. *)
+let report state =
+  let value name =
+    let rec find i =
+      if i >= Array.length aggregates then 0L
+      else if aggregates.(i).name = name then state.values.(i)
+      else find (i + 1)
+    in
+    find 0
+  in
+  let blocks = value "Block count" in
+  Array.to_list (Array.mapi (fun i agg -> (agg.name, state.values.(i))) aggregates)
+  @ [
+      ( "Avg tx per block",
+        if blocks = 0L then 0L else Int64.div (Int64.mul (value "Tx count") 1000L) blocks );
+      ("Unspent outputs", Int64.sub (value "Output count") (value "Spent outputs"));
+    ]
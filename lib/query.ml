@@ -49,6 +49,15 @@ let get_address store addr =
   | Some (Address a) -> Some a
   | _ -> None
 
+(** IDs of the transactions in a block, in block order. *)
+let block_tx_ids store height =
+  List.filter_map
+    (fun key ->
+      match Store.get store (Store.block_txs_path height @ [ key ]) with
+      | Some (TxRef tx_id) | Some (TxSummary { sum_tx_id = tx_id; _ }) -> Some tx_id
+      | _ -> None)
+    (Store.list store (Store.block_txs_path height))
+
 (** Get all transactions in a block.
 
     {v
@@ -57,13 +66,7 @@ let get_address store addr =
     ORDER BY t.txId
     v} *)
 let block_transactions store height =
-  let keys = Store.list store (Store.block_txs_path height) in
-  List.filter_map
-    (fun key ->
-      match Store.get store (Store.block_txs_path height @ [ key ]) with
-      | Some (TxRef tx_id) -> get_transaction store tx_id
-      | _ -> None)
-    keys
+  List.filter_map (get_transaction store) (block_tx_ids store height)
 
 (** Get all inputs for a transaction.
 
@@ -73,13 +76,44 @@ let block_transactions store height =
     ORDER BY i.index
     v} *)
 let tx_inputs store tx_id =
-  let keys = Store.list store (Store.tx_inputs_path tx_id) in
-  List.filter_map
-    (fun key ->
-      match Store.get store (Store.tx_inputs_path tx_id @ [ key ]) with
-      | Some (Input i) -> Some i
-      | _ -> None)
-    keys
+  match Store.get store (Store.tx_inputs_path tx_id) with
+  | Some (Inputs is) -> is
+  | _ ->
+      let keys = Store.list store (Store.tx_inputs_path tx_id) in
+      List.filter_map
+        (fun key ->
+          match Store.get store (Store.tx_inputs_path tx_id @ [ key ]) with
+          | Some (Input i) -> Some i
+          | _ -> None)
+        keys
+
+(** References to the outputs of a transaction, from the packed value or
+    the per-output leaves. *)
+let tx_output_refs store tx_id =
+  match Store.get store (Store.tx_outputs_path tx_id) with
+  | Some (OutputRefs rs) -> rs
+  | _ ->
+      let keys = Store.list store (Store.tx_outputs_path tx_id) in
+      List.filter_map
+        (fun key ->
+          match Store.get store (Store.tx_outputs_path tx_id @ [ key ]) with
+          | Some (OutputRef r) -> Some r
+          | _ -> None)
+        keys
+
+(** The output [r] points to, if [import --output-values] embedded its
+    value and script type in [r], so no output record read is needed. *)
+let embedded_output r =
+  match (r.ref_value, Option.bind r.ref_script (Dict.name Dict.script_types)) with
+  | Some value, Some script ->
+      Some
+        {
+          out_value = value;
+          out_script_type = script;
+          out_tx_id = r.ref_tx_id;
+          out_vout = r.ref_vout;
+        }
+  | _ -> None
 
 (** Get all outputs for a transaction.
 
@@ -89,13 +123,12 @@ let tx_inputs store tx_id =
     ORDER BY o.vout
     v} *)
 let tx_outputs store tx_id =
-  let keys = Store.list store (Store.tx_outputs_path tx_id) in
   List.filter_map
-    (fun key ->
-      match Store.get store (Store.tx_outputs_path tx_id @ [ key ]) with
-      | Some (OutputRef r) -> get_output store r.ref_tx_id r.ref_vout
-      | _ -> None)
-    keys
+    (fun r ->
+      match embedded_output r with
+      | Some _ as output -> output
+      | None -> get_output store r.ref_tx_id r.ref_vout)
+    (tx_output_refs store tx_id)
 
 (** Get the address an output is locked to.
 
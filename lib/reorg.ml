@@ -0,0 +1,83 @@
+(** Chain reorganisations.
+
+    When the tip is replaced, the blocks from the fork point up are
+    orphaned. With per-block commits ({!History}) the branch is moved
+    back to the commit of the last common block, which undoes every
+    record and index entry of the orphaned blocks at once, and only the
+    export's blocks from the fork up, with their transactions, are
+    imported on top of it. State kept outside the store follows: heights
+    past the fork are dropped from the height index, and dictionary codes
+    the fork commit doesn't have are written again. *)
+
+(** Block hashes of the export in [dir], by height. *)
+let export_hashes dir =
+  let hashes = Hashtbl.create 1024 in
+  Import.with_csv_stream Eio.Path.(dir / "nodes" / "blocks.csv") (fun csv ->
+      Csv.iter
+        ~f:(function
+          | _ :: height :: hash :: _ ->
+              Option.iter
+                (fun h -> Hashtbl.replace hashes h hash)
+                (int_of_string_opt height)
+          | _ -> failwith "Invalid blocks.csv row")
+        csv);
+  hashes
+
+(** Highest height in [hashes], -1 if it is empty. *)
+let export_tip hashes = Hashtbl.fold (fun h _ acc -> max h acc) hashes (-1)
+
+(** Lowest height at which [store] and the export disagree, searching
+    down from the lower of the two tips: one past the highest block they
+    share. The tip of [store] plus one if nothing is orphaned. *)
+let fork_height store hashes =
+  let rec search height =
+    if height < 0 then 0
+    else
+      match (Hashtbl.find_opt hashes height, Query.get_block store height) with
+      | Some hash, Some block when hash = block.Types.hash -> height + 1
+      | Some _, _ -> search (height - 1)
+      | None, _ ->
+          failwith
+            (Printf.sprintf
+               "Block %d is not in the export: the fork is below its first block"
+               height)
+  in
+  search (min (Query.last_block_height store) (export_tip hashes))
+
+(** Replace the blocks of [store] from the fork with the export in [dir]:
+    reset the branch to the commit recorded for the last common block in
+    [heights], then import the blocks of [dir] from the fork up, one
+    commit per block. Returns the fork height. *)
+let run store ~heights dir =
+  let hashes = export_hashes dir in
+  let fork = fork_height store hashes in
+  if fork > export_tip hashes then
+    failwith
+      (Printf.sprintf "The export has no block past the store's (its tip is %d)"
+         (export_tip hashes));
+  if fork > Query.last_block_height store then
+    Printf.printf "No orphaned blocks, importing from block %d\n%!" fork
+  else begin
+    if fork = 0 then failwith "The whole chain is orphaned; re-import instead";
+    let base =
+      match History.find heights (fork - 1) with
+      | None -> None
+      | Some hash -> History.commit_of_hash store hash
+    in
+    match base with
+    | None ->
+        failwith
+          (Printf.sprintf
+             "No commit recorded for block %d in %s (import with --commit-per-block)"
+             (fork - 1) heights)
+    | Some commit ->
+        Printf.printf "Orphaning blocks %d..%d\n%!" fork (Query.last_block_height store);
+        Store.Store.Head.set store commit;
+        History.truncate heights ~from:fork;
+        List.iter
+          (fun (d : Dict.t) ->
+            Dict.forget_saved d (List.length (Store.list store (Store.dict_path d.name))))
+          Dict.all
+  end;
+  Import.import_all ~heights ~from_height:fork store dir;
+  fork
@@ -0,0 +1,114 @@
+(** Query results keyed by the commit they were computed on.
+
+    A commit never changes, so a result computed over it stays valid. The
+    CLI, the GraphQL server and the C benchmark (c_bin/result_cache.h)
+    share one directory next to the store, [<store>.cache/], with one file
+    per result, named by the 64-bit FNV-1a hash of its key in hex:
+
+    {v
+    "BSCACHE1 <commit length> <query length> <params length>\n"
+    commit query params result
+    v}
+
+    The key fields are stored in full and compared on lookup, so a hash
+    collision is a miss rather than a wrong answer. Queries are normalised
+    first (whitespace outside string literals collapsed, trailing [;]
+    dropped) and prefixed by the tool that ran them. Files are written
+    beside their final name and renamed, so concurrent readers never see
+    a partial entry. The directory can be deleted at any time. *)
+
+let magic = "BSCACHE1"
+
+(** Default cache directory for a store path. *)
+let dir_of_store store_path = store_path ^ ".cache"
+
+type t = { dir : string; commit : string }
+
+(** Cache for results over the head of [store], or [None] if the store
+    has no commit yet. *)
+let at_head dir store =
+  Option.map (fun commit -> { dir; commit }) (Store.head_hash store)
+
+let fnv1a s =
+  let h = ref 0xcbf29ce484222325L in
+  String.iter
+    (fun c ->
+      h := Int64.mul (Int64.logxor !h (Int64.of_int (Char.code c))) 0x100000001b3L)
+    s;
+  !h
+
+(** Collapse whitespace runs outside quotes to one space and drop a
+    trailing [;], so layout differences share an entry. *)
+let normalise query =
+  let b = Buffer.create (String.length query) in
+  let quote = ref None and space = ref false in
+  String.iter
+    (fun c ->
+      match (!quote, c) with
+      | None, (' ' | '\t' | '\n' | '\r') -> space := true
+      | None, _ ->
+          if !space && Buffer.length b > 0 then Buffer.add_char b ' ';
+          space := false;
+          if c = '\'' || c = '"' then quote := Some c;
+          Buffer.add_char b c
+      | Some q, _ ->
+          if c = q then quote := None;
+          Buffer.add_char b c)
+    query;
+  let s = Buffer.contents b in
+  let n = String.length s in
+  if n > 0 && s.[n - 1] = ';' then String.trim (String.sub s 0 (n - 1)) else s
+
+(** Parameters in a canonical order, one [name=value] per line. *)
+let params_key params =
+  List.sort compare params
+  |> List.map (fun (k, v) -> k ^ "=" ^ v)
+  |> String.concat "\n"
+
+let header t query params =
+  Printf.sprintf "%s %d %d %d\n%s%s%s" magic (String.length t.commit)
+    (String.length query) (String.length params) t.commit query params
+
+let file t query params =
+  Filename.concat t.dir
+    (Printf.sprintf "%016Lx" (fnv1a (t.commit ^ "\000" ^ query ^ "\000" ^ params)))
+
+(** Cached result of [query] with [params], if any. *)
+let find t ~query ~params =
+  let query = normalise query and params = params_key params in
+  let expected = header t query params in
+  match open_in_bin (file t query params) with
+  | exception Sys_error _ -> None
+  | ic ->
+      Fun.protect
+        ~finally:(fun () -> close_in ic)
+        (fun () ->
+          let len = in_channel_length ic in
+          let n = String.length expected in
+          if len < n || really_input_string ic n <> expected then None
+          else Some (really_input_string ic (len - n)))
+
+(** Store [result] for [query] with [params]. Failures (read-only
+    directory, full disk) only lose the entry. *)
+let add t ~query ~params result =
+  let query = normalise query and params = params_key params in
+  let path = file t query params in
+  let tmp = Printf.sprintf "%s.tmp.%d" path (Unix.getpid ()) in
+  try
+    if not (Sys.file_exists t.dir) then Sys.mkdir t.dir 0o755;
+    let oc = open_out_bin tmp in
+    output_string oc (header t query params);
+    output_string oc result;
+    close_out oc;
+    Sys.rename tmp path
+  with Sys_error _ -> ( try Sys.remove tmp with Sys_error _ -> ())
+
+(** Cached result of [query] with [params], computing and storing it
+    with [f] on a miss. *)
+let memo t ~query ~params f =
+  match find t ~query ~params with
+  | Some result -> result
+  | None ->
+      let result = f () in
+      add t ~query ~params result;
+      result
@@ -0,0 +1,409 @@
+(** Flat, mmappable snapshots of the transaction graph.
+
+    A snapshot is a directory of little-endian fixed-width arrays laid out
+    in compressed sparse row (CSR) form, so graph traversals can run over
+    plain memory instead of hopping through [index/spent_by] and
+    [index/tx_outputs] one path lookup at a time.
+
+    {v
+    meta               text: version, commit and array lengths
+    tx_outputs.off     u64 [txs + 1]      first output ordinal of each tx
+    out_addr.u32       u32 [outputs]      address index of each output
+    out_spent_by.u32   u32 [outputs]      spending tx of each output
+    tx_spenders.off    u64 [txs + 1]      first edge of each tx
+    tx_spenders.u32    u32 [edges]        distinct spending txs of each tx
+    addr_keys.off      u64 [addresses + 1]
+    addr_keys.str      address IDs, concatenated in sorted order
+    out_script.u8      u8  [outputs]      script type code of each output
+    addr_type.u8       u8  [addresses]    address type code of each address
+    script_types.dict  text: script type of each code, one per line
+    addr_types.dict    text: address type of each code, one per line
+    block_time.i64     i64 [blocks]       timestamp of each height
+    tx_height.u32      u32 [txs]          block height of each tx
+    tx_fee.i64         i64 [txs]          fee of each tx
+    out_value.i64      i64 [outputs]      value of each output
+    v}
+
+    Output ordinals are [tx_outputs.off.(tx) + vout]. Missing entries
+    (no address, unspent output) are stored as {!none}, missing codes as
+    {!Dict.none}, the time of a height without a block record as
+    {!no_time}. Codes are the store's {!Dict} codes. *)
+
+let version = 4
+
+(** Marker for a missing u32 entry. *)
+let none = 0xFFFF_FFFF
+
+(** Marker for the time of a missing block. *)
+let no_time = Int64.min_int
+
+(** Default snapshot directory for a store path. *)
+let dir_of_store store_path = store_path ^ ".snapshot"
+
+let meta_file = "meta"
+let tx_outputs_off_file = "tx_outputs.off"
+let out_addr_file = "out_addr.u32"
+let out_spent_by_file = "out_spent_by.u32"
+let tx_spenders_off_file = "tx_spenders.off"
+let tx_spenders_file = "tx_spenders.u32"
+let addr_keys_off_file = "addr_keys.off"
+let addr_keys_file = "addr_keys.str"
+let out_script_file = "out_script.u8"
+let addr_type_file = "addr_type.u8"
+let script_types_file = "script_types.dict"
+let addr_types_file = "addr_types.dict"
+let block_time_file = "block_time.i64"
+let tx_height_file = "tx_height.u32"
+let tx_fee_file = "tx_fee.i64"
+let out_value_file = "out_value.i64"
+
+(** {1 Binary writers} *)
+
+module Writer = struct
+  type t = { oc : out_channel; buf : Bytes.t }
+
+  let create dir name =
+    { oc = open_out_bin (Filename.concat dir name); buf = Bytes.create 8 }
+
+  let u8 w v = output_byte w.oc v
+
+  let u32 w v =
+    Bytes.set_int32_le w.buf 0 (Int32.of_int v);
+    output w.oc w.buf 0 4
+
+  let u64 w v =
+    Bytes.set_int64_le w.buf 0 (Int64.of_int v);
+    output w.oc w.buf 0 8
+
+  let i64 w v =
+    Bytes.set_int64_le w.buf 0 v;
+    output w.oc w.buf 0 8
+
+  let string w s = output_string w.oc s
+  let close w = close_out w.oc
+end
+
+let rec mkdir_p dir =
+  if not (Sys.file_exists dir) then begin
+    mkdir_p (Filename.dirname dir);
+    Sys.mkdir dir 0o755
+  end
+
+let int_keys store path =
+  Store.list store path |> List.filter_map int_of_string_opt
+
+let max_key keys = List.fold_left max (-1) keys
+
+(** {1 Export} *)
+
+(** Write a snapshot of the graph reachable from [store]'s head into [dir].
+
+    Transactions are numbered by their BlockSci [tx_id] and addresses by
+    their rank in the sorted list of address IDs. *)
+let export store dir =
+  mkdir_p dir;
+  Printf.printf "Exporting snapshot to %s...\n%!" dir;
+  Store.load_dicts store;
+  let num_blocks = Query.last_block_height store + 1 in
+  let block_time = Writer.create dir block_time_file in
+  for height = 0 to num_blocks - 1 do
+    Writer.i64 block_time
+      (match Query.get_block store height with
+      | Some (b : Types.block) -> b.timestamp
+      | None -> no_time)
+  done;
+  Writer.close block_time;
+  let num_txs = max_key (int_keys store [ "tx" ]) + 1 in
+  let addr_keys = Store.list store [ "address" ] |> List.sort compare in
+  let addr_index = Hashtbl.create (List.length addr_keys) in
+  let keys_off = Writer.create dir addr_keys_off_file in
+  let keys = Writer.create dir addr_keys_file in
+  let addr_type = Writer.create dir addr_type_file in
+  let key_bytes =
+    List.fold_left
+      (fun (i, off) key ->
+        Hashtbl.replace addr_index key i;
+        Writer.u64 keys_off off;
+        Writer.string keys key;
+        Writer.u8 addr_type
+          (match Query.get_address store key with
+          | Some (a : Types.address) -> Dict.code_or_none Dict.addr_types a.addr_type
+          | None -> Dict.none);
+        (i + 1, off + String.length key))
+      (0, 0) addr_keys
+    |> snd
+  in
+  Writer.u64 keys_off key_bytes;
+  List.iter Writer.close [ keys_off; keys; addr_type ];
+  let outputs_off = Writer.create dir tx_outputs_off_file in
+  let out_addr = Writer.create dir out_addr_file in
+  let out_spent_by = Writer.create dir out_spent_by_file in
+  let out_script = Writer.create dir out_script_file in
+  let out_value = Writer.create dir out_value_file in
+  let tx_height = Writer.create dir tx_height_file in
+  let tx_fee = Writer.create dir tx_fee_file in
+  let spenders_off = Writer.create dir tx_spenders_off_file in
+  let spenders = Writer.create dir tx_spenders_file in
+  let num_outputs = ref 0 in
+  let num_edges = ref 0 in
+  for tx_id = 0 to num_txs - 1 do
+    if (tx_id + 1) mod 100000 = 0 then
+      Printf.printf "\r  snapshot: %d txs...%!" (tx_id + 1);
+    Writer.u64 outputs_off !num_outputs;
+    Writer.u64 spenders_off !num_edges;
+    (match Query.get_transaction store tx_id with
+    | Some (tx : Types.transaction) ->
+        Writer.u32 tx_height tx.tx_block_height;
+        Writer.i64 tx_fee tx.tx_fee
+    | None ->
+        Writer.u32 tx_height none;
+        Writer.i64 tx_fee 0L);
+    let n =
+      List.fold_left
+        (fun n (r : Types.output_ref) -> max n (r.ref_vout + 1))
+        0
+        (Query.tx_output_refs store tx_id)
+    in
+    let tx_spenders = ref [] in
+    for vout = 0 to n - 1 do
+      let addr =
+        match Query.output_address store tx_id vout with
+        | Some a -> Option.value (Hashtbl.find_opt addr_index a) ~default:none
+        | None -> none
+      in
+      let spent =
+        match Query.output_spent_by store tx_id vout with
+        | Some s ->
+            tx_spenders := s :: !tx_spenders;
+            s
+        | None -> none
+      in
+      Writer.u32 out_addr addr;
+      Writer.u32 out_spent_by spent;
+      match Query.get_output store tx_id vout with
+      | Some (o : Types.output) ->
+          Writer.u8 out_script (Dict.code_or_none Dict.script_types o.out_script_type);
+          Writer.i64 out_value o.out_value
+      | None ->
+          Writer.u8 out_script Dict.none;
+          Writer.i64 out_value 0L
+    done;
+    num_outputs := !num_outputs + n;
+    List.iter
+      (fun s ->
+        Writer.u32 spenders s;
+        incr num_edges)
+      (List.sort_uniq compare !tx_spenders)
+  done;
+  Writer.u64 outputs_off !num_outputs;
+  Writer.u64 spenders_off !num_edges;
+  List.iter Writer.close
+    [
+      outputs_off; out_addr; out_spent_by; out_script; out_value; tx_height;
+      tx_fee; spenders_off; spenders;
+    ];
+  List.iter
+    (fun (file, d) ->
+      let oc = open_out (Filename.concat dir file) in
+      List.iter (fun name -> Printf.fprintf oc "%s\n" name) (Dict.to_list d);
+      close_out oc)
+    [ (script_types_file, Dict.script_types); (addr_types_file, Dict.addr_types) ];
+  let meta = open_out (Filename.concat dir meta_file) in
+  Printf.fprintf meta
+    "version %d\ncommit %s\nblocks %d\ntxs %d\noutputs %d\nedges %d\naddresses %d\n"
+    version
+    (Option.value (Store.head_hash store) ~default:"none")
+    num_blocks num_txs !num_outputs !num_edges (List.length addr_keys);
+  close_out meta;
+  Printf.printf "\rSnapshot: %d txs, %d outputs, %d edges, %d addresses\n%!"
+    num_txs !num_outputs !num_edges (List.length addr_keys)
+
+(** {1 Reading} *)
+
+(** Bounded min-heap keeping the [k] highest-ranked [(balance, index)]
+    entries: higher balance first, lower index on ties, so results do not
+    depend on how the input was split. *)
+module Top_k = struct
+  type t = { k : int; mutable size : int; keys : int64 array; ids : int array }
+
+  let create k =
+    { k; size = 0; keys = Array.make (max k 1) 0L; ids = Array.make (max k 1) 0 }
+
+  let below h i j =
+    let c = Int64.compare h.keys.(i) h.keys.(j) in
+    c < 0 || (c = 0 && h.ids.(i) > h.ids.(j))
+
+  let swap h i j =
+    let k = h.keys.(i) and id = h.ids.(i) in
+    h.keys.(i) <- h.keys.(j);
+    h.ids.(i) <- h.ids.(j);
+    h.keys.(j) <- k;
+    h.ids.(j) <- id
+
+  let rec sift_up h i =
+    let p = (i - 1) / 2 in
+    if i > 0 && below h i p then begin
+      swap h i p;
+      sift_up h p
+    end
+
+  let rec sift_down h i =
+    let l = (2 * i) + 1 in
+    let m = if l < h.size && below h l i then l else i in
+    let m = if l + 1 < h.size && below h (l + 1) m then l + 1 else m in
+    if m <> i then begin
+      swap h i m;
+      sift_down h m
+    end
+
+  let add h key id =
+    if h.size < h.k then begin
+      h.keys.(h.size) <- key;
+      h.ids.(h.size) <- id;
+      h.size <- h.size + 1;
+      sift_up h (h.size - 1)
+    end
+    else if
+      h.k > 0
+      && (Int64.compare key h.keys.(0) > 0
+         || (Int64.equal key h.keys.(0) && id < h.ids.(0)))
+    then begin
+      h.keys.(0) <- key;
+      h.ids.(0) <- id;
+      sift_down h 0
+    end
+
+  let iter h f =
+    for i = 0 to h.size - 1 do
+      f h.keys.(i) h.ids.(i)
+    done
+
+  (** Entries as [(index, balance)], best first. *)
+  let to_list h =
+    List.init h.size (fun i -> (h.ids.(i), h.keys.(i)))
+    |> List.sort (fun (i, a) (j, b) ->
+           match Int64.compare b a with 0 -> compare i j | c -> c)
+end
+
+(** A mapped snapshot, with the columns the OCaml queries use. *)
+module Reader = struct
+  open Bigarray
+
+  type t = {
+    commit : string;  (** Commit the snapshot was taken of *)
+    num_outputs : int;
+    num_addresses : int;
+    out_addr : (int32, int32_elt, c_layout) Array1.t;
+    out_spent_by : (int32, int32_elt, c_layout) Array1.t;
+    out_value : (int64, int64_elt, c_layout) Array1.t;
+    addr_keys_off : (int64, int64_elt, c_layout) Array1.t;
+    addr_keys : (char, int8_unsigned_elt, c_layout) Array1.t;
+    balances : (int64, int64_elt, c_layout) Array1.t Lazy.t;
+  }
+
+  let read_meta dir =
+    let ic = open_in (Filename.concat dir meta_file) in
+    Fun.protect
+      ~finally:(fun () -> close_in ic)
+      (fun () ->
+        let rec go acc =
+          match input_line ic with
+          | line -> (
+              match String.split_on_char ' ' line with
+              | [ key; value ] -> go ((key, value) :: acc)
+              | _ -> go acc)
+          | exception End_of_file -> acc
+        in
+        go [])
+
+  let map dir name kind n =
+    if n = 0 then Array1.create kind c_layout 0
+    else
+      let fd = Unix.openfile (Filename.concat dir name) [ Unix.O_RDONLY ] 0 in
+      Fun.protect
+        ~finally:(fun () -> Unix.close fd)
+        (fun () ->
+          array1_of_genarray (Unix.map_file fd kind c_layout false [| n |]))
+
+  (* Value of unspent outputs per address index, in one pass over outputs *)
+  let compute_balances num_outputs num_addresses out_addr out_spent_by out_value =
+    let b = Array1.create int64 c_layout num_addresses in
+    Array1.fill b 0L;
+    for o = 0 to num_outputs - 1 do
+      let a = Int32.to_int out_addr.{o} land none in
+      if Int32.equal out_spent_by.{o} (-1l) && a < num_addresses then
+        b.{a} <- Int64.add b.{a} out_value.{o}
+    done;
+    b
+
+  (** Map the snapshot in [dir], or [None] if it is missing or from another
+      version. *)
+  let open_ dir =
+    if not (Sys.file_exists (Filename.concat dir meta_file)) then None
+    else
+      let meta = read_meta dir in
+      let count key =
+        Option.value ~default:0
+          (Option.bind (List.assoc_opt key meta) int_of_string_opt)
+      in
+      if count "version" <> version then None
+      else
+        let num_outputs = count "outputs" and num_addresses = count "addresses" in
+        let out_addr = map dir out_addr_file int32 num_outputs in
+        let out_spent_by = map dir out_spent_by_file int32 num_outputs in
+        let out_value = map dir out_value_file int64 num_outputs in
+        let addr_keys_off = map dir addr_keys_off_file int64 (num_addresses + 1) in
+        let addr_keys =
+          map dir addr_keys_file char (Int64.to_int addr_keys_off.{num_addresses})
+        in
+        Some
+          {
+            commit = Option.value (List.assoc_opt "commit" meta) ~default:"";
+            num_outputs;
+            num_addresses;
+            out_addr;
+            out_spent_by;
+            out_value;
+            addr_keys_off;
+            addr_keys;
+            balances =
+              lazy
+                (compute_balances num_outputs num_addresses out_addr
+                   out_spent_by out_value);
+          }
+
+  (** Address ID of address index [a]. *)
+  let address_key t a =
+    let off = Int64.to_int t.addr_keys_off.{a} in
+    String.init
+      (Int64.to_int t.addr_keys_off.{a + 1} - off)
+      (fun i -> t.addr_keys.{off + i})
+
+  (** The [k] addresses with the highest balance (value of unspent
+      outputs), best first, as [(address_id, balance)].
+
+      Balances are computed once per reader. Each of [domains] domains
+      then keeps a bounded heap over a slice of the addresses, and the
+      heaps are merged at the end. [k] is clamped to the number of
+      addresses, since each heap is allocated at size [k]. *)
+  let top_balances ?(domains = Domain.recommended_domain_count ()) t k =
+    let balances = Lazy.force t.balances in
+    let n = t.num_addresses in
+    let k = max 0 (min k n) in
+    let domains = max 1 (min domains (n / 4096 + 1)) in
+    let slice d () =
+      let h = Top_k.create k in
+      for a = n * d / domains to (n * (d + 1) / domains) - 1 do
+        let b = balances.{a} in
+        if Int64.compare b 0L > 0 then Top_k.add h b a
+      done;
+      h
+    in
+    let workers = List.init (domains - 1) (fun d -> Domain.spawn (slice (d + 1))) in
+    let first = slice 0 () in
+    let merged = Top_k.create k in
+    List.iter
+      (fun h -> Top_k.iter h (Top_k.add merged))
+      (first :: List.map Domain.join workers);
+    Top_k.to_list merged |> List.map (fun (a, b) -> (address_key t a, b))
+end
@@ -30,22 +30,48 @@ let addr_output_path addr tx_id vout =
 let output_addr_path tx_id vout =
   [ "index"; "output_addr"; string_of_int tx_id; string_of_int vout ]
 
-let spent_by_path tx_id vout =
-  [ "index"; "spent_by"; string_of_int tx_id; string_of_int vout ]
+let spent_by_tx_path tx_id = [ "index"; "spent_by"; string_of_int tx_id ]
+let spent_by_path tx_id vout = spent_by_tx_path tx_id @ [ string_of_int vout ]
+
+let layout_path = [ "meta"; "layout" ]
+let summaries_path = [ "meta"; "summaries" ]
+let output_values_path = [ "meta"; "output_values" ]
+let records_path = [ "meta"; "records" ]
+let dict_path name = [ "meta"; "dict"; name ]
+let dict_entry_path name code = dict_path name @ [ string_of_int code ]
+
+(** Transaction ID in an index key, the base that {!Types.entity_to_value}
+    delta-encodes leaves against (0 for keys without one). *)
+let index_base = function
+  | "index" :: ("tx_inputs" | "tx_outputs" | "output_addr" | "spent_by") :: tx :: _
+    ->
+      Option.value (int_of_string_opt tx) ~default:0
+  | [ "index"; "addr_outputs"; _; key ] -> (
+      match String.index_opt key ':' with
+      | Some i -> Option.value (int_of_string_opt (String.sub key 0 i)) ~default:0
+      | None -> 0)
+  | _ -> 0
+
+let encode ?binary path entity =
+  Types.entity_to_value ?binary ~base:(index_base path) entity
 
 let init ~sw ~fs root =
   let config = Irmin_pack.Conf.init ~sw ~fs root in
   Store.Repo.v config
 
-let main repo = Store.main repo
+(** Hash of the head commit, as printed by Irmin. *)
+let head_hash store =
+  match Store.Head.find store with
+  | None -> None
+  | Some commit ->
+      Some (Irmin.Type.to_string Store.Hash.t (Store.Commit.hash commit))
 
 let info msg =
   Store.Info.v ~author:"irmin-blocksci" ~message:msg
     (Int64.of_float (Unix.time ()))
 
 let set store path entity =
-  let json = Types.entity_to_json entity in
-  Store.set_exn ~info:(fun () -> info "import") store path json
+  Store.set_exn ~info:(fun () -> info "import") store path (encode path entity)
 
 (* Batch operations for efficient bulk imports *)
 module Batch = struct
@@ -54,39 +80,70 @@ module Batch = struct
     mutable tree : Store.tree;
     mutable count : int;
     batch_size : int;
+    binary : bool;  (** Write blocks and txs as binary records *)
+    deferred : bool;
+        (** Keep every write in [tree] until the caller commits it *)
   }
 
-  let create ?(batch_size = 10000) store =
+  let create ?(batch_size = 10000) ?(binary = false) ?(deferred = false) store =
     let tree =
       match Store.Head.find store with
       | Some commit -> Store.Commit.tree commit
       | None -> Store.Tree.empty ()
     in
-    { store; tree; count = 0; batch_size }
+    { store; tree; count = 0; batch_size; binary; deferred }
+
+  (* Dictionary codes are assigned as rows are read, so the ones assigned
+     since the last save go into every commit: a commit never holds a code
+     without its dictionary entry *)
+  let commit batch =
+    List.iter
+      (fun (d : Dict.t) ->
+        List.iter
+          (fun (code, name) ->
+            let path = dict_entry_path d.name code in
+            batch.tree <- Store.Tree.add batch.tree path (encode path (Meta name)))
+          (Dict.unsaved d);
+        Dict.mark_saved d)
+      Dict.all;
+    Store.set_tree_exn ~info:(fun () -> info "batch import") batch.store [] batch.tree;
+    batch.count <- 0
 
   let set batch path entity =
-    let json = Types.entity_to_json entity in
-    batch.tree <- Store.Tree.add batch.tree path json;
+    batch.tree <-
+      Store.Tree.add batch.tree path (encode ~binary:batch.binary path entity);
     batch.count <- batch.count + 1;
-    if batch.count >= batch.batch_size then begin
-      Store.set_tree_exn ~info:(fun () -> info "batch import") batch.store [] batch.tree;
-      batch.count <- 0
-    end
+    if batch.count >= batch.batch_size && not batch.deferred then commit batch
 
-  let flush batch =
-    if batch.count > 0 then begin
-      Store.set_tree_exn ~info:(fun () -> info "batch import") batch.store [] batch.tree;
-      batch.count <- 0
-    end
+  let flush batch = if batch.count > 0 && not batch.deferred then commit batch
 
   let mem batch path =
     Store.Tree.mem batch.tree path
+
+  (** Entity at [path] in the pending tree. *)
+  let get batch path =
+    Option.bind (Store.Tree.find batch.tree path)
+      (Types.value_to_entity ~base:(index_base path))
+
+  (** Keys directly under [path] in the pending tree. *)
+  let list batch path = Store.Tree.list batch.tree path |> List.map fst
+
+  (** Entities of the leaves directly under [path] in the pending tree. *)
+  let children batch path =
+    list batch path |> List.filter_map (fun key -> get batch (path @ [ key ]))
+
+  (** Write the codes [d] assigned since it was last saved. *)
+  let save_dict batch (d : Dict.t) =
+    List.iter
+      (fun (code, name) -> set batch (dict_entry_path d.name code) (Meta name))
+      (Dict.unsaved d);
+    Dict.mark_saved d
 end
 
 let get store path =
   match Store.find store path with
   | None -> None
-  | Some json -> Types.json_to_entity json
+  | Some value -> Types.value_to_entity ~base:(index_base path) value
 
 let list store path =
   try Store.list store path |> List.map fst
@@ -94,3 +151,25 @@ let list store path =
     Printf.printf "Error listing path %s: %s\n%!" (String.concat "/" path)
       (Printexc.to_string e);
     []
+
+(** Load the dictionaries persisted under [meta/dict] into {!Dict}. *)
+let load_dicts store =
+  List.iter
+    (fun (d : Dict.t) ->
+      List.iter
+        (fun key ->
+          match int_of_string_opt key with
+          | None -> ()
+          | Some code -> (
+              match get store (dict_entry_path d.name code) with
+              | Some (Types.Meta name) -> Dict.set d code name
+              | _ -> ()))
+        (list store (dict_path d.name)))
+    Dict.all
+
+(** Main branch of [repo], with its dictionaries loaded so coded records
+    decode to names. *)
+let main repo =
+  let store = Store.main repo in
+  load_dicts store;
+  store
@@ -40,6 +40,21 @@ type address = {
 type output_ref = {
   ref_tx_id : int;
   ref_vout : int;
+  ref_value : int64 option;  (** Value of the output, if embedded *)
+  ref_script : int option;  (** Its {!Dict} script type code, if embedded *)
+}
+
+(** Per-transaction fields denormalised into [index/block_txs] leaves, so
+    tx-level scans need one read per transaction. *)
+type tx_summary = {
+  sum_tx_id : int;
+  sum_fee : int64;
+  sum_locktime : int64;
+  sum_version : int;
+  sum_inputs : int;
+  sum_outputs : int;
+  sum_output_value : int64;
+  sum_max_output_value : int64;
 }
 
 type entity =
@@ -49,7 +64,10 @@ type entity =
   | Input of input
   | Address of address
   | OutputRef of output_ref
+  | OutputRefs of output_ref list  (** Packed [index/tx_outputs/<tx>] *)
+  | Inputs of input list  (** Packed [index/tx_inputs/<tx>] *)
   | TxRef of int
+  | TxSummary of tx_summary  (** TxRef with summary fields *)
   | AddrRef of string
   | Meta of string
 
@@ -64,9 +82,13 @@ let transaction_to_json t =
     t.tx_id t.tx_hash t.tx_locktime t.tx_version t.tx_fee t.tx_size t.tx_weight
     t.tx_block_height
 
+(* Script and address types are stored as {!Dict} codes. The importer
+   assigns them; a value without one is written as {!Dict.none} *)
 let output_to_json o =
-  Printf.sprintf {|{"type":"out","value":%Ld,"script":"%s","tx":%d,"vout":%d}|}
-    o.out_value o.out_script_type o.out_tx_id o.out_vout
+  Printf.sprintf {|{"type":"out","value":%Ld,"script":%d,"tx":%d,"vout":%d}|}
+    o.out_value
+    (Dict.code_or_none Dict.script_types o.out_script_type)
+    o.out_tx_id o.out_vout
 
 let input_to_json i =
   Printf.sprintf
@@ -74,10 +96,15 @@ let input_to_json i =
     i.in_spent_tx_id i.in_spent_vout i.in_index i.in_sequence
 
 let address_to_json a =
-  Printf.sprintf {|{"type":"addr","str":"%s","typ":"%s"|} a.addr_str a.addr_type
+  Printf.sprintf {|{"type":"addr","str":"%s","typ":%d}|} a.addr_str
+    (Dict.code_or_none Dict.addr_types a.addr_type)
 
 let output_ref_to_json r =
-  Printf.sprintf {|{"type":"oref","tx":%d,"vout":%d}|} r.ref_tx_id r.ref_vout
+  match (r.ref_value, r.ref_script) with
+  | Some value, Some script ->
+      Printf.sprintf {|{"type":"oref","tx":%d,"vout":%d,"value":%Ld,"script":%d}|}
+        r.ref_tx_id r.ref_vout value script
+  | _ -> Printf.sprintf {|{"type":"oref","tx":%d,"vout":%d}|} r.ref_tx_id r.ref_vout
 
 let entity_to_json = function
   | Block b -> block_to_json b
@@ -86,10 +113,228 @@ let entity_to_json = function
   | Input i -> input_to_json i
   | Address a -> address_to_json a
   | OutputRef r -> output_ref_to_json r
+  | OutputRefs rs ->
+      Printf.sprintf {|{"type":"orefs","refs":[%s]}|}
+        (String.concat "," (List.map output_ref_to_json rs))
+  | Inputs is ->
+      Printf.sprintf {|{"type":"ins","inputs":[%s]}|}
+        (String.concat "," (List.map input_to_json is))
   | TxRef tx_id -> Printf.sprintf {|{"type":"txref","id":%d}|} tx_id
+  | TxSummary t ->
+      Printf.sprintf
+        {|{"type":"txsum","id":%d,"fee":%Ld,"locktime":%Ld,"version":%d,"inputs":%d,"outputs":%d,"value":%Ld,"max_value":%Ld}|}
+        t.sum_tx_id t.sum_fee t.sum_locktime t.sum_version t.sum_inputs
+        t.sum_outputs t.sum_output_value t.sum_max_output_value
   | AddrRef addr -> Printf.sprintf {|{"type":"addrref","addr":"%s"}|} addr
   | Meta data -> Printf.sprintf {|{"type":"meta","data":"%s"}|} data
 
+(** {1 Binary index leaves}
+
+    TxRef and OutputRef leaves are the bulk of the index, so they are stored
+    as a tag byte followed by LEB128 varints rather than JSON:
+
+    {v
+    0x01 zigzag(id - base)          TxRef
+    0x02 zigzag(tx - base) vout     OutputRef
+    0x03 n (zigzag(tx - base) vout)*n                  OutputRefs
+    0x04 n (zigzag(spent_tx - base) spent_vout idx seq)*n  Inputs
+    0x05 zigzag(id - base) ...                            Old TxSummary (below)
+    0x06 zigzag(tx - base) vout zigzag(value) script       OutputRef with value
+    0x07 n (zigzag(tx - base) vout zigzag(value) script)*n  OutputRefs with values
+    0x08 height hash[32] zigzag(timestamp) zigzag(nonce) zigzag(bits)
+         zigzag(version)                                   Block
+    0x09 id hash[32] zigzag(locktime) zigzag(version) zigzag(fee) size
+         weight zigzag(block)                              Transaction
+    0x0A zigzag(id - base) zigzag(fee) zigzag(locktime) zigzag(version)
+         inputs outputs zigzag(value) zigzag(max_value)    TxSummary
+    v}
+
+    [base] is the transaction ID in the leaf's key (see {!Store.index_base}),
+    which makes most deltas a single byte. Leaves written before this
+    encoding are JSON and still decode. The packed [OutputRefs] and [Inputs]
+    values and [TxSummary] only exist in binary form. [0x05] summaries
+    hold the version as a plain varint, which would decode halved as
+    zigzag; they are read as the TxRef they start with, so callers fall
+    back to the tx record until an import rewrites them.
+
+    Block and Transaction records are JSON unless the store was imported
+    with binary records, which hold the hash as 32 raw bytes instead of 64
+    hex digits. Hashes are hex again once decoded, so callers never see
+    the raw form. *)
+
+let txref_tag = '\x01'
+let oref_tag = '\x02'
+let orefs_tag = '\x03'
+let inputs_tag = '\x04'
+let txsum_v1_tag = '\x05'
+let oref_value_tag = '\x06'
+let orefs_value_tag = '\x07'
+let block_tag = '\x08'
+let tx_tag = '\x09'
+let txsum_tag = '\x0A'
+
+let add_varint buf n =
+  let rec go n =
+    if n < 0x80 then Buffer.add_char buf (Char.chr n)
+    else begin
+      Buffer.add_char buf (Char.chr (n land 0x7F lor 0x80));
+      go (n lsr 7)
+    end
+  in
+  go n
+
+let zigzag n = (n lsl 1) lxor (n asr (Sys.int_size - 1))
+let unzigzag n = (n lsr 1) lxor -(n land 1)
+
+(* Varint at [pos] in [s], with the position after it *)
+(* [None] on a truncated varint or one longer than 10 bytes, which no
+   63-bit value needs (the C reader stops at the same point) *)
+let read_varint s pos =
+  let rec go pos shift acc =
+    if pos >= String.length s || shift > 63 then None
+    else
+      let b = Char.code s.[pos] in
+      let acc = acc lor ((b land 0x7F) lsl shift) in
+      if b < 0x80 then Some (acc, pos + 1) else go (pos + 1) (shift + 7) acc
+  in
+  go pos 0 0
+
+(** {2 Hex} *)
+
+let hex_digits = "0123456789abcdef"
+
+(* Nibble value of each byte, or -1 *)
+let hex_values =
+  Array.init 256 (fun c ->
+      match Char.chr c with
+      | '0' .. '9' -> c - Char.code '0'
+      | 'a' .. 'f' -> c - Char.code 'a' + 10
+      | 'A' .. 'F' -> c - Char.code 'A' + 10
+      | _ -> -1)
+
+(** Lowercase hex of [len] raw bytes of [s] at [pos]. *)
+let hex_of_raw s pos len =
+  Bytes.init (2 * len) (fun i ->
+      let b = Char.code s.[pos + (i / 2)] in
+      hex_digits.[if i land 1 = 0 then b lsr 4 else b land 0xF])
+  |> Bytes.unsafe_to_string
+
+(** Raw bytes of a hex string, or [None] if it is not hex. *)
+let raw_of_hex h =
+  let n = String.length h in
+  if n land 1 <> 0 then None
+  else
+    let out = Bytes.create (n / 2) in
+    let rec go i =
+      if i = n / 2 then Some (Bytes.unsafe_to_string out)
+      else
+        let hi = hex_values.(Char.code h.[2 * i])
+        and lo = hex_values.(Char.code h.[(2 * i) + 1]) in
+        if hi < 0 || lo < 0 then None
+        else begin
+          Bytes.set out i (Char.chr ((hi lsl 4) lor lo));
+          go (i + 1)
+        end
+    in
+    go 0
+
+(* Raw form of a 32-byte hash, if it is in the lowercase hex that decoding
+   gives back; other hashes keep their record in JSON *)
+let raw_hash h =
+  if String.length h <> 64 then None
+  else
+    match raw_of_hex h with
+    | Some raw when hex_of_raw raw 0 32 = h -> Some raw
+    | _ -> None
+
+let has_value r = Option.is_some r.ref_value && Option.is_some r.ref_script
+
+let add_output_ref buf ~base ~value r =
+  add_varint buf (zigzag (r.ref_tx_id - base));
+  add_varint buf r.ref_vout;
+  if value then begin
+    add_varint buf (zigzag (Int64.to_int (Option.get r.ref_value)));
+    add_varint buf (Option.get r.ref_script)
+  end
+
+(** Stored value of [entity] at a key whose transaction ID is [base].
+    With [~binary], blocks and transactions are binary records. *)
+let entity_to_value ?(binary = false) ~base entity =
+  match entity with
+  | Block b when binary && Option.is_some (raw_hash b.hash) ->
+      let buf = Buffer.create 48 in
+      Buffer.add_char buf block_tag;
+      add_varint buf b.height;
+      Buffer.add_string buf (Option.get (raw_hash b.hash));
+      List.iter (add_varint buf)
+        [
+          zigzag (Int64.to_int b.timestamp);
+          zigzag (Int64.to_int b.nonce);
+          zigzag (Int64.to_int b.bits);
+          zigzag b.version;
+        ];
+      Buffer.contents buf
+  | Transaction t when binary && Option.is_some (raw_hash t.tx_hash) ->
+      let buf = Buffer.create 48 in
+      Buffer.add_char buf tx_tag;
+      add_varint buf t.tx_id;
+      Buffer.add_string buf (Option.get (raw_hash t.tx_hash));
+      List.iter (add_varint buf)
+        [
+          zigzag (Int64.to_int t.tx_locktime);
+          zigzag t.tx_version;
+          zigzag (Int64.to_int t.tx_fee);
+          t.tx_size;
+          t.tx_weight;
+          zigzag t.tx_block_height;
+        ];
+      Buffer.contents buf
+  | TxRef id ->
+      let buf = Buffer.create 4 in
+      Buffer.add_char buf txref_tag;
+      add_varint buf (zigzag (id - base));
+      Buffer.contents buf
+  | OutputRef r ->
+      let buf = Buffer.create 4 in
+      Buffer.add_char buf (if has_value r then oref_value_tag else oref_tag);
+      add_output_ref buf ~base ~value:(has_value r) r;
+      Buffer.contents buf
+  | OutputRefs rs ->
+      let value = rs <> [] && List.for_all has_value rs in
+      let buf = Buffer.create 16 in
+      Buffer.add_char buf (if value then orefs_value_tag else orefs_tag);
+      add_varint buf (List.length rs);
+      List.iter (add_output_ref buf ~base ~value) rs;
+      Buffer.contents buf
+  | Inputs is ->
+      let buf = Buffer.create 32 in
+      Buffer.add_char buf inputs_tag;
+      add_varint buf (List.length is);
+      List.iter
+        (fun i ->
+          add_varint buf (zigzag (i.in_spent_tx_id - base));
+          add_varint buf i.in_spent_vout;
+          add_varint buf i.in_index;
+          add_varint buf (Int64.to_int i.in_sequence))
+        is;
+      Buffer.contents buf
+  | TxSummary t ->
+      let buf = Buffer.create 16 in
+      Buffer.add_char buf txsum_tag;
+      List.iter (add_varint buf)
+        [
+          zigzag (t.sum_tx_id - base);
+          zigzag (Int64.to_int t.sum_fee);
+          zigzag (Int64.to_int t.sum_locktime);
+          zigzag t.sum_version;
+          t.sum_inputs;
+          t.sum_outputs;
+          zigzag (Int64.to_int t.sum_output_value);
+          zigzag (Int64.to_int t.sum_max_output_value);
+        ];
+      Buffer.contents buf
+  | e -> entity_to_json e
+
 let parse_int64 s = Int64.of_string s
 let parse_int s = int_of_string s
 
@@ -99,6 +344,15 @@ let parse_string s =
     String.sub s 1 (len - 2)
   else s
 
+(* A dictionary-coded field: a code, or the string itself in stores
+   imported before codes were introduced *)
+let parse_code d s =
+  if String.length s > 0 && s.[0] = '"' then parse_string s
+  else
+    match Option.bind (int_of_string_opt s) (Dict.name d) with
+    | Some name -> name
+    | None -> "unknown"
+
 let find_field json key =
   let pattern = Printf.sprintf "\"%s\":" key in
   match String.index_opt json '"' with
@@ -200,7 +454,7 @@ let json_to_entity json =
                 (Output
                    {
                      out_value = parse_int64 v;
-                     out_script_type = parse_string s;
+                     out_script_type = parse_code Dict.script_types s;
                      out_tx_id = parse_int t;
                      out_vout = parse_int vo;
                    })
@@ -225,12 +479,21 @@ let json_to_entity json =
       | "addr" -> (
           match (find_field json "str", find_field json "typ") with
           | Some s, Some t ->
-              Some (Address { addr_str = parse_string s; addr_type = parse_string t })
+              Some
+                (Address
+                   { addr_str = parse_string s; addr_type = parse_code Dict.addr_types t })
           | _ -> None)
       | "oref" -> (
           match (find_field json "tx", find_field json "vout") with
           | Some t, Some v ->
-              Some (OutputRef { ref_tx_id = parse_int t; ref_vout = parse_int v })
+              Some
+                (OutputRef
+                   {
+                     ref_tx_id = parse_int t;
+                     ref_vout = parse_int v;
+                     ref_value = Option.map parse_int64 (find_field json "value");
+                     ref_script = Option.map parse_int (find_field json "script");
+                   })
           | _ -> None)
       | "txref" -> (
           match find_field json "id" with
@@ -245,3 +508,120 @@ let json_to_entity json =
           | Some d -> Some (Meta (parse_string d))
           | None -> None)
       | _ -> None)
+
+(* [k] varints from [pos], with the position after them *)
+let read_fields s pos k =
+  let rec go pos k acc =
+    if k = 0 then Some (List.rev acc, pos)
+    else
+      match read_varint s pos with
+      | None -> None
+      | Some (v, pos) -> go pos (k - 1) (v :: acc)
+  in
+  go pos k []
+
+(* A count then that many varint groups of [arity] from [pos], built with [f] *)
+let read_packed s pos arity f =
+  match read_varint s pos with
+  | None -> None
+  | Some (n, pos) ->
+      let rec go pos k acc =
+        if k = 0 then Some (List.rev acc)
+        else
+          match read_fields s pos arity with
+          | None -> None
+          | Some (vs, pos) -> go pos (k - 1) (f vs :: acc)
+      in
+      go pos n []
+
+let output_ref_of_fields ~base = function
+  | [ d; vout ] ->
+      { ref_tx_id = base + unzigzag d; ref_vout = vout; ref_value = None; ref_script = None }
+  | [ d; vout; value; script ] ->
+      {
+        ref_tx_id = base + unzigzag d;
+        ref_vout = vout;
+        ref_value = Some (Int64.of_int (unzigzag value));
+        ref_script = Some script;
+      }
+  | _ -> assert false
+
+(** Inverse of {!entity_to_value}; also reads JSON leaves. *)
+let value_to_entity ~base s =
+  match if String.length s > 0 then s.[0] else '{' with
+  | tag when tag = txref_tag || tag = txsum_v1_tag ->
+      Option.map (fun (d, _) -> TxRef (base + unzigzag d)) (read_varint s 1)
+  | tag when tag = oref_tag || tag = oref_value_tag -> (
+      match read_fields s 1 (if tag = oref_tag then 2 else 4) with
+      | Some (fields, _) -> Some (OutputRef (output_ref_of_fields ~base fields))
+      | None -> None)
+  | tag when tag = orefs_tag || tag = orefs_value_tag ->
+      read_packed s 1
+        (if tag = orefs_tag then 2 else 4)
+        (output_ref_of_fields ~base)
+      |> Option.map (fun rs -> OutputRefs rs)
+  | tag when tag = inputs_tag ->
+      read_packed s 1 4 (function
+        | [ d; vout; idx; seq ] ->
+            {
+              in_spent_tx_id = base + unzigzag d;
+              in_spent_vout = vout;
+              in_index = idx;
+              in_sequence = Int64.of_int seq;
+            }
+        | _ -> assert false)
+      |> Option.map (fun is -> Inputs is)
+  | tag when tag = txsum_tag -> (
+      match read_fields s 1 8 with
+      | Some ([ d; fee; locktime; version; inputs; outputs; value; max_value ], _)
+        ->
+          Some
+            (TxSummary
+               {
+                 sum_tx_id = base + unzigzag d;
+                 sum_fee = Int64.of_int (unzigzag fee);
+                 sum_locktime = Int64.of_int (unzigzag locktime);
+                 sum_version = unzigzag version;
+                 sum_inputs = inputs;
+                 sum_outputs = outputs;
+                 sum_output_value = Int64.of_int (unzigzag value);
+                 sum_max_output_value = Int64.of_int (unzigzag max_value);
+               })
+      | _ -> None)
+  | tag when tag = block_tag -> (
+      match read_varint s 1 with
+      | Some (height, pos) when pos + 32 <= String.length s -> (
+          match read_fields s (pos + 32) 4 with
+          | Some ([ ts; nonce; bits; version ], _) ->
+              Some
+                (Block
+                   {
+                     height;
+                     hash = hex_of_raw s pos 32;
+                     timestamp = Int64.of_int (unzigzag ts);
+                     nonce = Int64.of_int (unzigzag nonce);
+                     bits = Int64.of_int (unzigzag bits);
+                     version = unzigzag version;
+                   })
+          | _ -> None)
+      | _ -> None)
+  | tag when tag = tx_tag -> (
+      match read_varint s 1 with
+      | Some (id, pos) when pos + 32 <= String.length s -> (
+          match read_fields s (pos + 32) 6 with
+          | Some ([ locktime; version; fee; size; weight; block ], _) ->
+              Some
+                (Transaction
+                   {
+                     tx_id = id;
+                     tx_hash = hex_of_raw s pos 32;
+                     tx_locktime = Int64.of_int (unzigzag locktime);
+                     tx_version = unzigzag version;
+                     tx_fee = Int64.of_int (unzigzag fee);
+                     tx_size = size;
+                     tx_weight = weight;
+                     tx_block_height = unzigzag block;
+                   })
+          | _ -> None)
+      | _ -> None)
+  | _ -> json_to_entity s
@@ -33,6 +33,7 @@ RETURN max(t.fee) AS value;
 // --- Satoshi Dice address ---
 // Sum of outputs sent to a specific address (Satoshi Dice)
 // Note: Replace ADDRESS_ID with the actual internal address ID
+// The benchmarks take it on the command line: -a ADDRESS_ID[,ADDRESS_ID...]
 // MATCH (a:Address)<-[:TO_ADDRESS]-(o:Output)
 // WHERE id(a) = ADDRESS_ID
 // RETURN sum(o.value) AS value;
@@ -0,0 +1,135 @@
+(* Runs the queries of queries.cypher, and the cases that needed fixes,
+   against a store imported from the small export in fixture/ and checks
+   their rows.
+
+   The fixture has three blocks and six transactions. Tx 4 (block 2) has
+   locktime 100, version 2 and a 20 BTC fee, and spends outputs of txs 1
+   and 2; tx 5 spends its output in the same block. *)
+
+open Blocksci
+
+let genesis_hash = "00000000000000000000000000000000000000000000000000000000000003e8"
+
+(* Expected rows of the queries in queries.cypher, by their "// --- name ---"
+   heading *)
+let expected =
+  [
+    ("Tx locktime > 0", [ [ "1" ] ]);
+    ("Max output value", [ [ "6000000000" ] ]);
+    ("Calculate fee", [ [ "2000000000" ] ]);
+    ("Zero-conf outputs", [ [ "1" ] ]);
+    ("Locktime change", [ [ "1" ] ]);
+    ("Sum output value", [ [ "31998990000" ] ]);
+    ("Sum fees", [ [ "2001010000" ] ]);
+    ("Max input value", [ [ "6000000000" ] ]);
+    ("Tx version > 1", [ [ "1" ] ]);
+    ("Input count", [ [ "4" ] ]);
+    ("Output count", [ [ "7" ] ]);
+    ("Block count", [ [ "3" ] ]);
+    ("Transaction count", [ [ "6" ] ]);
+    ("Address count", [ [ "4" ] ]);
+    ("Spent outputs", [ [ "4" ] ]);
+    ("Unspent outputs (UTXOs)", [ [ "3" ] ]);
+    ("Avg tx per block", [ [ "2" ] ]);
+    ("Max tx per block", [ [ "3" ] ]);
+    ("High-value tx", [ [ "1" ] ]);
+    ("Multi-input tx", [ [ "0" ] ]);
+    ("Genesis block", [ [ genesis_hash; "1231006505" ] ]);
+    ("Block 170 (first real transaction)", [ [ "0" ] ]);
+    ("Script type distribution", [ [ "pubkeyhash"; "6" ]; [ "witness_v0_keyhash"; "1" ] ]);
+    ("Address type distribution", [ [ "pubkeyhash"; "3" ]; [ "witness_v0_keyhash"; "1" ] ]);
+  ]
+
+(* Queries outside queries.cypher: (name, query, params, rows) *)
+let extra =
+  [
+    ( "addressId literal",
+      "MATCH (a:Address {addressId: 1}) RETURN a.addressId AS id",
+      [],
+      [ [ "1" ] ] );
+    ( "addressId in WHERE",
+      "MATCH (a:Address) WHERE a.addressId = 3 RETURN count(a) AS value",
+      [],
+      [ [ "1" ] ] );
+    ( "addressId parameter",
+      "MATCH (a:Address {addressId: $id})<-[:TO_ADDRESS]-(o:Output) RETURN sum(o.value) AS value",
+      [ ("id", Cypher.value_of_string "4") ],
+      [ [ "6000000000" ] ] );
+    ( "Pattern predicate after WITH",
+      "MATCH (t:Transaction) WITH t WHERE (t)-[:TX_INPUT]->() RETURN count(t) AS value",
+      [],
+      [ [ "3" ] ] );
+    ( "Aggregate filtered after WITH",
+      "MATCH (o:Output)-[:TO_ADDRESS]->(a:Address) WITH a, sum(o.value) AS total \
+       WHERE total > 6000000000 RETURN count(a) AS value",
+      [],
+      [ [ "2" ] ] );
+  ]
+
+(* (heading, query) for each statement of [file] *)
+let statements file =
+  let ic = open_in file in
+  let rec go name lines acc =
+    match input_line ic with
+    | exception End_of_file -> List.rev acc
+    | line -> (
+        let line = String.trim line in
+        if String.starts_with ~prefix:"// ---" line then
+          let heading =
+            String.sub line 6 (String.length line - 6)
+            |> String.trim
+            |> fun s ->
+            if String.ends_with ~suffix:"---" s then
+              String.trim (String.sub s 0 (String.length s - 3))
+            else s
+          in
+          go (Some heading) [] acc
+        else if line = "" || String.starts_with ~prefix:"//" line then go name lines acc
+        else
+          let lines = line :: lines in
+          if not (String.ends_with ~suffix:";" line) then go name lines acc
+          else
+            let query = String.concat " " (List.rev lines) in
+            let query = String.sub query 0 (String.length query - 1) in
+            match name with
+            | Some n -> go None [] ((n, query) :: acc)
+            | None -> go None [] acc)
+  in
+  Fun.protect ~finally:(fun () -> close_in ic) (fun () -> go None [] [])
+
+let show rows = String.concat "; " (List.map (String.concat ", ") rows)
+
+let () =
+  Eio_main.run @@ fun env ->
+  Eio.Switch.run @@ fun sw ->
+  let fs = Eio.Stdenv.fs env in
+  let store_path = "cypher-test-store" in
+  ignore (Sys.command ("rm -rf " ^ store_path));
+  let repo = Store.init ~sw ~fs Eio.Path.(fs / store_path) in
+  let store = Store.main repo in
+  Import.import_all store Eio.Path.(fs / "fixture");
+  let failures = ref 0 in
+  let check name ?(params = []) query rows =
+    match Cypher.run ~params store query with
+    | exception Cypher.Error msg ->
+        incr failures;
+        Printf.printf "FAIL %s: %s\n" name msg
+    | result ->
+        let got = List.map (List.map Cypher.to_string) result.Cypher.rows in
+        if got <> rows then begin
+          incr failures;
+          Printf.printf "FAIL %s: expected [%s], got [%s]\n" name (show rows) (show got)
+        end
+  in
+  let queries = statements "../queries.cypher" in
+  List.iter
+    (fun (name, rows) ->
+      match List.assoc_opt name queries with
+      | Some query -> check name query rows
+      | None ->
+          incr failures;
+          Printf.printf "FAIL %s: not in queries.cypher\n" name)
+    expected;
+  List.iter (fun (name, query, params, rows) -> check name ~params query rows) extra;
+  Store.Store.Repo.close repo;
+  if !failures > 0 then exit 1